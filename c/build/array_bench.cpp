@@ -0,0 +1,69 @@
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "espresso.hpp"
+
+using namespace std;
+
+/**
+ * Element-wise throughput of x*y + x on packed real arrays at each
+ *  kernel level, against the same expression over boxed values, then a
+ *  check that an element whose overload fails fails the whole operation.
+**/
+int main() {
+	const size_t N = 500000;
+	const int RUNS = 20;
+	
+	vector<esp::Value> xs, ys;
+	for(size_t i = 0; i < N; ++i) {
+		xs.push_back(esp::Value(i*0.5));
+		ys.push_back(esp::Value(1.0 + i%7));
+	}
+	
+	auto start = chrono::steady_clock::now();
+	esp::Value sum(0.0);
+	for(int r = 0; r < RUNS; ++r) {
+		for(size_t i = 0; i < N; ++i) {
+			esp::Value t = xs[i]*ys[i];
+			sum = t + xs[i];
+		}
+	}
+	chrono::duration<double> dt = chrono::steady_clock::now() - start;
+	cout << "boxed: " << (N*RUNS/dt.count()/1e6) << "M elements/s" << endl;
+	
+	auto x = esp::Value::adopt(esp::Array::pack(xs.data(), N));
+	auto y = esp::Value::adopt(esp::Array::pack(ys.data(), N));
+	
+	for(int l = esp::simd::SCALAR; l <= esp::simd::AVX2; ++l) {
+		auto level = esp::simd::setLevel((esp::simd::Level)l);
+		if(level != l) {
+			break;
+		}
+		
+		start = chrono::steady_clock::now();
+		esp::Value res;
+		for(int r = 0; r < RUNS; ++r) {
+			esp::Value t = x*y;
+			res = t + x;
+		}
+		dt = chrono::steady_clock::now() - start;
+		
+		cout << esp::simd::level_name(level) << ": " <<
+			(N*RUNS/dt.count()/1e6) << "M elements/s, last " <<
+			res.asArray()->at(N - 1).toString() << endl;
+	}
+	
+	esp::Environment env;
+	esp::Value obj = env.exec("let sub(r) fail 9; $(\"-\": sub)").value();
+	esp::gc::Handle root(env.heap, &obj);
+	
+	esp::Value elems[] = {obj, esp::Value(5)};
+	auto arr = esp::Value::adopt(esp::Array::pack(elems, 2));
+	auto res = arr - esp::Value(1);
+	bool failed = res.isFailure() && res.toString() == "9";
+	cout << "Failing element: " << (failed? "fails" : "DOESN'T FAIL") <<
+		" the array, " << res.toString() << endl;
+	
+	return !failed;
+}
@@ -0,0 +1,36 @@
+#include <chrono>
+#include <iostream>
+
+#include "espresso.hpp"
+
+using namespace std;
+
+/**
+ * Property access throughput: every term builds a 4 property object
+ *  from the same literal and reads one property back, so each term is
+ *  5 attribute operations on objects of the same layout.
+**/
+int main() {
+	const int TERMS = 1000, RUNS = 200;
+	
+	string src = "$(x: 1, y: 2, z: 3, w: 4).w";
+	for(int i = 1; i < TERMS; ++i) {
+		src += " + $(x: 1, y: 2, z: 3, w: 4).w";
+	}
+	
+	esp::Environment env;
+	auto fn = esp::parse(src);
+	
+	auto start = chrono::steady_clock::now();
+	esp::Value res;
+	for(int i = 0; i < RUNS; ++i) {
+		res = env.exec(fn);
+	}
+	chrono::duration<double> dt = chrono::steady_clock::now() - start;
+	
+	double ops = 5.0*TERMS*RUNS;
+	cout << "Result " << res.toString() << endl;
+	cout << (ops/dt.count()/1e6) << "M property ops/s" << endl;
+	
+	return 0;
+}
@@ -0,0 +1,68 @@
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+#include "espresso.hpp"
+#include "cache.hpp"
+
+using namespace std;
+
+/**
+ * Cold start of a service with many scripts: parsing each one the way
+ *  Environment::exec does against loading each from a bytecode cache
+ *  precompiled at OPT_FULL, checking both run to the same results.
+**/
+int main() {
+	const int SCRIPTS = 300, FUNCTIONS = 40;
+	
+	vector<string> srcs, paths;
+	for(int s = 0; s < SCRIPTS; ++s) {
+		string src;
+		for(int i = 0; i < FUNCTIONS; ++i) {
+			string f = "f" + to_string(i);
+			src += "let " + f + "(a, b) if a < b then (try a*b - " +
+				to_string(s*i) + " catch (e) $(x: a).x + b) else " + f +
+				"(a - 1, b + 2); ";
+		}
+		src += "f0(" + to_string(s) + ", 1) + 999999999999999999 * 1000 + " +
+			"\"s\".length + f" + to_string(s % FUNCTIONS) + "(3, 4)";
+		srcs.push_back(src);
+		
+		char path[64];
+		snprintf(path, sizeof(path), "/tmp/cache_bench%d.espb", s);
+		paths.push_back(path);
+		
+		auto fn = esp::parse(src);
+		esp::cache::write(path, fn, esp::cache::hash(src));
+		fn->release();
+	}
+	
+	esp::Environment env;
+	vector<string> parsed, loaded;
+	
+	auto start = chrono::steady_clock::now();
+	for(auto& src : srcs) {
+		parsed.push_back(env.exec(src).toString());
+	}
+	chrono::duration<double> dt = chrono::steady_clock::now() - start;
+	cout << "Parsed " << SCRIPTS << " scripts: " << dt.count()*1e3 << "ms" << endl;
+	
+	start = chrono::steady_clock::now();
+	for(int s = 0; s < SCRIPTS; ++s) {
+		auto fn = esp::cache::load(paths[s], esp::cache::hash(srcs[s]));
+		loaded.push_back(env.exec(fn).toString());
+		fn->release();
+	}
+	dt = chrono::steady_clock::now() - start;
+	cout << "Loaded " << SCRIPTS << " caches: " << dt.count()*1e3 << "ms" << endl;
+	
+	int bad = 0;
+	for(int s = 0; s < SCRIPTS; ++s) {
+		bad += parsed[s] != loaded[s];
+		remove(paths[s].c_str());
+	}
+	cout << (bad? "Mismatched " : "Matched ") << (SCRIPTS - bad) << "/" <<
+		SCRIPTS << ", e.g. " << loaded[0] << endl;
+	return bad != 0;
+}
@@ -0,0 +1,70 @@
+#include <chrono>
+#include <iostream>
+
+#include "espresso.hpp"
+
+using namespace std;
+
+/**
+ * Script-to-script call throughput with doubly recursive fib, which
+ *  makes 2*fib(n + 1) - 1 calls, then recursion deeper than the native
+ *  stack could take if each call recursed in C++, a tail recursive loop
+ *  which runs in one frame however long it goes, then an embedder
+ *  calling a script callback from a C++ loop.
+**/
+int main() {
+	const int N = 27, DEPTH = 90000, LOOPS = 10000000, HOST_CALLS = 5000000;
+	
+	esp::Environment env;
+	auto fib = esp::parse(
+		"let fib(n) if n < 2 then n else fib(n - 1) + fib(n - 2); fib(" +
+		to_string(N) + ")"
+	);
+	
+	auto start = chrono::steady_clock::now();
+	esp::Value res = env.exec(fib);
+	chrono::duration<double> dt = chrono::steady_clock::now() - start;
+	
+	double a = 0, b = 1;
+	for(int i = 0; i <= N; ++i) {
+		b += a;
+		a = b - a;
+	}
+	double calls = 2*a - 1;
+	cout << "fib(" << N << ") = " << res.toString() << endl;
+	cout << (calls/dt.count()/1e6) << "M calls/s" << endl;
+	
+	auto deep = esp::parse(
+		"let down(n) if n == 0 then 0 else 1 + down(n - 1); down(" +
+		to_string(DEPTH) + ")"
+	);
+	cout << "Depth " << env.exec(deep).toString() << ", " <<
+		env.stack.size() << " registers reserved" << endl;
+	
+	auto loop = esp::parse(
+		"let loop(n, acc) if n == 0 then acc else loop(n - 1, acc + n); "
+		"loop(" + to_string(LOOPS) + ", 0)"
+	);
+	start = chrono::steady_clock::now();
+	res = env.exec(loop);
+	dt = chrono::steady_clock::now() - start;
+	cout << "Tail loop " << res.toString() << ", " <<
+		(LOOPS/dt.count()/1e6) << "M iterations/s" << endl;
+	
+	auto mod = esp::parse("let add(a, b) a + b");
+	esp::Value add = env.exec(mod), acc(0);
+	
+	start = chrono::steady_clock::now();
+	for(int i = 0; i < HOST_CALLS; ++i) {
+		acc = add.call(&env, esp::Value::nil, acc, esp::Value(i&7)).value();
+	}
+	dt = chrono::steady_clock::now() - start;
+	cout << "Callback sum " << acc.toString() << ", " <<
+		(HOST_CALLS/dt.count()/1e6) << "M host calls/s" << endl;
+	
+	fib->release();
+	deep->release();
+	loop->release();
+	mod->release();
+	return 0;
+}
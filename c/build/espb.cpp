@@ -0,0 +1,39 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "espresso.hpp"
+#include "cache.hpp"
+
+using namespace std;
+
+/**
+ * Precompile an Espresso program to a bytecode cache, which
+ *  cache::load maps without parsing: espb prog.esp prog.espb
+**/
+int main(int argc, char* argv[]) {
+	if(argc != 3) {
+		cerr << "Usage: " << argv[0] << " <program.esp> <output.espb>" << endl;
+		return 2;
+	}
+	
+	ifstream in(argv[1]);
+	if(!in) {
+		cerr << "Can't read " << argv[1] << endl;
+		return 1;
+	}
+	stringstream src;
+	src << in.rdbuf();
+	
+	try {
+		string code = src.str();
+		auto fn = esp::parse(code);
+		esp::cache::write(argv[2], fn, esp::cache::hash(code));
+		fn->release();
+	}
+	catch(const exception& e) {
+		cerr << argv[1] << ": " << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
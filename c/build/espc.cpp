@@ -0,0 +1,45 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "espresso.hpp"
+#include "aot.hpp"
+
+using namespace std;
+
+/**
+ * Translate an Espresso program to C++, which builds into a native
+ *  program against the runtime: espc prog.esp prog.cpp
+**/
+int main(int argc, char* argv[]) {
+	if(argc != 3) {
+		cerr << "Usage: " << argv[0] << " <program.esp> <output.cpp>" << endl;
+		return 2;
+	}
+	
+	ifstream in(argv[1]);
+	if(!in) {
+		cerr << "Can't read " << argv[1] << endl;
+		return 1;
+	}
+	stringstream src;
+	src << in.rdbuf();
+	
+	try {
+		auto fn = esp::parse(src.str());
+		string code = esp::aot::translate(fn);
+		fn->release();
+		
+		ofstream out(argv[2]);
+		out << code;
+		if(!out) {
+			cerr << "Can't write " << argv[2] << endl;
+			return 1;
+		}
+	}
+	catch(const exception& e) {
+		cerr << argv[1] << ": " << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
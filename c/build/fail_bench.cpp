@@ -0,0 +1,61 @@
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+#include "espresso.hpp"
+
+using namespace std;
+
+/**
+ * Failures used for control flow: a loop catching one fail per
+ *  iteration from a called function, a failure escaping to the embedder
+ *  as a failed Result, and for scale the same number of C++ exceptions
+ *  thrown and caught like Result::value() does.
+**/
+int main() {
+	const int LOOPS = 5000000, HOST_CALLS = 2000000;
+	
+	esp::Environment env;
+	auto loop = esp::parse(
+		"let check(n) if n % 3 == 0 then fail n else 0; "
+		"let loop(n, acc) if n == 0 then acc else "
+		"loop(n - 1, acc + (try check(n) catch (e) 1)); "
+		"loop(" + to_string(LOOPS) + ", 0)"
+	);
+	
+	auto start = chrono::steady_clock::now();
+	esp::Value res = env.exec(loop);
+	chrono::duration<double> dt = chrono::steady_clock::now() - start;
+	cout << "Caught " << res.toString() << ", " <<
+		(res.asSmallInt()/dt.count()/1e6) << "M failures/s" << endl;
+	
+	auto mod = esp::parse("let refuse(x) fail x");
+	esp::Value refuse = env.exec(mod);
+	
+	int failed = 0;
+	start = chrono::steady_clock::now();
+	for(int i = 0; i < HOST_CALLS; ++i) {
+		failed += refuse.call(&env, esp::Value::nil, esp::Value(i)).isFailure();
+	}
+	dt = chrono::steady_clock::now() - start;
+	cout << "Host saw " << failed << ", " <<
+		(HOST_CALLS/dt.count()/1e6) << "M failed calls/s" << endl;
+	
+	int thrown = 0;
+	start = chrono::steady_clock::now();
+	for(int i = 0; i < HOST_CALLS; ++i) {
+		try {
+			throw runtime_error("Failure");
+		}
+		catch(const runtime_error&) {
+			++thrown;
+		}
+	}
+	dt = chrono::steady_clock::now() - start;
+	cout << "C++ caught " << thrown << ", " <<
+		(HOST_CALLS/dt.count()/1e6) << "M exceptions/s" << endl;
+	
+	loop->release();
+	mod->release();
+	return 0;
+}
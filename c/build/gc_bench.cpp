@@ -0,0 +1,143 @@
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#include "espresso.hpp"
+
+using namespace std;
+
+static esp::Atom NEXT, ID, PAYLOAD, OF;
+
+static int64_t id_of(esp::Object* o, esp::Atom key) {
+	auto v = o->find(key);
+	return v && v->isSmallInt()? v->asSmallInt() : -1;
+}
+
+/**
+ * Walk the list from head, checking it still has n nodes with ids in
+ *  order and that every payload stored into one names that node.
+**/
+static bool intact(const esp::Value& head, int64_t n) {
+	int64_t i = 0;
+	for(auto v = &head; v && v->isObject(); v = v->asObject()->find(NEXT)) {
+		auto o = v->asObject();
+		if(id_of(o, ID) != i) {
+			return false;
+		}
+		if(auto p = o->find(PAYLOAD)) {
+			if(!p->isObject() || id_of(p->asObject(), OF) != i) {
+				return false;
+			}
+		}
+		++i;
+	}
+	return i == n;
+}
+
+/**
+ * Collector regression driver: a long-lived linked list which is soon
+ *  promoted, under a stream of garbage. Every few allocations a young
+ *  payload is stored into an old node, through the write barrier and
+ *  into the remembered set, and a node is replaced by a copy, leaving
+ *  old garbage for major collections to sweep and blocks to recycle.
+ *  The list is checked after the run and after a full collection, and
+ *  the longest pauses of allocation are reported by kind, with that of
+ *  allocations which did no collection work as the timer's noise floor.
+ *  Usage: gc_bench [allocations] [nodes]
+**/
+int main(int argc, char* argv[]) {
+	const int64_t ALLOCS = argc > 1? atoll(argv[1]) : 2000000;
+	const int64_t NODES = argc > 2? atoll(argv[2]) : 20000;
+	
+	NEXT = esp::intern("next");
+	ID = esp::intern("id");
+	PAYLOAD = esp::intern("payload");
+	OF = esp::intern("of");
+	
+	esp::Environment env;
+	auto& heap = env.heap;
+	
+	esp::Value head, fresh;
+	esp::gc::Handle rootHead(heap, &head), rootFresh(heap, &fresh);
+	
+	// Build the list back to front so each node is rooted by the next
+	vector<esp::Object*> nodes(NODES);
+	for(int64_t i = NODES; i-- > 0;) {
+		auto o = env.newObject();
+		o->set(ID, esp::Value(i));
+		o->set(NEXT, head);
+		head = o;
+		nodes[i] = o;
+	}
+	
+	using clock = chrono::steady_clock;
+	clock::duration longestMinor{}, longestStep{}, longestIdle{};
+	uint64_t rng = 88172645463325252ull;
+	
+	auto start = clock::now();
+	for(int64_t n = 0; n < ALLOCS; ++n) {
+		auto minors = heap.stats.minor;
+		bool idle = heap.phase == esp::gc::Heap::IDLE;
+		auto t = clock::now();
+		fresh = env.newObject();
+		auto dt = clock::now() - t;
+		
+		if(heap.stats.minor != minors) {
+			longestMinor = max(longestMinor, dt);
+		}
+		else if(idle && heap.phase == esp::gc::Heap::IDLE) {
+			longestIdle = max(longestIdle, dt);
+		}
+		else {
+			longestStep = max(longestStep, dt);
+		}
+		
+		rng ^= rng << 13;
+		rng ^= rng >> 7;
+		rng ^= rng << 17;
+		int64_t i = rng%NODES;
+		auto o = fresh.asObject();
+		
+		if(n%16 == 0 && i > 0) {
+			// Replace node i, the old one becomes garbage
+			auto old = nodes[i];
+			o->set(ID, esp::Value(i));
+			o->set(NEXT, *old->find(NEXT));
+			if(auto p = old->find(PAYLOAD)) {
+				o->set(PAYLOAD, *p);
+			}
+			nodes[i - 1]->set(NEXT, fresh);
+			nodes[i] = o;
+		}
+		else if(n%4 == 0) {
+			// Young into old, replacing any previous payload
+			o->set(OF, esp::Value(i));
+			nodes[i]->set(PAYLOAD, fresh);
+		}
+		else {
+			o->set(OF, esp::Value(n));
+		}
+	}
+	chrono::duration<double> total = clock::now() - start;
+	fresh = esp::Value::nil;
+	
+	bool ok = intact(head, NODES);
+	heap.collect();
+	ok = ok && intact(head, NODES);
+	
+	auto stats = heap.getStats();
+	auto us = [](clock::duration d) {
+		return chrono::duration<double, micro>(d).count();
+	};
+	
+	cout << (ALLOCS/total.count()/1e6) << "M allocs/s, list " <<
+		(ok? "intact" : "CORRUPT") << endl;
+	cout << stats.minor << " minor, " << stats.major << " major, " <<
+		stats.young << " young, " << stats.old << " old, " <<
+		stats.blocks << " blocks" << endl;
+	cout << "Longest pause: " << us(longestMinor) << "us minor, " <<
+		us(longestStep) << "us incremental step, " <<
+		us(longestIdle) << "us allocation alone" << endl;
+	
+	return !ok;
+}
@@ -0,0 +1,34 @@
+#include <chrono>
+#include <iostream>
+
+#include "espresso.hpp"
+
+using namespace std;
+
+/**
+ * Integer arithmetic throughput on immediates, then a product which
+ *  runs past 64 bits to exercise promotion to big ints.
+**/
+int main() {
+	const int OPS = 20000000;
+	
+	auto start = chrono::steady_clock::now();
+	esp::Value acc(0);
+	for(int i = 0; i < OPS/2; ++i) {
+		acc = (acc + esp::Value(i&7)).value();
+		acc = (acc - esp::Value(3)).value();
+	}
+	chrono::duration<double> dt = chrono::steady_clock::now() - start;
+	
+	cout << "Result " << acc.toString() << endl;
+	cout << (OPS/dt.count()/1e6) << "M int ops/s" << endl;
+	
+	esp::Value big((int64_t)INT64_MAX);
+	esp::Value step((int64_t)1 << 40);
+	for(int i = 0; i < 4; ++i) {
+		big = (big*step).value();
+	}
+	cout << "INT64_MAX*2^160 = " << big.toString() << endl;
+	
+	return 0;
+}
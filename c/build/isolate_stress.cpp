@@ -0,0 +1,103 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "espresso.hpp"
+
+using namespace std;
+
+static const char* SCRIPTS[] = {
+	"let fib(n) if n < 2 then n else fib(n - 1) + fib(n - 2); fib(20)",
+	
+	"let loop(n, x) if n == 0 then x else loop(n - 1, x*0.5 + n); "
+	"loop(20000, 1) + loop(20000, 1.5)",
+	
+	"let point(x, y) $(x: x, y: y); "
+	"let sum(n, acc) if n == 0 then acc else "
+	"sum(n - 1, acc + point(n, n*2).y - $(y: 1, x: n).x); "
+	"sum(5000, 0)",
+	
+	"let check(n) if n % 3 == 0 then fail n else n; "
+	"let loop(n, acc) if n == 0 then acc else "
+	"loop(n - 1, acc + (try check(n) catch (e) 1)); loop(10000, 0)",
+	
+	"let big(n, acc) if n == 0 then acc else "
+	"big(n - 1, acc + 999999999999999999); big(500, 0)",
+	
+	"let twice(f, x) f(f(x)); let inc(x) x + 1; "
+	"let loop(n, acc) if n == 0 then acc else "
+	"loop(n - 1, twice(inc, acc)); loop(10000, 0)",
+	
+	"let mixed(n, x) if n == 0 then x else mixed(n - 1, "
+	"if n % 2 == 0 then x + 1 else x + 0.5); mixed(10000, 0)",
+	
+	"let len(n, acc) if n == 0 then acc else "
+	"len(n - 1, acc + \"shared constant\".length); len(10000, 0)"
+};
+
+/**
+ * Isolates on every core running the same frozen programs: each thread
+ *  has its own Environment, half of them with the JIT off, and runs every
+ *  script many times while also parsing scripts of its own, checking
+ *  each result against a run of its own unfrozen copy.
+ *  Usage: isolate_stress [rounds] [threads]
+**/
+int main(int argc, char* argv[]) {
+	const int ROUNDS = argc > 1? atoi(argv[1]) : 20;
+	const int THREADS = argc > 2?
+		atoi(argv[2]) : max(4u, thread::hardware_concurrency());
+	const int M = sizeof(SCRIPTS)/sizeof(*SCRIPTS);
+	
+	vector<esp::Function*> programs;
+	vector<string> expected;
+	for(auto src : SCRIPTS) {
+		esp::Environment env;
+		expected.push_back(env.exec(src).toString());
+		
+		auto fn = esp::parse(src);
+		esp::vm::freeze(fn);
+		programs.push_back(fn);
+	}
+	
+	atomic<int> bad{0};
+	auto start = chrono::steady_clock::now();
+	vector<thread> threads;
+	for(int t = 0; t < THREADS; ++t) {
+		threads.emplace_back([&, t]() {
+			esp::Environment env;
+			env.jit = env.jit && t % 2 == 0;
+			
+			for(int r = 0; r < ROUNDS; ++r) {
+				for(int s = 0; s < M; ++s) {
+					int i = (s + t) % M;
+					if(env.exec(programs[i]).toString() != expected[i]) {
+						++bad;
+					}
+				}
+				
+				string key = "k" + to_string(t) + "_" + to_string(r);
+				string own = env.exec(
+					"$(" + key + ": " + to_string(r) + ")." + key
+				).toString();
+				if(own != to_string(r)) {
+					++bad;
+				}
+			}
+		});
+	}
+	for(auto& th : threads) {
+		th.join();
+	}
+	chrono::duration<double> dt = chrono::steady_clock::now() - start;
+	
+	cout << THREADS << " threads x " << M << " scripts x " << ROUNDS <<
+		" rounds: " << (THREADS*M*ROUNDS/dt.count()) << " runs/s, " <<
+		bad << " bad" << endl;
+	
+	for(auto fn : programs) {
+		fn->release();
+	}
+	return bad != 0;
+}
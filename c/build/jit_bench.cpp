@@ -0,0 +1,61 @@
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "espresso.hpp"
+
+using namespace std;
+
+/**
+ * Time a program with the JIT off, then on, in separate Environments so
+ *  neither sees functions the other compiled, and check they agree.
+**/
+static void compare(const string& name, const string& src) {
+	double secs[2];
+	string results[2];
+	
+	for(int i = 0; i < 2; ++i) {
+		esp::Environment env;
+		env.jit = env.jit && i;
+		auto fn = esp::parse(src);
+		
+		auto start = chrono::steady_clock::now();
+		results[i] = env.exec(fn).toString();
+		chrono::duration<double> dt = chrono::steady_clock::now() - start;
+		secs[i] = dt.count();
+		
+		fn->release();
+	}
+	
+	cout << name << " = " << results[1] << ": " <<
+		secs[0] << "s interpreted, " << secs[1] << "s compiled, " <<
+		(secs[0]/secs[1]) << "x" << endl;
+	if(results[0] != results[1]) {
+		cout << "  MISMATCH, interpreter gave " << results[0] << endl;
+	}
+}
+
+/**
+ * What compiling functions to machine code buys over the interpreter on
+ *  doubly recursive fib, which is mostly calls that still go through the
+ *  interpreter, and tail recursive loops doing integer and then real
+ *  arithmetic, which stay in machine code between iterations.
+**/
+int main() {
+	if(!esp::jit::available()) {
+		cout << "No JIT in this build" << endl;
+	}
+	
+	compare("fib(27)",
+		"let fib(n) if n < 2 then n else fib(n - 1) + fib(n - 2); fib(27)"
+	);
+	compare("Int loop",
+		"let loop(n, acc) if n == 0 then acc else "
+		"loop(n - 1, acc*1 + n - 2 + 2); loop(10000000, 0)"
+	);
+	compare("Real loop",
+		"let loop(n, x, y) if n == 0 then x + y else "
+		"loop(n - 1, y*0.5 + 1.0, x/2.0 - 0.25); loop(10000000, 1.5, 0.5)"
+	);
+	return 0;
+}
@@ -0,0 +1,55 @@
+#include <chrono>
+#include <iostream>
+
+#include "espresso.hpp"
+
+using namespace std;
+
+static const char* TIER_NAMES[] = {"interpreted", "optimized", "native"};
+
+/**
+ * Tiered execution on a script of many functions of which only a few
+ *  run, or run hot: how soon it starts running when parsed the way
+ *  Environment::exec does rather than fully optimized, how long it then
+ *  takes with the default tiers, and which functions got hot enough to
+ *  move up.
+**/
+int main() {
+	const int COLD = 3000;
+	
+	string src;
+	for(int i = 0; i < COLD; ++i) {
+		string f = "cold" + to_string(i);
+		src += "let " + f + "(a, b) if a < b then (try a*b - " + to_string(i) +
+			" catch (e) $(x: a).x + b) else " + f + "(a - 1, b + 2); ";
+	}
+	src +=
+		"let step(x, y) x*0.5 + y; "
+		"let loop(n, x) if n == 0 then x else loop(n - 1, step(x, 1.0)); "
+		"let fib(n) if n < 2 then n else fib(n - 1) + fib(n - 2); "
+		"cold0(3, 1) + loop(2000000, 0.0) + fib(25)";
+	
+	for(auto opt : {esp::vm::OPT_NONE, esp::vm::OPT_FULL}) {
+		esp::Environment env;
+		
+		auto start = chrono::steady_clock::now();
+		auto fn = esp::parse(src, opt);
+		chrono::duration<double> parsed = chrono::steady_clock::now() - start;
+		esp::Value res = env.exec(fn);
+		chrono::duration<double> ran = chrono::steady_clock::now() - start;
+		
+		cout << (opt == esp::vm::OPT_NONE? "Parsed for tiers" : "Optimized") <<
+			": parse " << parsed.count()*1e3 << "ms, total " <<
+			ran.count()*1e3 << "ms = " << res.toString() << endl;
+		
+		for(auto& h : esp::vm::profile(fn)) {
+			if(h.calls + h.loops < env.tiers.optimize) {
+				break;
+			}
+			cout << "  " << esp::atom_name(h.fn->name) << ": " << h.calls <<
+				" calls, " << h.loops << " loops, " << TIER_NAMES[h.tier] << endl;
+		}
+		fn->release();
+	}
+	return 0;
+}
@@ -0,0 +1,39 @@
+#include <chrono>
+#include <iostream>
+
+#include "espresso.hpp"
+
+using namespace std;
+
+/**
+ * Interpreter throughput on straight-line arithmetic. The expression
+ *  mixes precedence levels so it needs several live temporaries, and
+ *  every instruction of the function runs once per call. It starts from
+ *  an attribute so the compiler can only fold the terms, not the sum.
+**/
+int main() {
+	const int TERMS = 2000, RUNS = 2000;
+	
+	string src = "$(x: 1).x";
+	for(int i = 1; i < TERMS; ++i) {
+		src += i%3? " + 3*(7 - 2)" : " - 4*5";
+	}
+	
+	esp::Environment env;
+	auto fn = esp::parse(src);
+	
+	auto start = chrono::steady_clock::now();
+	esp::Value res;
+	for(int i = 0; i < RUNS; ++i) {
+		res = env.exec(fn);
+	}
+	chrono::duration<double> dt = chrono::steady_clock::now() - start;
+	
+	double ops = (double)fn->code.size()*RUNS;
+	cout << "Result " << res.toString() << endl;
+	cout << fn->code.size() << " instructions, " <<
+		(ops/dt.count()/1e6) << "M instructions/s" << endl;
+	
+	fn->release();
+	return 0;
+}
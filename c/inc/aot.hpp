@@ -0,0 +1,202 @@
+/**
+ * Ahead-of-time translation of programs to C++, and the runtime support
+ *  the translated code calls into.
+**/
+#ifndef ESPRESSO_AOT_HPP
+#define ESPRESSO_AOT_HPP
+
+#include <string>
+
+#include "value.hpp"
+
+namespace esp {
+namespace aot {
+
+/**
+ * Translate the program fn was parsed from to a C++ translation unit
+ *  which links against the runtime and whose main runs it, printing the
+ *  result. Each function becomes a C++ function with its registers as a
+ *  native array. Throws if fn uses an opcode the interpreter doesn't
+ *  run either.
+**/
+std::string translate(Function* fn);
+
+/**
+ * Translated calls recurse natively, so they're limited to what the
+ *  native stack can take rather than Environment::maxDepth.
+**/
+constexpr uint MAX_DEPTH = 10000;
+
+/**
+ * Counts the translated calls in progress on this thread.
+**/
+struct Depth {
+	static inline thread_local uint current = 0;
+	
+	inline Depth() {
+		++current;
+	}
+	inline ~Depth() {
+		--current;
+	}
+	
+	inline bool overflowed() const {
+		return current > MAX_DEPTH;
+	}
+};
+
+/**
+ * Store res in dst, or in err returning false if it's a failure, which
+ *  the caller unwinds like the interpreter's STORE.
+**/
+inline bool store(Value& dst, Result res, Value& err) {
+	if(res.isFailure()) {
+		err = std::move(res);
+		return false;
+	}
+	dst = std::move(res);
+	return true;
+}
+
+inline bool truth(Value& v) {
+	return v.isBool()? v.asBool() : v.toBool();
+}
+
+/**
+ * Operators with the interpreter's int and real fast paths inline and
+ *  the generic Value operator for anything else, which is what its
+ *  quickened forms would do for the same operands.
+**/
+#define ESP_AOT_INT_OP(name, builtin, op) \
+	inline bool name(Value& dst, Value& l, Value& r, Value& err) { \
+		if(l.isSmallInt() && r.isSmallInt()) { \
+			esp_int v; \
+			if(!builtin(l.asSmallInt(), r.asSmallInt(), &v) && \
+				Value::fitsSmallInt(v)) { \
+				dst = Value::fromSmallInt(v); \
+				return true; \
+			} \
+		} \
+		else if(l.isReal() && r.isReal()) { \
+			dst = Value::fromReal(l.asReal() op r.asReal()); \
+			return true; \
+		} \
+		return store(dst, l op r, err); \
+	}
+
+#define ESP_AOT_REAL_OP(name, op, expr) \
+	inline bool name(Value& dst, Value& l, Value& r, Value& err) { \
+		if(l.isSmallInt() && r.isSmallInt()) { \
+			esp_real x = l.asSmallInt(), y = r.asSmallInt(); \
+			dst = Value::fromReal(expr); \
+			return true; \
+		} \
+		if(l.isReal() && r.isReal()) { \
+			esp_real x = l.asReal(), y = r.asReal(); \
+			dst = Value::fromReal(expr); \
+			return true; \
+		} \
+		return store(dst, l op r, err); \
+	}
+
+#define ESP_AOT_CMP_OP(name, op) \
+	inline bool name(Value& dst, Value& l, Value& r, Value& err) { \
+		if(l.isSmallInt() && r.isSmallInt()) { \
+			dst = Value::fromBool(l.asSmallInt() op r.asSmallInt()); \
+			return true; \
+		} \
+		if(l.isReal() && r.isReal()) { \
+			dst = Value::fromBool(l.asReal() op r.asReal()); \
+			return true; \
+		} \
+		return store(dst, l op r, err); \
+	}
+
+#define ESP_AOT_STEP_OP(name, op) \
+	inline bool name(Value& dst, Value& v, Value& err) { \
+		if(v.isSmallInt()) { \
+			esp_int x = v.asSmallInt() op 1; \
+			dst = Value::fitsSmallInt(x)? Value::fromSmallInt(x) : Value(x); \
+			return true; \
+		} \
+		if(v.isReal()) { \
+			dst = Value::fromReal(v.asReal() op 1); \
+			return true; \
+		} \
+		return store(dst, v op Value::fromSmallInt(1), err); \
+	}
+
+ESP_AOT_INT_OP(add, __builtin_add_overflow, +)
+ESP_AOT_INT_OP(sub, __builtin_sub_overflow, -)
+ESP_AOT_INT_OP(mul, __builtin_mul_overflow, *)
+
+// Ints divide as reals
+ESP_AOT_REAL_OP(div, /, x/y)
+
+// But take an exact remainder, and a zero divisor the generic path
+inline bool mod(Value& dst, Value& l, Value& r, Value& err) {
+	if(l.isSmallInt() && r.isSmallInt() && r.asSmallInt() != 0) {
+		dst = Value::fromSmallInt(l.asSmallInt() % r.asSmallInt());
+		return true;
+	}
+	if(l.isReal() && r.isReal()) {
+		dst = Value::fromReal(fmod(l.asReal(), r.asReal()));
+		return true;
+	}
+	return store(dst, l % r, err);
+}
+
+ESP_AOT_CMP_OP(gt, >)
+ESP_AOT_CMP_OP(gte, >=)
+ESP_AOT_CMP_OP(lt, <)
+ESP_AOT_CMP_OP(lte, <=)
+ESP_AOT_CMP_OP(eq, ==)
+ESP_AOT_CMP_OP(ne, !=)
+
+ESP_AOT_STEP_OP(inc, +)
+ESP_AOT_STEP_OP(dec, -)
+
+#undef ESP_AOT_INT_OP
+#undef ESP_AOT_REAL_OP
+#undef ESP_AOT_CMP_OP
+#undef ESP_AOT_STEP_OP
+
+/**
+ * OP_CALL, calling at[0] with self and the arguments in the n values
+ *  after it and leaving the result in at[0]. Functions which weren't
+ *  translated run in env's interpreter.
+**/
+inline bool call(Environment* env, Value* at, uint n, Value& err) {
+	Value& callee = at[0];
+	if(!callee.isFunction()) {
+		err = Value("Value isn't callable");
+		return false;
+	}
+	
+	Depth depth;
+	if(depth.overflowed()) {
+		err = Value("Call stack overflow");
+		return false;
+	}
+	
+	Function* fn = callee.asFunction();
+	if(fn->compiled) {
+		if(!fn->frozen) {
+			++fn->calls;
+		}
+		return store(callee, fn->compiled(env, at + 1, n), err);
+	}
+	return store(
+		callee, env->call(fn, at[1], Span<const Value>{at + 2, n - 1}), err
+	);
+}
+
+/**
+ * A big int constant from its sign and limbs.
+**/
+Value bigint(bool neg, std::initializer_list<uint32_t> mag);
+
+}
+}
+
+#endif
@@ -0,0 +1,126 @@
+/**
+ * Region allocation for data which lives and dies together.
+**/
+#ifndef ESPRESSO_ARENA_HPP
+#define ESPRESSO_ARENA_HPP
+
+#include <new>
+#include <utility>
+#include <type_traits>
+
+#include "common.hpp"
+
+namespace esp {
+
+/**
+ * A fixed-size array which doesn't own its storage.
+**/
+template<typename T>
+struct Span {
+	T* ptr = nullptr;
+	size_t count = 0;
+	
+	inline T* begin() const {
+		return ptr;
+	}
+	inline T* end() const {
+		return ptr + count;
+	}
+	inline size_t size() const {
+		return count;
+	}
+	inline bool empty() const {
+		return count == 0;
+	}
+	inline T& operator[](size_t i) const {
+		return ptr[i];
+	}
+};
+
+/**
+ * Bump allocator which frees everything at once when destroyed. Chunks
+ *  grow geometrically, so a small compilation costs one or two mallocs.
+ *  Destructors of non-trivial types are recorded and run in reverse.
+**/
+struct Arena {
+	static constexpr size_t MIN_CHUNK = 1024;
+	static constexpr size_t MAX_CHUNK = 64*1024;
+	
+	Arena();
+	~Arena();
+	
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+	
+	void* alloc(size_t n, size_t align);
+	
+	template<typename T, typename... ARGS>
+	T* make(ARGS&&... args) {
+		auto p = new(alloc(sizeof(T), alignof(T))) T(std::forward<ARGS>(args)...);
+		onDestroy(p, 1);
+		return p;
+	}
+	
+	/**
+	 * Copy n elements into an exactly sized array.
+	**/
+	template<typename T>
+	Span<T> copy(const T* src, size_t n) {
+		Span<T> s;
+		if(n) {
+			s.ptr = (T*)alloc(sizeof(T)*n, alignof(T));
+			for(size_t i = 0; i < n; ++i) {
+				new(s.ptr + i) T(src[i]);
+			}
+			s.count = n;
+			onDestroy(s.ptr, n);
+		}
+		return s;
+	}
+	
+	/**
+	 * Total bytes reserved from the system.
+	**/
+	inline size_t reserved() const {
+		return total;
+	}
+
+private:
+	struct Chunk {
+		Chunk* next;
+	};
+	
+	struct Cleanup {
+		Cleanup* next;
+		void (*fn)(void*, size_t);
+		void* ptr;
+		size_t count;
+	};
+	
+	Chunk* chunks;
+	Cleanup* cleanups;
+	char *cur, *end;
+	size_t next, total;
+	
+	void grow(size_t min);
+	
+	template<typename T>
+	void onDestroy(T* p, size_t n) {
+		if(!std::is_trivially_destructible<T>::value) {
+			auto c = (Cleanup*)alloc(sizeof(Cleanup), alignof(Cleanup));
+			c->next = cleanups;
+			c->fn = [](void* p, size_t n) {
+				for(size_t i = n; i-- > 0;) {
+					((T*)p)[i].~T();
+				}
+			};
+			c->ptr = p;
+			c->count = n;
+			cleanups = c;
+		}
+	}
+};
+
+}
+
+#endif
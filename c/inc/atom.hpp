@@ -0,0 +1,61 @@
+/**
+ * Interned identifiers and string literals.
+**/
+#ifndef ESPRESSO_ATOM_HPP
+#define ESPRESSO_ATOM_HPP
+
+#include <string>
+
+#include "common.hpp"
+
+namespace esp {
+
+struct Value;
+
+/**
+ * An atom is the index of an interned string. Two atoms are equal iff
+ *  their strings are equal, so property keys compare as integers.
+**/
+typedef uint32_t Atom;
+
+/**
+ * Atoms the runtime itself needs, interned at startup in this order.
+**/
+enum BuiltinAtom : Atom {
+	ATOM_EMPTY,
+	ATOM_TOBOOL, ATOM_TOINT, ATOM_TOREAL, ATOM_TOSTRING, ATOM_CALL,
+	
+	ATOM_ADD, ATOM_SUB, ATOM_MUL, ATOM_DIV, ATOM_IDIV, ATOM_MOD, ATOM_IMOD,
+	ATOM_GT, ATOM_GTE, ATOM_LT, ATOM_LTE, ATOM_NE, ATOM_EQ,
+	ATOM_BAND, ATOM_BOR, ATOM_BXOR, ATOM_SHL, ATOM_SHR,
+	ATOM_NEG, ATOM_POS, ATOM_INV, ATOM_NOT,
+	
+	ATOM_BUILTIN_COUNT
+};
+
+/**
+ * Return the atom for s, interning it if it hasn't been seen before.
+**/
+Atom intern(const std::string& s);
+Atom intern(const char* s, size_t len);
+
+/**
+ * Set a to the atom for s if it's been interned, without interning it
+ *  otherwise. No object can have a key which was never interned, so
+ *  lookups by string use this and don't grow the table.
+**/
+bool find_atom(const std::string& s, Atom& a);
+
+/**
+ * The string an atom was interned from.
+**/
+const std::string& atom_name(Atom a);
+
+/**
+ * A string value of the atom, shared so loading it doesn't allocate.
+**/
+Value atom_value(Atom a);
+
+}
+
+#endif
@@ -0,0 +1,75 @@
+/**
+ * Arbitrary-precision integers for ints which overflow the immediate.
+**/
+#ifndef ESPRESSO_BIGINT_HPP
+#define ESPRESSO_BIGINT_HPP
+
+#include <vector>
+#include <string>
+
+#include "common.hpp"
+
+namespace esp {
+
+/**
+ * A signed integer of any size in sign and magnitude form, with 32 bit
+ *  limbs least significant first. The magnitude never has leading zero
+ *  limbs and zero is the empty magnitude with neg unset, so every value
+ *  has exactly one representation.
+**/
+struct BigInt {
+	bool neg;
+	std::vector<uint32_t> mag;
+	
+	inline BigInt():neg(false) {}
+	explicit BigInt(int64_t v);
+	
+	inline bool isZero() const {
+		return mag.empty();
+	}
+	
+	/**
+	 * Store the value in out if it fits in 64 bits.
+	**/
+	bool toInt64(int64_t& out) const;
+	
+	/**
+	 * The low 64 bits in two's complement, wrapping like a cast.
+	**/
+	int64_t wrap() const;
+	
+	double toReal() const;
+	std::string toString() const;
+	
+	/**
+	 * Negative, zero or positive as a is less than, equal to or greater
+	 *  than b.
+	**/
+	static int compare(const BigInt& a, const BigInt& b);
+	
+	/**
+	 * Truncating division, so the remainder takes the sign of a. b must
+	 *  not be zero, and either output may be nullptr.
+	**/
+	static void divmod(const BigInt& a, const BigInt& b, BigInt* q, BigInt* r);
+	
+	BigInt operator-() const;
+	
+	/**
+	 * Shifts by n bits. Right shifts round toward negative infinity like
+	 *  an arithmetic shift.
+	**/
+	BigInt shl(uint64_t n) const;
+	BigInt shr(uint64_t n) const;
+	
+	friend BigInt operator+(const BigInt& a, const BigInt& b);
+	friend BigInt operator-(const BigInt& a, const BigInt& b);
+	friend BigInt operator*(const BigInt& a, const BigInt& b);
+
+private:
+	void trim();
+};
+
+} /* namespace esp */
+
+#endif
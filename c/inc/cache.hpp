@@ -0,0 +1,56 @@
+/**
+ * Compiled programs saved to disk, so loading one skips the lexer, the
+ *  parser and the optimizer.
+**/
+#ifndef ESPRESSO_CACHE_HPP
+#define ESPRESSO_CACHE_HPP
+
+#include <string>
+#include <string_view>
+
+#include "value.hpp"
+
+namespace esp {
+namespace cache {
+
+/**
+ * Bumped whenever the format or the meaning of the bytecode in it
+ *  changes, which makes every older cache stale.
+**/
+constexpr uint32_t VERSION = 1;
+
+/**
+ * Hash of the source a cache was compiled from, so a cache can be
+ *  checked against the file it was made from.
+**/
+uint64_t hash(std::string_view source);
+
+/**
+ * Serialize the program fn was parsed from, recording source as the
+ *  hash of its source.
+**/
+std::string serialize(Function* fn, uint64_t source);
+
+/**
+ * serialize() to path. Throws if it can't be written.
+**/
+void write(const std::string& path, Function* fn, uint64_t source);
+
+/**
+ * Map the cache at path and build its program in a new unit, returning
+ *  it with one reference like parse(). Code and handlers are used in
+ *  place from a private mapping, which the unit keeps until it's freed,
+ *  so only the pages quickening writes to are ever copied.
+ *
+ * Returns null if there's no file or it's stale: another VERSION, a
+ *  build with another instruction layout, or, when source isn't 0,
+ *  compiled from other source. Throws if it's malformed. A cache is
+ *  trusted like the source it came from; loading checks that it's well
+ *  formed, not that its code is safe to run.
+**/
+Function* load(const std::string& path, uint64_t source=0);
+
+}
+}
+
+#endif
@@ -0,0 +1,241 @@
+/**
+ * The garbage collector for objects.
+**/
+#ifndef ESPRESSO_GC_HPP
+#define ESPRESSO_GC_HPP
+
+#include <vector>
+#include <functional>
+
+#include "common.hpp"
+
+namespace esp {
+
+struct Object;
+struct Value;
+struct Environment;
+
+namespace gc {
+
+struct Heap;
+struct Block;
+struct Handle;
+struct Scope;
+
+enum Generation : uint8_t {
+	/**
+	 * Allocated outside of any heap (eg with new), never collected or
+	 *  traced. Objects reachable only through these must be rooted.
+	**/
+	UNMANAGED,
+	YOUNG, OLD
+};
+
+/**
+ * Tri-color state of old objects during incremental marking.
+**/
+enum Color : uint8_t {
+	WHITE, GRAY, BLACK
+};
+
+/**
+ * Header of every collected cell.
+**/
+struct Cell {
+	Heap* heap = nullptr;
+	Generation gen = UNMANAGED;
+	Color color = WHITE;
+	/**
+	 * Mark bit of minor collections, separate from color so a minor
+	 *  collection can run in the middle of an incremental major one.
+	**/
+	bool marked = false;
+	/**
+	 * Whether this old cell is in the remembered set, and where.
+	**/
+	bool remembered = false;
+	uint32_t rememberedAt = 0;
+};
+
+/**
+ * A generational heap of objects, one per Environment.
+ *
+ * Objects never move. Young and old ones share fixed-size blocks, and
+ *  new objects are bump-allocated through a run of free cells in the
+ *  current block, which an empty block is all one of. Once its runs are
+ *  used up, allocation moves to a spare block, then to one from the
+ *  list of blocks freeing left less than half full, then to a new one.
+ *
+ * After NURSERY_CELLS young allocations, a minor collection traces them
+ *  from the roots and the remembered set and promotes the survivors in
+ *  place. The old generation is collected by incremental mark-sweep:
+ *  each allocation does a slice of marking or sweeping, and a Dijkstra
+ *  write barrier on stores into objects keeps the marking sound while
+ *  the program runs between slices. Marking ends once rescanning the
+ *  roots and young objects finds nothing left to mark, and anything it
+ *  does find is marked in further slices, so no pause is longer than
+ *  that rescan or a slice.
+ *
+ * Roots are the registers of the Environment's active frames, any
+ *  Handles and any Scopes. Values held elsewhere (eg an embedder's
+ *  locals) must be rooted with one to survive a collection.
+**/
+struct Heap {
+	/**
+	 * Young allocations between minor collections.
+	**/
+	static constexpr uint NURSERY_CELLS = 4096;
+	/**
+	 * Gray objects scanned per allocation while marking.
+	**/
+	static constexpr uint MARK_STEP = 32;
+	/**
+	 * Blocks swept per allocation while sweeping.
+	**/
+	static constexpr uint SWEEP_STEP = 1;
+	/**
+	 * Old objects needed before the first major collection starts.
+	**/
+	static constexpr size_t MIN_THRESHOLD = 16384;
+	/**
+	 * Empty blocks kept for reuse rather than returned to the system.
+	**/
+	static constexpr uint SPARE_BLOCKS = 4;
+	
+	enum Phase {
+		IDLE, MARKING, SWEEPING
+	};
+	
+	struct Stats {
+		size_t minor = 0, major = 0;
+		size_t young = 0, old = 0;
+		size_t blocks = 0;
+	};
+	
+	Environment* env;
+	Phase phase;
+	
+	std::vector<Block*> blocks;
+	std::vector<Block*> spare;
+	
+	/**
+	 * Allocation cursor, bumped through the run of free cells in the
+	 *  current block which ends at limit.
+	**/
+	Block* current;
+	uint cursor, limit;
+	
+	/**
+	 * Blocks less than half full, neither spare nor current, which
+	 *  allocation moves to before making new ones.
+	**/
+	std::vector<Block*> available;
+	
+	std::vector<Object*> young;
+	std::vector<Object*> remembered;
+	std::vector<Object*> gray;
+	std::vector<Handle*> roots;
+	
+	/**
+	 * The innermost live Scope, which links to the ones outside it.
+	**/
+	Scope* scopes;
+	
+	size_t sweepIndex;
+	size_t oldCount;
+	size_t threshold;
+	
+	Stats stats;
+	
+	Heap(Environment* e);
+	~Heap();
+	
+	/**
+	 * Allocate a new young object, possibly doing collection work first.
+	**/
+	Object* alloc();
+	
+	/**
+	 * Write barrier, called by stores of child into an old target.
+	**/
+	void barrier(Object* target, Object* child);
+	
+	/**
+	 * Run a full, non-incremental collection of both generations.
+	**/
+	void collect();
+	
+	/**
+	 * Collect the nursery.
+	**/
+	void minor();
+	
+	Stats getStats();
+
+private:
+	Object* nextCell();
+	bool nextRun();
+	void nextBlock();
+	void free(Object* o);
+	void offer(Block* b);
+	void recycle(Block* b);
+	
+	void step();
+	
+	void traceRoots(const std::function<void(const Value&)>& visit);
+	
+	void shade(Object* o);
+	void shade(const Value& v);
+	void startMark();
+	void markStep(uint n);
+	void finishMark();
+	void sweepStep(uint n);
+};
+
+/**
+ * A root for a value held outside the Environment's frames.
+**/
+struct Handle {
+	Heap& heap;
+	Value* value;
+	
+	/**
+	 * Where it is in the heap's roots, so it's removed without a search.
+	**/
+	size_t at;
+	
+	Handle(Heap& h, Value* v);
+	~Handle();
+	
+	Handle(const Handle&) = delete;
+	Handle& operator=(const Handle&) = delete;
+};
+
+/**
+ * A root for n values in native storage, like the registers of code
+ *  translated to C++. Unlike a Handle it's linked in and out rather
+ *  than kept in a list, so scopes must end in the reverse order they
+ *  began, which C++ locals do.
+**/
+struct Scope {
+	Heap& heap;
+	Value* values;
+	uint n;
+	Scope* prev;
+	
+	inline Scope(Heap& h, Value* v, uint count)
+		:heap(h), values(v), n(count), prev(h.scopes) {
+		heap.scopes = this;
+	}
+	inline ~Scope() {
+		heap.scopes = prev;
+	}
+	
+	Scope(const Scope&) = delete;
+	Scope& operator=(const Scope&) = delete;
+};
+
+} /* namespace gc */
+} /* namespace esp */
+
+#endif
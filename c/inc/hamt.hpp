@@ -0,0 +1,67 @@
+/**
+ * Persistent maps for object properties.
+**/
+#ifndef ESPRESSO_HAMT_HPP
+#define ESPRESSO_HAMT_HPP
+
+#include <functional>
+
+#include "common.hpp"
+#include "atom.hpp"
+
+namespace esp {
+
+struct Value;
+struct HamtNode;
+
+/**
+ * A persistent hash array mapped trie from atoms to values.
+ *
+ * Copying a Hamt is O(1) and shares every node. A later set or del
+ *  copies only the O(log n) nodes on the path to its key and shares the
+ *  rest, while nodes this map owns alone are updated in place.
+ *
+ * Atoms are hashed with a bijective mix, so keys never collide and the
+ *  trie is at most 7 levels deep. Nodes are kept in canonical (CHAMP)
+ *  form, so the iteration order depends only on which keys are present
+ *  and not on the order they were added or removed in.
+**/
+struct Hamt {
+	Hamt();
+	Hamt(const Hamt& h);
+	Hamt(Hamt&& h);
+	~Hamt();
+	
+	Hamt& operator=(const Hamt& h);
+	Hamt& operator=(Hamt&& h);
+	
+	inline size_t size() const {
+		return count;
+	}
+	
+	/**
+	 * The value of key, or nullptr if it isn't present.
+	**/
+	const Value* find(Atom key) const;
+	
+	/**
+	 * Returns true if key wasn't present before.
+	**/
+	bool set(Atom key, const Value& v);
+	bool del(Atom key);
+	
+	void clear();
+	
+	/**
+	 * Call visit on every entry in the trie's deterministic order.
+	**/
+	void each(const std::function<void(Atom, const Value&)>& visit) const;
+
+private:
+	HamtNode* root;
+	size_t count;
+};
+
+} /* namespace esp */
+
+#endif
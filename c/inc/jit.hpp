@@ -0,0 +1,81 @@
+/**
+ * Baseline compiler from a Function's bytecode to x86-64 machine code.
+**/
+#ifndef ESPRESSO_JIT_HPP
+#define ESPRESSO_JIT_HPP
+
+#include <vector>
+
+#include "common.hpp"
+
+namespace esp {
+struct Value;
+struct Function;
+struct Environment;
+
+namespace jit {
+
+/**
+ * Set in what Code::run returns when the instruction it stopped at
+ *  failed, the failure having been stored through err.
+**/
+constexpr uint32_t FAILED = 1u << 31;
+
+/**
+ * Set instead when it threw a C++ exception, which rethrow() throws.
+**/
+constexpr uint32_t THREW = 1u << 30;
+
+/**
+ * Whether this build can compile anything, only Linux on x86-64.
+**/
+bool available();
+
+/**
+ * One function's machine code in a mapping of its own, which is only
+ *  ever writable while it's being written and only executable after.
+**/
+struct Code {
+	typedef uint32_t (*Entry)(
+		Value* reg, Environment* env, Value* err, const void* at
+	);
+	
+	uint8_t* mem;
+	size_t length;
+	
+	/**
+	 * Where each instruction's code starts.
+	**/
+	std::vector<uint32_t> offsets;
+	
+	Code(uint8_t* m, size_t n, std::vector<uint32_t> o);
+	~Code();
+	
+	Code(const Code&) = delete;
+	Code& operator=(const Code&) = delete;
+	
+	/**
+	 * Run the function on its registers from instruction pc up to the
+	 *  first call, return or fail, which the interpreter has to run, or
+	 *  an instruction which fails. Returns that instruction's index.
+	**/
+	inline uint32_t run(Value* reg, Environment* env, Value* err, size_t pc) {
+		return ((Entry)mem)(reg, env, err, mem + offsets[pc]);
+	}
+};
+
+/**
+ * Throw the exception machine code on this thread stopped with.
+**/
+[[noreturn]] void rethrow();
+
+/**
+ * Compile fn into its unit's arena. Returns null if there's no JIT or fn
+ *  uses an opcode it doesn't compile, leaving it to the interpreter.
+**/
+Code* compile(Function* fn);
+
+}
+}
+
+#endif
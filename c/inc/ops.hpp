@@ -14,11 +14,11 @@ namespace vm {
 /**
  * The opcodes used by the VM.
 **/
-enum Opcode {
+enum Opcode : uint8_t {
 	OP_NOP, OP_CONST, OP_IMM,
-	OP_NIL, OP_BOOL, OP_MOVE,
+	OP_NIL, OP_BOOL, OP_MOVE, OP_OBJECT, OP_FUNC,
 	
-	OP_JMP, OP_IF, OP_CALL, OP_RETURN, OP_FAIL,
+	OP_JMP, OP_IF, OP_CALL, OP_TAILCALL, OP_RETURN, OP_FAIL,
 	OP_GETATTR, OP_SETATTR, OP_HASATTR, OP_DELATTR,
 	
 	OP_NEG, OP_POS, OP_INV, OP_NOT, OP_INC, OP_DEC,
@@ -29,27 +29,86 @@ enum Opcode {
 	OP_AND, OP_OR, OP_BAND, OP_BOR, OP_BXOR,
 	OP_GT, OP_GTE, OP_LT, OP_LTE, OP_EQ, OP_NE,
 	
-	OP_SHL, OP_SHR
+	OP_SHL, OP_SHR,
+	
+	/**
+	 * Quickened forms which the interpreter rewrites generic opcodes into
+	 *  after seeing their operands, _II for two immediate ints, _RR for
+	 *  two reals and _SS for two strings. Each guards its operand types
+	 *  and rewrites itself back to the generic form when they change, so
+	 *  the compiler never emits them.
+	**/
+	OP_ADD_II, OP_ADD_RR, OP_ADD_SS,
+	OP_SUB_II, OP_SUB_RR, OP_MUL_II, OP_MUL_RR,
+	OP_DIV_II, OP_DIV_RR, OP_MOD_II, OP_MOD_RR,
+	
+	OP_GT_II, OP_GT_RR, OP_GTE_II, OP_GTE_RR,
+	OP_LT_II, OP_LT_RR, OP_LTE_II, OP_LTE_RR,
+	OP_EQ_II, OP_EQ_RR, OP_NE_II, OP_NE_RR,
+	
+	OP_INC_I, OP_INC_R, OP_DEC_I, OP_DEC_R
 };
 
+constexpr int OPCODE_COUNT = OP_DEC_R + 1;
+
 const char* op_name(Opcode op);
 
 /**
- * A VM operation consists of one opcode and an optional payload.
+ * A VM operation packed into 32 bits, an 8 bit opcode followed by either
+ *  three 8 bit operands a, b and c or an 8 bit a and a 16 bit bx. Values
+ *  which don't fit an operand, like most literals, go in the Function's
+ *  constant pool.
  *
  * In general, symbol[a] = op(symbol[b], symbol[c])
 **/
 struct Operation {
 	Opcode op;
 	
-	int a, b, c;
+	uint8_t a, b, c;
 	
 	Operation();
 	Operation(Opcode oc, int x, int y, int z);
+	Operation(Opcode oc, int x, int bx);
+	
+	/**
+	 * b and c read as one unsigned or signed 16 bit operand.
+	**/
+	inline uint16_t bx() const {
+		return b | (c << 8);
+	}
+	inline int16_t sbx() const {
+		return (int16_t)bx();
+	}
+	
+	/**
+	 * The operation as one word, opcode in the low byte, and back, for
+	 *  passing it where only an integer fits, like a JIT helper's
+	 *  argument register.
+	**/
+	inline uint32_t bits() const {
+		return op | a << 8 | b << 16 | (uint32_t)c << 24;
+	}
+	static inline Operation fromBits(uint32_t w) {
+		return Operation((Opcode)(w & 0xff), (w >> 8) & 0xff,
+			(w >> 16) & 0xff, w >> 24);
+	}
 	
 	std::string disasm();
 };
 
+static_assert(sizeof(Operation) == 4, "Operations must be packed");
+
+/**
+ * A protected range of a function's code. When an instruction in
+ *  [begin, end) fails, the failure value is stored in reg and execution
+ *  continues at target. Nothing runs on entering the range, the table is
+ *  only searched once something fails.
+**/
+struct Handler {
+	uint32_t begin, end, target;
+	uint8_t reg;
+};
+
 }
 
 #ifdef DEBUG
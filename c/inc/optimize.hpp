@@ -0,0 +1,50 @@
+/**
+ * Bytecode optimization passes run on a function's code before it's
+ *  finished.
+**/
+#ifndef ESPRESSO_OPTIMIZE_HPP
+#define ESPRESSO_OPTIMIZE_HPP
+
+#include <vector>
+
+#include "common.hpp"
+#include "ops.hpp"
+
+namespace esp {
+namespace vm {
+
+/**
+ * Each level includes the passes of the ones below it.
+**/
+enum OptLevel {
+	/**
+	 * Code exactly as the compiler emitted it.
+	**/
+	OPT_NONE,
+	/**
+	 * Local cleanup: NOPs, unreachable code, jump threading and loads of
+	 *  values a register already holds.
+	**/
+	OPT_LOCAL,
+	/**
+	 * Copy propagation, dead store elimination and register coalescing.
+	**/
+	OPT_FULL
+};
+
+constexpr OptLevel DEFAULT_OPT = OPT_FULL;
+
+/**
+ * Optimize code in place, lowering slots if registers are coalesced and
+ *  keeping the handlers' ranges on the code they protect. Code using
+ *  opcodes the passes don't understand is left alone.
+**/
+void optimize(
+	std::vector<Operation>& code, std::vector<Handler>& handlers,
+	uint& slots, OptLevel level
+);
+
+}
+}
+
+#endif
@@ -5,9 +5,10 @@
 #define ESPRESSO_PARSE_HPP
 
 #include "value.hpp"
+#include "optimize.hpp"
 
 namespace esp {
-	Function* parse(const std::string& code);
+	Function* parse(const std::string& code, vm::OptLevel opt=vm::DEFAULT_OPT);
 }
 
 #endif
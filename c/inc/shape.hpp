@@ -0,0 +1,142 @@
+/**
+ * Hidden classes (shapes) describing object layouts, and the inline
+ *  caches the attribute opcodes keep on them.
+**/
+#ifndef ESPRESSO_SHAPE_HPP
+#define ESPRESSO_SHAPE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include <unordered_map>
+
+#include "common.hpp"
+#include "atom.hpp"
+
+namespace esp {
+
+/**
+ * A shape maps property names to slot indices. Shapes form a tree
+ *  rooted at Shape::root(), each child adding one property, so objects
+ *  which acquire the same properties in the same order share a shape.
+ *  Shapes are immutable once created and are never freed.
+ *
+ * The tree is shared by all threads. Transitions are only ever added,
+ *  so finding one takes no lock, only adding one does.
+**/
+struct Shape {
+	/**
+	 * Shapes with more slots than this aren't created, objects that
+	 *  would need one switch to dictionary mode instead.
+	**/
+	static constexpr uint MAX_SLOTS = 64;
+	/**
+	 * Same for a shape which already has this many children, as that
+	 *  indicates objects built with ad-hoc keys.
+	**/
+	static constexpr uint MAX_TRANSITIONS = 32;
+	
+	Shape* parent;
+	
+	/**
+	 * Keys in slot order.
+	**/
+	std::vector<Atom> keys;
+	
+	/**
+	 * Atom -> slot for shapes too large to scan linearly.
+	**/
+	std::unordered_map<Atom, uint> index;
+	
+	/**
+	 * Children by the key they add. Each is written before
+	 *  transitionCount is raised past it, like InlineCache's entries.
+	**/
+	struct Transition {
+		Atom key;
+		Shape* next;
+	};
+	Transition transitions[MAX_TRANSITIONS];
+	std::atomic<uint> transitionCount;
+	
+	static Shape* root();
+	
+	inline uint size() const {
+		return keys.size();
+	}
+	
+	/**
+	 * The slot of key, or -1 if this shape doesn't have it.
+	**/
+	int lookup(Atom key) const;
+	
+	/**
+	 * The shape with key appended, or nullptr if the object should be
+	 *  put into dictionary mode.
+	**/
+	Shape* add(Atom key);
+
+private:
+	Shape(Shape* p, Atom key);
+	
+	/**
+	 * The child adding key, or nullptr if there's none yet.
+	**/
+	Shape* child(Atom key) const;
+};
+
+/**
+ * Per-instruction cache of the shapes an attribute opcode has seen.
+ *  Entries record the slot the key was found at (-1 if absent) and, for
+ *  stores which add a property, the shape after the transition.
+ *
+ * Caches of frozen functions are used by every thread running them.
+ *  Entries are only added under a lock and each is written before count
+ *  is raised past it, so lookups don't need one.
+**/
+struct InlineCache {
+	static constexpr int WAYS = 4;
+	
+	struct Entry {
+		Shape* shape;
+		Shape* next;
+		int slot;
+	};
+	
+	Atom key;
+	/**
+	 * Number of live entries, or WAYS + 1 once megamorphic.
+	**/
+	std::atomic<uint8_t> count;
+	Entry entries[WAYS];
+	
+	inline InlineCache(Atom k):key(k), count(0) {}
+	
+	inline InlineCache(const InlineCache& ic)
+		:key(ic.key), count(ic.count.load(std::memory_order_relaxed)) {
+		std::copy(ic.entries, ic.entries + WAYS, entries);
+	}
+	
+	inline const Entry* find(Shape* shape) const {
+		int n = count.load(std::memory_order_acquire);
+		for(int i = 0; i < n && i < WAYS; ++i) {
+			if(entries[i].shape == shape) {
+				return &entries[i];
+			}
+		}
+		return nullptr;
+	}
+	
+	void insert(Shape* shape, Shape* next, int slot);
+	
+	inline bool isMonomorphic() const {
+		return count.load(std::memory_order_relaxed) == 1;
+	}
+	inline bool isMegamorphic() const {
+		return count.load(std::memory_order_relaxed) > WAYS;
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,72 @@
+/**
+ * Element-wise kernels over packed arrays.
+**/
+#ifndef ESPRESSO_SIMD_HPP
+#define ESPRESSO_SIMD_HPP
+
+#include "common.hpp"
+
+namespace esp {
+namespace simd {
+
+enum Op : uint8_t {
+	ADD, SUB, MUL, DIV,
+	LT, LTE, GT, GTE, EQ, NE
+};
+
+/**
+ * Instruction sets with kernels, in increasing order. The best one the
+ *  CPU supports is selected the first time a kernel runs.
+**/
+enum Level : uint8_t {
+	SCALAR, SSE2, AVX2
+};
+
+Level level();
+
+/**
+ * Select kernels at or below the given level, returning the level
+ *  actually in use. Mostly for benchmarks and tests.
+**/
+Level setLevel(Level l);
+
+const char* level_name(Level l);
+
+/**
+ * Each kernel computes out[i] = a[i] op b[i] for i < n. When va or vb
+ *  is false that operand is a single scalar broadcast to every element.
+**/
+
+/**
+ * ADD, SUB, MUL or DIV.
+**/
+void reals(
+	Op op, const double* a, bool va, const double* b, bool vb,
+	double* out, size_t n
+);
+
+/**
+ * ADD, SUB or MUL. Returns false if any element overflowed 64 bits, in
+ *  which case the contents of out are unspecified.
+**/
+bool ints(
+	Op op, const int64_t* a, bool va, const int64_t* b, bool vb,
+	int64_t* out, size_t n
+);
+
+/**
+ * Comparisons writing 0 or 1 per element.
+**/
+void compareReals(
+	Op op, const double* a, bool va, const double* b, bool vb,
+	uint8_t* out, size_t n
+);
+void compareInts(
+	Op op, const int64_t* a, bool va, const int64_t* b, bool vb,
+	uint8_t* out, size_t n
+);
+
+} /* namespace simd */
+} /* namespace esp */
+
+#endif
@@ -5,12 +5,13 @@
 #define ESPRESSO_TOKEN_HPP
 
 #include "common.hpp"
+#include "atom.hpp"
 
 namespace esp {
 
 enum TokenType {
 	TT_NONE, TT_ERROR, TT_END,
-	TT_NIL, TT_BOOL, TT_INT, TT_OP
+	TT_NIL, TT_BOOL, TT_INT, TT_BIGINT, TT_REAL, TT_STRING, TT_IDENT, TT_OP
 };
 
 #ifdef DEBUG
@@ -21,9 +22,14 @@ inline std::string toString<TokenType>(TokenType v) {
 	switch(v) {
 		case TT_NONE: return "TT_NONE";
 		case TT_ERROR: return "TT_ERROR";
+		case TT_END: return "TT_END";
 		case TT_NIL: return "TT_NIL";
 		case TT_BOOL: return "TT_BOOL";
 		case TT_INT: return "TT_INT";
+		case TT_BIGINT: return "TT_BIGINT";
+		case TT_REAL: return "TT_REAL";
+		case TT_STRING: return "TT_STRING";
+		case TT_IDENT: return "TT_IDENT";
 		case TT_OP: return "TT_OP";
 	}
 	return "TT_<UNK>";
@@ -35,7 +41,11 @@ inline std::string toString<TokenType>(TokenType v) {
 enum Symbol {
 	TK_NONE,
 	TK_PLUS, TK_MINUS, TK_ASTERISK, TK_FSLASH, TK_PERCENT,
+	TK_LT, TK_LTE, TK_GT, TK_GTE, TK_EQ, TK_NE,
+	TK_DOT, TK_COMMA, TK_COLON, TK_SEMICOLON, TK_DOLLAR,
+	TK_LPAREN, TK_RPAREN, TK_LBRACKET, TK_RBRACKET, TK_LBRACE, TK_RBRACE,
 	
+	TK_IF, TK_THEN, TK_ELSE, TK_LET, TK_TRY, TK_CATCH, TK_FAIL,
 	TK_RETURN
 };
 
@@ -48,6 +58,10 @@ inline std::string toString<Symbol>(Symbol v) {
 		case TK_NONE: return "TK_NONE";
 		case TK_PLUS: return "TK_PLUS";
 		case TK_MINUS: return "TK_MINUS";
+		case TK_DOT: return "TK_DOT";
+		case TK_COMMA: return "TK_COMMA";
+		case TK_COLON: return "TK_COLON";
+		case TK_DOLLAR: return "TK_DOLLAR";
 		case TK_RETURN: return "TK_RETURN";
 	}
 	
@@ -70,6 +84,8 @@ struct Token {
 	union TokenValue {
 		bool b;
 		esp_int i;
+		esp_real r;
+		Atom atom;
 		Symbol sym;
 	} value;
 	
@@ -77,6 +93,8 @@ struct Token {
 	Token(TokenType tt, Position ori, size_t len, bool v);
 	Token(TokenType tt, Position ori, size_t len, int i);
 	Token(TokenType tt, Position ori, size_t len, esp_int i);
+	Token(TokenType tt, Position ori, size_t len, esp_real r);
+	Token(TokenType tt, Position ori, size_t len, Atom atom);
 	Token(TokenType tt, Position ori, size_t len, Symbol sym);
 	
 	operator bool();
@@ -91,6 +109,7 @@ inline std::string toString<Token>(Token v) {
 	switch(v.type) {
 		case TT_NONE:
 		case TT_ERROR:
+		case TT_END:
 		case TT_NIL:
 			return out;
 		
@@ -100,6 +119,15 @@ inline std::string toString<Token>(Token v) {
 		case TT_INT:
 			return out + '(' + toString(v.value.i) + ')';
 		
+		case TT_BIGINT:
+			return out + '(' + std::string(v.origin.cur, v.length) + ')';
+		
+		case TT_REAL:
+			return out + '(' + toString(v.value.r) + ')';
+		
+		case TT_IDENT:
+			return out + '(' + atom_name(v.value.atom) + ')';
+		
 		case TT_OP:
 			return out + '(' + toString(v.value.sym) + ')';
 	}
@@ -114,6 +142,12 @@ struct Lexer {
 	Position pos;
 	Token lookahead;
 	
+	/**
+	 * Contents of the lookahead if it's a TT_STRING. String literals
+	 *  aren't interned, so one-off literals die with their unit.
+	**/
+	std::string str;
+	
 	Lexer(const char* code);
 	
 	void advance();
@@ -127,6 +161,7 @@ struct Lexer {
 	
 	bool nextOperator();
 	bool nextNumber();
+	bool nextString();
 	bool nextIdent();
 };
 
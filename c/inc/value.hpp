@@ -4,66 +4,556 @@
 #ifndef ESPRESSO_VALUE_HPP
 #define ESPRESSO_VALUE_HPP
 
+#include <climits>
 #include <cmath>
 #include <stdexcept>
-#include <map>
 #include <vector>
-#include <variant>
 #include <string>
+#include <string_view>
 #include <cassert>
+#include <type_traits>
 
 #include "common.hpp"
+#include "atom.hpp"
+#include "shape.hpp"
+#include "hamt.hpp"
+#include "bigint.hpp"
+#include "simd.hpp"
+#include "gc.hpp"
+#include "arena.hpp"
 #include "vm.hpp"
 #include "ops.hpp"
+#include "jit.hpp"
 
 namespace esp {
 
 struct Object;
+struct Array;
 struct Function;
 struct Value;
 struct MethodProxy;
 struct Result;
 
-struct Object {
-	std::map<std::string, Value> entries;
+/**
+ * Base of the immutable, reference-counted payloads which can't fit in
+ *  a Value's 48 bit immediate. Each Value owns one reference.
+ *
+ * Counts aren't atomic, so a payload belongs to the thread whose values
+ *  reference it, except for immortal ones, see vm::freeze, which are
+ *  never counted or freed and so can be shared without any writes.
+**/
+struct Shared {
+	static constexpr uint IMMORTAL = UINT_MAX;
+	
+	uint refs = 1;
+	
+	inline void incref() {
+		if(refs != IMMORTAL) {
+			++refs;
+		}
+	}
+	
+	inline bool decref() {
+		return refs != IMMORTAL && --refs == 0;
+	}
+	
+	inline bool isImmortal() const {
+		return refs == IMMORTAL;
+	}
+};
+
+/**
+ * Copy-on-write storage for the slots of an object, with the values
+ *  following the header in the same allocation. Objects copied with
+ *  Object::copyFrom share it until one of them writes.
+**/
+struct alignas(uint64_t) SlotArray : public Shared {
+	uint size, capacity;
+	
+	static SlotArray* alloc(uint capacity);
+	
+	/**
+	 * An unshared copy with room for at least n values.
+	**/
+	SlotArray* copy(uint n);
+	
+	inline Value* values() {
+		return (Value*)(this + 1);
+	}
+	
+	void release();
+
+private:
+	inline SlotArray(uint c):size(0), capacity(c) {}
+};
+
+/**
+ * Objects store their properties in a slot array laid out by a shared
+ *  Shape. Objects which delete properties or outgrow the shape tree fall
+ *  back to dictionary mode, keeping their properties in a Hamt.
+ *
+ * Both kinds of storage are persistent, so copying an object shares it
+ *  and a modified copy only pays for what it changes: O(1) to share,
+ *  then one slot array copy (at most Shape::MAX_SLOTS values) or O(log n)
+ *  trie nodes on the first write.
+ *
+ * Objects are collected by the gc::Heap of the Environment which
+ *  allocated them, and every store of a value into one must go through
+ *  writeBarrier.
+**/
+struct Object : public gc::Cell {
+	/**
+	 * Layout of slots, or nullptr in dictionary mode.
+	**/
+	Shape* shape;
+	
+	/**
+	 * nullptr until the first property is added and in dictionary mode.
+	**/
+	SlotArray* slots;
+	Hamt dict;
+	
+	Object();
+	~Object();
+	
+	Object(const Object&) = delete;
+	Object& operator=(const Object&) = delete;
+	
+	inline bool isDictionary() const {
+		return !shape;
+	}
+	
+	/**
+	 * Replace this object's properties with o's, sharing its storage.
+	**/
+	void copyFrom(Object* o);
+	
+	/**
+	 * The property's storage, or nullptr if it doesn't exist.
+	**/
+	const Value* find(Atom key);
+	void set(Atom key, Value v);
+	bool del(Atom key);
+	
+	void toDictionary();
+	
+	/**
+	 * Direct slot access for inline caches, the caller must have checked
+	 *  the shape.
+	**/
+	inline const Value& getSlot(int i);
+	inline void setSlot(int i, Value v);
+	
+	/**
+	 * Append a slot for the transition to next.
+	**/
+	void addSlot(Shape* next, Value v);
+	
+	inline void writeBarrier(const Value& v);
+	
+	/**
+	 * Barrier for each object held by a stored array.
+	**/
+	void barrierArray(Array* a);
+
+private:
+	void unshare();
+};
+
+/**
+ * A compilation unit, owning the arena its Functions and their code,
+ *  constants and caches are allocated from. Each live Function holds a
+ *  reference to its unit, so the whole unit is freed in one shot once
+ *  none of them are referenced.
+**/
+struct Unit : public Shared {
+	Arena arena;
+	
+	inline void release() {
+		if(decref()) {
+			delete this;
+		}
+	}
 };
 
 /**
  * A set of instructions which can run on the VM.
+ *
+ * Functions are immutable code which can't reference objects, so they
+ *  can't form cycles and are reference-counted rather than collected.
+ *  parse() returns a Function with one reference owned by the caller.
+ *  They live in their Unit's arena, so dropping the last reference
+ *  releases the unit rather than freeing the Function itself. A Function
+ *  holds one reference to its unit while its own count is nonzero, and
+ *  nested functions start at zero, so the unit can't keep itself alive.
+ *
+ * The only writes to code are the interpreter quickening instructions
+ *  between their generic and specialized forms, which compute the same
+ *  thing.
 **/
-struct Function {
-	std::vector<vm::Operation> code;
+struct Function : public Shared {
+	Unit* unit;
+	
+	/**
+	 * The name it was declared with by let, ATOM_EMPTY if anonymous.
+	**/
+	Atom name;
+	
+	Span<vm::Operation> code;
 	uint slots;
 	
-	Result call(Environment* env, std::vector<Value> args);
+	/**
+	 * Instruction and register counts as compiled, before optimization.
+	**/
+	uint rawSize, rawSlots;
+	
+	/**
+	 * The handler address of each instruction when the interpreter is
+	 *  built with threaded dispatch.
+	**/
+	Span<const void*> threaded;
+	
+	/**
+	 * Literals loaded by OP_CONST.
+	**/
+	Span<Value> constants;
+	
+	/**
+	 * Inline caches of the attribute opcodes, indexed by their operand.
+	**/
+	Span<InlineCache> caches;
+	
+	/**
+	 * Functions of the same unit loaded by OP_FUNC, which don't own a
+	 *  reference to them.
+	**/
+	Span<Function*> functions;
+	
+	/**
+	 * Protected ranges of code, innermost first.
+	**/
+	Span<vm::Handler> handlers;
+	
+	/**
+	 * Machine code, null until the JIT compiles the function the first
+	 *  time it's entered with the JIT on, or if it can't be compiled.
+	 *  jitTried keeps it from trying again.
+	**/
+	jit::Code* native;
+	bool jitTried;
+	
+	/**
+	 * C++ translated by espc, which runs in place of code. It takes self
+	 *  and the arguments as the n values at args, which it may move from.
+	**/
+	Result (*compiled)(Environment* env, Value* args, uint n);
+	
+	/**
+	 * Hotness counters: entries from calls, including tail calls of
+	 *  other functions, and loops, its tail calls of itself. Environment
+	 *  tiers functions up by them, see Environment::TierPolicy.
+	**/
+	uint64_t calls, loops;
+	
+	/**
+	 * The level code was optimized at and the tier it has reached.
+	**/
+	vm::OptLevel opt;
+	vm::Tier tier;
+	
+	/**
+	 * Heat at which an attempt to reoptimize is next made, after one
+	 *  found the function active.
+	**/
+	uint64_t retry;
+	
+	/**
+	 * Frames running the function in any environment, which its code
+	 *  can't be replaced under. Not kept once it's frozen.
+	**/
+	uint active;
+	
+	/**
+	 * Set by vm::freeze, after which nothing writes to the function but
+	 *  quickening and its inline caches, and it isn't counted.
+	**/
+	bool frozen;
+	
+	/**
+	 * Takes a reference to u unless the function is nested in another.
+	**/
+	inline Function(Unit* u, bool nested=false)
+		:unit(u), name(ATOM_EMPTY), slots(0), rawSize(0), rawSlots(0),
+		native(nullptr), jitTried(false), compiled(nullptr),
+		calls(0), loops(0), opt(vm::OPT_NONE), tier(vm::TIER_INTERPRETED),
+		retry(0), active(0), frozen(false) {
+		if(nested) {
+			refs = 0;
+		}
+		else {
+			u->incref();
+		}
+	}
+	
+	/**
+	 * Call in env. If it's null, call in the environment owning self,
+	 *  see Environment::owner, or failing that this thread's, see
+	 *  Environment::local.
+	**/
+	Result call(Environment* env, const Value& self, Span<const Value> args);
+	Result call(Environment* env, const std::vector<Value>& args);
 	
 	std::string disasm();
+	
+	/**
+	 * Drop the caller's reference. A frozen function is immortal, so
+	 *  the reference to its unit it stood for is dropped instead.
+	**/
+	inline void release() {
+		if(isImmortal() || decref()) {
+			unit->release();
+		}
+	}
+};
+
+/**
+ * Immutable byte storage shared by strings and their slices. The bytes
+ *  follow the header in the same allocation.
+**/
+struct Buffer : public Shared {
+	size_t size;
+	
+	static Buffer* alloc(size_t n);
+	static Buffer* copy(const char* s, size_t n);
+	
+	inline char* bytes() {
+		return (char*)(this + 1);
+	}
+	
+	inline void release() {
+		if(decref()) {
+			this->~Buffer();
+			::operator delete(this);
+		}
+	}
+
+private:
+	inline Buffer(size_t n):size(n) {}
+};
+
+/**
+ * Heap-allocated string payload. A string is either flat, viewing
+ *  length bytes of a shared Buffer, or a rope node concatenating two
+ *  other strings. Ropes are flattened in place the first time contiguous
+ *  bytes are needed. Neither copying nor slicing a flat string copies
+ *  its bytes.
+**/
+struct String : public Shared {
+	/**
+	 * Concatenations shorter than this are copied rather than roped.
+	**/
+	static constexpr size_t MIN_ROPE = 64;
+	
+	/**
+	 * Backing storage and the start of this string within it, both null
+	 *  while a rope.
+	**/
+	Buffer* buf;
+	const char* ptr;
+	size_t length;
+	
+	/**
+	 * Rope children, both null when flat.
+	**/
+	String *left, *right;
+	
+	String(const char* s, size_t n);
+	String(Buffer* b, const char* p, size_t n);
+	
+	~String();
+	
+	/**
+	 * Concatenate two strings, borrowing both.
+	**/
+	static String* concat(String* l, String* r);
+	
+	/**
+	 * A string of len bytes starting at begin which shares this string's
+	 *  buffer. The caller must clamp the range.
+	**/
+	String* slice(size_t begin, size_t len);
+	
+	inline bool isRope() const {
+		return left;
+	}
+	
+	inline size_t size() const {
+		return length;
+	}
+	
+	/**
+	 * The contiguous contents, flattening if this is a rope.
+	**/
+	inline std::string_view flat() {
+		if(isRope()) {
+			flatten();
+		}
+		return std::string_view(ptr, length);
+	}
+
+private:
+	String(String* l, String* r);
+	
+	void flatten();
+};
+
+/**
+ * Heap-allocated integer payload for ints which overflow the immediate.
+ *  Ints are only boxed when they don't fit, so a BoxedInt is never in
+ *  the immediate range.
+**/
+struct BoxedInt : public Shared {
+	BigInt value;
+	
+	inline BoxedInt(BigInt v):value(std::move(v)) {}
 };
 
+/**
+ * Immutable array of values. Homogeneous ints (within 64 bits) and reals
+ *  are packed unboxed and contiguous, anything else is stored as boxed
+ *  Values. The elements follow the header in the same allocation.
+ *
+ * Arithmetic and comparison operators apply element-wise, broadcasting
+ *  scalar operands and truncating to the shorter of two arrays. Packed
+ *  operands run through the simd kernels, others apply the scalar
+ *  operator to each pair of elements.
+**/
+struct Array : public Shared {
+	enum Kind : uint8_t {
+		INTS, REALS, BOXED
+	};
+	
+	Kind kind;
+	size_t length;
+	
+	/**
+	 * Elements of a BOXED array start as nil, packed ones are
+	 *  uninitialized and must be filled before the array is shared.
+	**/
+	static Array* alloc(Kind k, size_t n);
+	
+	/**
+	 * Copy n values into an array of the narrowest kind holding them.
+	**/
+	static Array* pack(const Value* v, size_t n);
+	
+	inline int64_t* ints() {
+		return (int64_t*)(this + 1);
+	}
+	inline double* reals() {
+		return (double*)(this + 1);
+	}
+	inline Value* values() {
+		return (Value*)(this + 1);
+	}
+	
+	inline size_t size() const {
+		return length;
+	}
+	
+	Value at(size_t i);
+	
+	/**
+	 * Element-wise l op r where at least one operand is an array. If the
+	 *  operator fails on any pair of elements, so does the whole thing.
+	**/
+	static Result apply(simd::Op op, Value& l, Value& r);
+	
+	inline void release() {
+		if(decref()) {
+			destroy();
+		}
+	}
+	
+	/**
+	 * Free an array whose last reference was dropped.
+	**/
+	void destroy();
+
+private:
+	inline Array(Kind k, size_t n):kind(k), length(n) {}
+};
+
+static_assert(sizeof(void*) == 8 && sizeof(esp_real) == 8,
+	"NaN-boxed values require a 64 bit target with a double esp_real"
+);
+
 /**
  * Boxed value. By design, this is meant to be passed by value
+ *
+ * Values are NaN-boxed into 64 bits. Any bit pattern which isn't a
+ *  negative quiet NaN is a real (all NaN reals are canonicalized to the
+ *  positive quiet NaN), and the remaining space holds a 3 bit tag in
+ *  bits 48-50 and a 48 bit payload:
+ *
+ *   SPECIAL  nil, false and true
+ *   INT      48 bit signed immediate int
+ *   BIGINT   BoxedInt* for arbitrary-precision ints outside the
+ *            immediate range
+ *   STRING   String*
+ *   ARRAY    Array*
+ *   FUNCTION Function*
+ *   OBJECT   Object*
+ *
+ * INT and BIGINT are adjacent so isInt() is one comparison, and the
+ *  same holds for the reference-counted tags BIGINT to FUNCTION.
 **/
 struct Value {
 	/**
-	 * Tags for the value union. These values will not be consistent across
+	 * Public type of a value. These values will not be consistent across
 	 *  implementations, they need only be powers of 2 for type masks.
 	**/
 	enum Type {
 		NIL = 1, BOOL = 2,
 		INT = 4, REAL = 8, STRING = 16,
-		OBJECT = 32, FUNCTION = 64
-	} type;
+		OBJECT = 32, FUNCTION = 64, ARRAY = 128
+	};
 	
-	std::variant<
-		std::monostate,
-		bool, esp_int, esp_real, std::string,
-		Function*, Object* //, void*
-	> value;
+	/**
+	 * Internal NaN-box tags. 0 is never produced because it overlaps the
+	 *  default NaN of x86.
+	**/
+	enum Tag {
+		TAG_SPECIAL = 1,
+		TAG_INT = 2, TAG_BIGINT = 3, TAG_STRING = 4,
+		TAG_ARRAY = 5, TAG_FUNCTION = 6, TAG_OBJECT = 7
+	};
+	
+	static constexpr uint64_t BOX = 0xfff8000000000000ull;
+	static constexpr int TAG_SHIFT = 48;
+	static constexpr uint64_t PAYLOAD = (1ull << TAG_SHIFT) - 1;
+	
+	static constexpr uint64_t tagged(Tag t) {
+		return BOX | ((uint64_t)t << TAG_SHIFT);
+	}
+	
+	static constexpr uint64_t SPECIAL_BITS =
+		BOX | ((uint64_t)TAG_SPECIAL << TAG_SHIFT);
+	static constexpr uint64_t NIL_BITS = SPECIAL_BITS | 0;
+	static constexpr uint64_t FALSE_BITS = SPECIAL_BITS | 2;
+	static constexpr uint64_t TRUE_BITS = SPECIAL_BITS | 3;
+	static constexpr uint64_t CANON_NAN = 0x7ff8000000000000ull;
+	
+	static constexpr esp_int SMALL_MIN = -(esp_int(1) << (TAG_SHIFT - 1));
+	static constexpr esp_int SMALL_MAX = (esp_int(1) << (TAG_SHIFT - 1)) - 1;
+	
+	uint64_t bits;
+	
+	static const Value nil;
 	
-	static Value nil;
-
 	Value();
 	Value(const Value& v);
+	Value(Value&& v) noexcept;
 	Value(bool v);
 	
 	// Overload all integer types to avoid type ambiguity
@@ -77,48 +567,166 @@ struct Value {
 	Value(double v);
 	Value(long double v);
 	
+	/**
+	 * Demotes to an immediate when the value fits.
+	**/
+	Value(BigInt v);
+	
 	Value(const char* v);
 	Value(const std::string& v);
-
-#ifdef DEBUG
-	#define VALUE_IS(vt, name, native) \
-		inline bool is##name() { \
-			assert( \
-				(type == (vt)) == std::holds_alternative<native>(value) \
-			); \
-			return type == (vt); \
-		}
-#else
-	#define VALUE_IS(vt, name, native) \
-		inline bool is##name() { \
-			return type == (vt); \
-		}
-#endif
 	
-	VALUE_IS(NIL, Nil, std::monostate)
-	VALUE_IS(BOOL, Bool, bool)
-	VALUE_IS(INT, Int, esp_int)
-	VALUE_IS(REAL, Real, esp_real)
+	Value(String* v);
+	Value(Array* v);
+	Value(Function* v);
+	Value(Object* v);
+	
+	~Value();
+	
+	Value& operator=(const Value& v);
+	Value& operator=(Value&& v) noexcept;
+	
+	/**
+	 * Wrap a new string or array, taking over the caller's reference.
+	**/
+	static inline Value adopt(String* s) {
+		Value v(s);
+		s->decref();
+		return v;
+	}
+	static inline Value adopt(Array* a) {
+		Value v(a);
+		a->decref();
+		return v;
+	}
+	
+	/**
+	 * Build a value directly from its boxed representation without
+	 *  touching reference counts.
+	**/
+	static inline Value fromBits(uint64_t b) {
+		Value v;
+		v.bits = b;
+		return v;
+	}
+	
+	/**
+	 * Unchecked constructors for the interpreter's quickened opcodes,
+	 *  which have already checked the types. v must fit the immediate.
+	**/
+	static inline Value fromSmallInt(esp_int v) {
+		return fromBits(tagged(TAG_INT) | ((uint64_t)v & PAYLOAD));
+	}
+	static inline Value fromReal(esp_real r) {
+		uint64_t b;
+		__builtin_memcpy(&b, &r, sizeof(b));
+		return fromBits(r != r? CANON_NAN : b);
+	}
+	static inline Value fromBool(bool v) {
+		return fromBits(v? TRUE_BITS : FALSE_BITS);
+	}
+	
+	static inline bool fitsSmallInt(int64_t v) {
+		return v >= SMALL_MIN && v <= SMALL_MAX;
+	}
+	
+	inline Tag tag() const {
+		return (Tag)((bits >> TAG_SHIFT) & 7);
+	}
+	
+	Type type() const;
 	
-	inline bool isNumber() {
+	inline bool isNil() const {
+		return bits == NIL_BITS;
+	}
+	inline bool isBool() const {
+		return (bits | 1) == TRUE_BITS;
+	}
+	inline bool isReal() const {
+		return (bits & BOX) != BOX;
+	}
+	inline bool isInt() const {
+		return bits - tagged(TAG_INT) < (2ull << TAG_SHIFT);
+	}
+	inline bool isSmallInt() const {
+		return (bits >> TAG_SHIFT) == (tagged(TAG_INT) >> TAG_SHIFT);
+	}
+	inline bool isNumber() const {
 		return isInt() || isReal();
 	}
+	inline bool isString() const {
+		return (bits >> TAG_SHIFT) == (tagged(TAG_STRING) >> TAG_SHIFT);
+	}
+	inline bool isArray() const {
+		return (bits >> TAG_SHIFT) == (tagged(TAG_ARRAY) >> TAG_SHIFT);
+	}
+	inline bool isFunction() const {
+		return (bits >> TAG_SHIFT) == (tagged(TAG_FUNCTION) >> TAG_SHIFT);
+	}
+	inline bool isObject() const {
+		return (bits >> TAG_SHIFT) == (tagged(TAG_OBJECT) >> TAG_SHIFT);
+	}
+	
+	/**
+	 * Whether the payload is a reference-counted Shared.
+	**/
+	inline bool isShared() const {
+		return bits - tagged(TAG_BIGINT) < (4ull << TAG_SHIFT);
+	}
 	
-	VALUE_IS(STRING, String, std::string)
-	VALUE_IS(FUNCTION, Function, Function*)
-	VALUE_IS(OBJECT, Object, Object*)
+	/**
+	 * Make a string or big int payload immortal, flattening a rope, so
+	 *  the value can be copied on any thread. It's never freed.
+	**/
+	void makeImmortal();
 	
 	inline bool isCallable() {
-		return isFunction() || hasMethod("()");
+		return isFunction() || hasMethod(ATOM_CALL);
+	}
+	
+	/**
+	 * Unchecked payload accessors, the caller must verify the type.
+	**/
+	inline esp_int asSmallInt() const {
+		return (int64_t)(bits << (64 - TAG_SHIFT)) >> (64 - TAG_SHIFT);
+	}
+	inline esp_real asReal() const {
+		esp_real r;
+		__builtin_memcpy(&r, &bits, sizeof(r));
+		return r;
+	}
+	inline bool asBool() const {
+		return bits & 1;
+	}
+	inline void* asPointer() const {
+		return (void*)(bits & PAYLOAD);
+	}
+	inline String* asString() const {
+		return (String*)asPointer();
+	}
+	inline BoxedInt* asBoxedInt() const {
+		return (BoxedInt*)asPointer();
+	}
+	inline Array* asArray() const {
+		return (Array*)asPointer();
+	}
+	inline Object* asObject() const {
+		return (Object*)asPointer();
+	}
+	inline Function* asFunction() const {
+		return (Function*)asPointer();
 	}
-
-#undef VALUE_IS
 	
 	bool toBool();
 	esp_int toInt();
 	esp_real toReal();
 	std::string toString();
 	
+	/**
+	 * Substring [begin, end) of a string, clamped to its bounds and
+	 *  sharing its bytes. Non-strings are converted first.
+	**/
+	Value slice(esp_int begin, esp_int end);
+	
 	/**
 	 * No integer or real type coercion because it produces ambiguity.
 	**/
@@ -131,6 +739,17 @@ struct Value {
 		return toString();
 	}
 	
+	MethodProxy get(Atom k);
+	void set(Atom k, Value v);
+	bool has(Atom k);
+	bool del(Atom k);
+	
+	bool hasMethod(Atom k);
+	
+	/**
+	 * String-keyed forms for embedders. Only set interns the key, the
+	 *  rest treat one which was never interned as absent.
+	**/
 	MethodProxy get(const std::string& k);
 	void set(const std::string& k, Value v);
 	bool has(const std::string& k);
@@ -138,6 +757,13 @@ struct Value {
 	
 	bool hasMethod(const std::string& s);
 	
+	/**
+	 * Calling anything but a function gives nil. The variadic forms build
+	 *  their arguments in an array on the C++ stack, so they don't
+	 *  allocate.
+	**/
+	Result call(Environment* env, const Value& self, Span<const Value> args);
+	
 	template<typename... ARGS>
 	Result call(Environment* env, Value self, ARGS... args);
 	template<typename... ARGS>
@@ -147,6 +773,14 @@ struct Value {
 	Result call(Value self);
 	Result call();
 	
+	template<typename... ARGS>
+	Result callMethod(Environment* env, Atom name, ARGS... args);
+	template<typename... ARGS>
+	Result callMethod(Atom name, ARGS... args);
+	
+	Result callMethod(Environment* env, Atom name);
+	Result callMethod(Atom name);
+	
 	template<typename... ARGS>
 	Result callMethod(
 		Environment* env, const std::string& name, ARGS... args
@@ -188,8 +822,83 @@ struct Value {
 	
 	template<typename... ARGS>
 	Result operator()(Value self, ARGS... args);
+
+private:
+	inline void retain() const {
+		if(isShared()) {
+			((Shared*)asPointer())->incref();
+		}
+	}
+	inline void release() {
+		if(isShared()) {
+			drop();
+		}
+	}
+	
+	/**
+	 * Release a reference to the shared payload.
+	**/
+	void drop();
 };
 
+static_assert(sizeof(Value) == 8, "Value must be NaN-boxed");
+static_assert(std::is_nothrow_move_constructible<Value>::value,
+	"Growing a vector of Values must move rather than copy them");
+
+/**
+ * Copying and assignment are inline so moving immediates around never
+ *  leaves the caller's translation unit.
+**/
+inline Value::Value():bits(NIL_BITS) {}
+inline Value::Value(const Value& v):bits(v.bits) {
+	retain();
+}
+inline Value::Value(Value&& v) noexcept:bits(v.bits) {
+	v.bits = NIL_BITS;
+}
+
+inline Value::~Value() {
+	release();
+}
+
+inline Value& Value::operator=(const Value& v) {
+	v.retain();
+	release();
+	bits = v.bits;
+	return *this;
+}
+inline Value& Value::operator=(Value&& v) noexcept {
+	if(this != &v) {
+		release();
+		bits = v.bits;
+		v.bits = NIL_BITS;
+	}
+	return *this;
+}
+
+inline void Object::writeBarrier(const Value& v) {
+	if(gen == gc::OLD) {
+		if(v.isObject()) {
+			heap->barrier(this, v.asObject());
+		}
+		else if(v.isArray()) {
+			barrierArray(v.asArray());
+		}
+	}
+}
+
+inline const Value& Object::getSlot(int i) {
+	return slots->values()[i];
+}
+
+inline void Object::setSlot(int i, Value v) {
+	writeBarrier(v);
+	if(slots->refs > 1) {
+		unshare();
+	}
+	slots->values()[i] = std::move(v);
+}
+
 #ifdef DEBUG
 inline std::string toString(Value v) {
 	return v.toString();
@@ -205,11 +914,21 @@ protected:
 	 * True if this result is from fail, false if it's from return.
 	**/
 	bool failed;
-	
+
 public:
 	inline Result():Value(), failed(false) {}
 	
 	inline Result(const Value& v):Value(v), failed(false) {}
+	inline Result(Value&& v):Value(std::move(v)), failed(false) {}
+	
+	/**
+	 * A failure carrying v, as if from fail v.
+	**/
+	static inline Result failure(Value v) {
+		Result r(std::move(v));
+		r.failed = true;
+		return r;
+	}
 	
 	template<typename T>
 	Result(T v):Result(Value(v)) {}
@@ -221,6 +940,10 @@ public:
 		return !failed;
 	}
 	
+	/**
+	 * The returned value, throwing if this is a failure. For embedders,
+	 *  the interpreter checks isFailure and unwinds on its own.
+	**/
 	inline Value value() {
 		if(failed) {
 			throw std::runtime_error(Value::toString());
@@ -237,21 +960,19 @@ public:
 struct MethodProxy : public Value {
 	Value self;
 	
+	inline MethodProxy(const Value& v, const Value& s):Value(v), self(s) {}
+	
 	template<typename... REST>
 	Result call(Environment* env, REST... rest) {
-		Value::call(env, self, rest...);
+		return Value::call(env, self, rest...);
 	}
 };
 
 template<typename... ARGS>
 Result Value::call(Environment* env, Value self, ARGS... args) {
-	std::vector<Value> als = {{args...}};
-	if(isFunction()) {
-		return env->call(std::get<Function*>(value), self, als);
-	}
-	else {
-		return nil;
-	}
+	// One spare element so an empty pack still makes an array
+	const Value als[sizeof...(ARGS) + 1] = {Value(args)...};
+	return call(env, self, Span<const Value>{als, sizeof...(ARGS)});
 }
 
 template<typename... ARGS>
@@ -259,11 +980,26 @@ Result Value::call(Value self, ARGS... args) {
 	return call(nullptr, self, args...);
 }
 
+template<typename... ARGS>
+Result Value::callMethod(Environment* env, Atom name, ARGS... args) {
+	// The proxy passes this as self
+	return get(name).call(env, args...);
+}
+
+template<typename... ARGS>
+Result Value::callMethod(Atom name, ARGS... args) {
+	return callMethod(nullptr, name, args...);
+}
+
 template<typename... ARGS>
 Result Value::callMethod(
 	Environment* env, const std::string& name, ARGS... args
 ) {
-	return get(name).call(env, *this, args...);
+	Atom a;
+	if(!find_atom(name, a)) {
+		return nil;
+	}
+	return callMethod(env, a, args...);
 }
 
 template<typename... ARGS>
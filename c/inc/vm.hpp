@@ -4,30 +4,257 @@
 #ifndef ESPRESSO_VM_HPP
 #define ESPRESSO_VM_HPP
 
-#include <stack>
 #include <vector>
 #include <string>
+#include <functional>
 
 #include "common.hpp"
 #include "ops.hpp"
+#include "gc.hpp"
+#include "arena.hpp"
+#include "optimize.hpp"
 
 namespace esp {
-namespace vm {
-	struct StackFrame;
-}
-
 struct Result;
 struct Function;
+struct Object;
 struct Value;
+struct InlineCache;
+
+namespace vm {
+	/**
+	 * How a function runs, each tier costing more to reach and running
+	 *  faster than the last.
+	**/
+	enum Tier : uint8_t {
+		/**
+		 * Bytecode as parsed below OPT_FULL, which starts running
+		 *  without waiting on the optimizer.
+		**/
+		TIER_INTERPRETED,
+		/**
+		 * Bytecode at OPT_FULL, either parsed that way or reoptimized
+		 *  once it got hot.
+		**/
+		TIER_OPTIMIZED,
+		/**
+		 * Machine code from the JIT.
+		**/
+		TIER_NATIVE
+	};
+	
+	/**
+	 * A call in progress. Its registers are a window of the environment's
+	 *  value stack starting at base, with self in r0 and the arguments
+	 *  after it. The slot just below base receives the result.
+	**/
+	struct StackFrame {
+		Function* fun;
+		
+		/**
+		 * The instruction to resume at, only kept up to date while the
+		 *  frame is calling another.
+		**/
+		Operation* pc;
+		
+		size_t base;
+		uint size;
+		
+		/**
+		 * Entered from C++ rather than by OP_CALL, so returning from it
+		 *  leaves the interpreter loop.
+		**/
+		bool entry;
+	};
+	
+	/**
+	 * A stack and its frames, set aside, see Environment::suspended.
+	**/
+	struct Segment {
+		std::vector<Value> stack;
+		std::vector<StackFrame> frames;
+	};
+	
+	/**
+	 * Translate fn's opcodes to handler addresses for threaded dispatch.
+	 *  Every Function must be prepared once its code is final, before it
+	 *  runs.
+	**/
+	void prepare(Function* fn);
+	
+	/**
+	 * The attribute opcodes, shared by the interpreter and the JIT.
+	**/
+	Value getattr(InlineCache& ic, const Value& obj);
+	void setattr(InlineCache& ic, const Value& obj, Value v);
+	bool hasattr(InlineCache& ic, const Value& obj);
+	
+	/**
+	 * One function's counters, see profile.
+	**/
+	struct Heat {
+		Function* fn;
+		uint64_t calls, loops;
+		Tier tier;
+	};
+	
+	/**
+	 * The counters of fn and every function nested in it, hottest first
+	 *  by calls plus loops.
+	**/
+	std::vector<Heat> profile(Function* fn);
+	
+	/**
+	 * Share the program fn was parsed from between isolates, one
+	 *  Environment per thread, which all run the same code rather than
+	 *  compiling their own. Its functions are optimized and, if native
+	 *  and the JIT is available, compiled up front, then no longer tier
+	 *  up or count calls, and they and their constants become immortal,
+	 *  see Shared. Only quickening and inline caches write to them after.
+	 *
+	 * Call it once, before any other thread can see the program. fn keeps
+	 *  the caller's reference, which frees the program when released, so
+	 *  every isolate must be done with it and hold no values of its
+	 *  functions by then. Its constants are never freed, since values of
+	 *  them can outlive it.
+	**/
+	void freeze(Function* fn, bool native=true);
+}
 
+/**
+ * An isolate: everything one allocates and the values it holds belong
+ *  to the thread running it, and the only things environments on other
+ *  threads may share are frozen programs, see vm::freeze, and atoms.
+**/
 struct Environment {
-	std::stack<vm::StackFrame> stack;
+	/**
+	 * Calls nested deeper than this fail instead of growing the stack.
+	**/
+	static constexpr size_t DEFAULT_MAX_DEPTH = 100000;
+	
+	/**
+	 * Registers of every active frame, each one a window of it. Frames
+	 *  are allocated by bumping the top, so once the stack has grown to
+	 *  a program's deepest call, calls don't allocate. Growing moves the
+	 *  values, so pointers into it only last until the next call.
+	**/
+	std::vector<Value> stack;
+	
+	/**
+	 * Active frames, innermost last.
+	**/
+	std::vector<vm::StackFrame> frames;
+	
+	/**
+	 * The stacks of calls which made host calls, like an operator calling
+	 *  an overload, innermost last. The host call runs on a stack of its
+	 *  own, so the one below doesn't move under the registers its frames
+	 *  are still using.
+	 *
+	 * Only the first nesting are suspended. Those past them are the
+	 *  stacks of host calls which have returned, kept for the next ones
+	 *  so they don't allocate.
+	**/
+	std::vector<vm::Segment> suspended;
+	size_t nesting;
+	
+	/**
+	 * Frames of the suspended stacks, which count towards maxDepth.
+	**/
+	size_t suspendedDepth;
+	
+	size_t maxDepth;
+	
+	/**
+	 * Run functions as machine code when the JIT can compile them. Off,
+	 *  everything runs in the interpreter, which is mostly for checking
+	 *  one against the other. Functions compiled before it's turned off
+	 *  keep their code for when it's turned back on.
+	**/
+	bool jit;
+	
+	/**
+	 * When functions move up a tier, by their heat: calls plus loops.
+	 *  A function is checked each time it's entered, so cold code never
+	 *  pays for optimizing or compiling.
+	**/
+	struct TierPolicy {
+		/**
+		 * Heat at which bytecode parsed below OPT_FULL is reoptimized.
+		 *  Code can't change under a frame running it, so a function
+		 *  which is active further down the stack is tried again at
+		 *  twice its heat.
+		**/
+		uint64_t optimize;
+		
+		/**
+		 * Heat at which the JIT compiles a function, if jit is on.
+		**/
+		uint64_t compile;
+		
+		/**
+		 * The level exec parses source at.
+		**/
+		vm::OptLevel parse;
+	};
+	
+	static constexpr TierPolicy DEFAULT_TIERS = {
+		100, 1000, vm::OPT_NONE
+	};
+	
+	TierPolicy tiers;
+	
+	gc::Heap heap;
 	
 	Environment();
 	~Environment();
 	
-	Result call(Function* fn, Value self, std::vector<Value> args);
-	Result call(Function* fn, std::vector<Value> args);
+	/**
+	 * The environment an object belongs to, which its methods run in, or
+	 *  null if it isn't an object collected by one.
+	**/
+	static Environment* owner(const Value& v);
+	
+	/**
+	 * This thread's environment for calls made without one which don't
+	 *  have an owner either. It lives until the thread exits, so like any
+	 *  environment's objects, those it returns must be rooted to outlive
+	 *  its next collection.
+	**/
+	static Environment& local();
+	
+	/**
+	 * Allocate a collected object in this environment's heap.
+	**/
+	Object* newObject();
+	
+	/**
+	 * Allocate a copy of o which shares its storage, so later writes to
+	 *  either only copy what they change.
+	**/
+	Object* copyObject(Object* o);
+	
+	/**
+	 * Call visit on every register of the active frames.
+	**/
+	void traceRoots(const std::function<void(const Value&)>& visit);
+	
+	/**
+	 * One past the innermost frame's registers.
+	**/
+	size_t top() const;
+	
+	/**
+	 * Call fn with the n values at args, which the caller keeps owning.
+	 *  They're copied straight into the new frame, so they may be in
+	 *  any storage, including this environment's stack below top().
+	**/
+	Result call(Function* fn, const Value& self, Span<const Value> args);
+	
+	Result call(
+		Function* fn, const Value& self, const std::vector<Value>& args
+	);
+	Result call(Function* fn, const std::vector<Value>& args);
 	
 	Result exec(Function* fn);
 	Result exec(const std::string& code);
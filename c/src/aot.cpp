@@ -0,0 +1,372 @@
+/**
+ * @file aot.cpp
+ *
+ * Translates a parsed program to C++ one instruction at a time. Every
+ *  function becomes a C++ function over a native array of its registers,
+ *  rooted for the collector by a gc::Scope, and every instruction
+ *  becomes the statement the interpreter's handler for it amounts to.
+ *  Jumps and handlers become gotos, and failures jump to the handler
+ *  covering the instruction, known here rather than searched for.
+ *
+ * Calls recurse natively through Function::compiled. A tail call of the
+ *  running function loops back to its start, any other tail call is a
+ *  call followed by a return.
+**/
+
+#include <algorithm>
+#include <cstdio>
+#include <unordered_map>
+
+#include "aot.hpp"
+
+namespace esp {
+namespace aot {
+
+using namespace vm;
+
+Value bigint(bool neg, std::initializer_list<uint32_t> mag) {
+	BigInt v;
+	v.neg = neg;
+	v.mag.assign(mag);
+	return Value(std::move(v));
+}
+
+namespace {
+	/**
+	 * s as a C++ string literal. Escapes are octal, which unlike hex
+	 *  can't run on into the next character.
+	**/
+	std::string quote(const std::string& s) {
+		std::string q = "\"";
+		for(unsigned char c : s) {
+			if(c == '"' || c == '\\') {
+				q += '\\';
+				q += c;
+			}
+			else if(c >= ' ' && c < 0x7f && c != '?') {
+				q += c;
+			}
+			else {
+				char buf[8];
+				snprintf(buf, sizeof(buf), "\\%03o", c);
+				q += buf;
+			}
+		}
+		return q + "\"";
+	}
+	
+	std::string literal(Value v) {
+		if(!v.isShared()) {
+			char buf[48];
+			snprintf(buf, sizeof(buf), "Value::fromBits(0x%016llxull)",
+				(unsigned long long)v.bits);
+			return buf;
+		}
+		
+		if(v.isString()) {
+			std::string s = v.toString();
+			return "Value(std::string(" + quote(s) + ", " +
+				std::to_string(s.size()) + "))";
+		}
+		
+		if(v.tag() == Value::TAG_BIGINT) {
+			auto& b = v.asBoxedInt()->value;
+			std::string lit = "aot::bigint(";
+			lit += b.neg? "true, {" : "false, {";
+			for(size_t i = 0; i < b.mag.size(); ++i) {
+				lit += (i? ", " : "") + std::to_string(b.mag[i]) + "u";
+			}
+			return lit + "})";
+		}
+		
+		throw std::runtime_error("Can't translate constant " + v.toString());
+	}
+	
+	struct Translator {
+		/**
+		 * Every function of the program in the order they're found,
+		 *  the program itself first.
+		**/
+		std::vector<Function*> fns;
+		std::unordered_map<Function*, size_t> index;
+		
+		std::string out;
+		
+		void collect(Function* fn) {
+			if(index.count(fn)) {
+				return;
+			}
+			index[fn] = fns.size();
+			fns.push_back(fn);
+			for(auto f : fn->functions) {
+				collect(f);
+			}
+		}
+		
+		static std::string reg(int r) {
+			return "r[" + std::to_string(r) + "]";
+		}
+		static std::string label(size_t i) {
+			return "L" + std::to_string(i);
+		}
+		
+		/**
+		 * Where a failure of instruction i goes, the handler covering it
+		 *  or else out of the function.
+		**/
+		static std::string onFail(Function* fn, size_t i) {
+			for(size_t h = 0; h < fn->handlers.size(); ++h) {
+				auto& hd = fn->handlers[h];
+				if(i >= hd.begin && i < hd.end) {
+					return "H" + std::to_string(h);
+				}
+			}
+			return "fail";
+		}
+		
+		static const char* binary(Opcode op) {
+			switch(op) {
+				case OP_ADD: case OP_ADD_II: case OP_ADD_RR: case OP_ADD_SS:
+					return "add";
+				case OP_SUB: case OP_SUB_II: case OP_SUB_RR: return "sub";
+				case OP_MUL: case OP_MUL_II: case OP_MUL_RR: return "mul";
+				case OP_DIV: case OP_DIV_II: case OP_DIV_RR: return "div";
+				case OP_MOD: case OP_MOD_II: case OP_MOD_RR: return "mod";
+				
+				case OP_GT: case OP_GT_II: case OP_GT_RR: return "gt";
+				case OP_GTE: case OP_GTE_II: case OP_GTE_RR: return "gte";
+				case OP_LT: case OP_LT_II: case OP_LT_RR: return "lt";
+				case OP_LTE: case OP_LTE_II: case OP_LTE_RR: return "lte";
+				case OP_EQ: case OP_EQ_II: case OP_EQ_RR: return "eq";
+				case OP_NE: case OP_NE_II: case OP_NE_RR: return "ne";
+				
+				case OP_INC: case OP_INC_I: case OP_INC_R: return "inc";
+				case OP_DEC: case OP_DEC_I: case OP_DEC_R: return "dec";
+				
+				default: return nullptr;
+			}
+		}
+		
+		/**
+		 * The statement for instruction i of fn, the kth function.
+		**/
+		std::string statement(size_t k, Function* fn, size_t i) {
+			Operation op = fn->code[i];
+			std::string a = reg(op.a), b = reg(op.b), c = reg(op.c);
+			std::string bx = std::to_string(op.bx());
+			std::string fail = " goto " + onFail(fn, i) + ";";
+			
+			switch(op.op) {
+				case OP_NOP: return "";
+				case OP_NIL: return a + " = Value::nil;";
+				case OP_BOOL:
+					return a + " = Value::fromBool(" +
+						(op.b? "true" : "false") + ");";
+				case OP_IMM:
+					return a + " = Value::fromSmallInt(" +
+						std::to_string(op.sbx()) + ");";
+				case OP_MOVE: return a + " = " + b + ";";
+				case OP_CONST: return a + " = K[" + bx + "];";
+				case OP_OBJECT: return a + " = Value(env->newObject());";
+				case OP_FUNC:
+					return a + " = Value(F[" +
+						std::to_string(index[fn->functions[op.bx()]]) + "]);";
+				
+				case OP_JMP: return "goto " + label(i + 1 + op.sbx()) + ";";
+				case OP_IF:
+					return "if(!aot::truth(" + a + ")) goto " +
+						label(i + 1 + op.sbx()) + ";";
+				
+				case OP_CALL:
+					return "if(!aot::call(env, r + " + std::to_string(op.a) +
+						", " + std::to_string(op.b + 1) + ", err))" + fail;
+				case OP_TAILCALL: {
+					std::string s;
+					uint n = op.b + 1;
+					if(n <= fn->slots) {
+						s += "if(" + a + ".isFunction() && " + a +
+							".asFunction() == F[" + std::to_string(k) + "]) {\n" +
+							"\t\t\t++F[" + std::to_string(k) + "]->loops;\n";
+						for(uint j = 0; j < n; ++j) {
+							s += "\t\t\t" + reg(j) + " = std::move(" +
+								reg(op.a + 1 + j) + ");\n";
+						}
+						for(uint j = n; j < fn->slots; ++j) {
+							s += "\t\t\t" + reg(j) + " = Value::nil;\n";
+						}
+						s += "\t\t\tgoto L0;\n\t\t}\n\t\t";
+					}
+					return s + "if(!aot::call(env, r + " +
+						std::to_string(op.a) + ", " + std::to_string(n) +
+						", err))" + fail + "\n\t\treturn std::move(" + a + ");";
+				}
+				case OP_RETURN: return "return std::move(" + a + ");";
+				case OP_FAIL: return "err = " + a + ";" + fail;
+				
+				case OP_GETATTR:
+					return a + " = vm::getattr(C[" + bx + "], " + a + ");";
+				case OP_SETATTR:
+					return "vm::setattr(C[" + bx + "], " + a + ", " +
+						reg(op.a + 1) + ");";
+				case OP_HASATTR:
+					return a + " = Value(vm::hasattr(C[" + bx + "], " + a + "));";
+				case OP_DELATTR:
+					return a + " = Value(" + a + ".del(C[" + bx + "].key));";
+				
+				case OP_IDIV:
+					return "if(!aot::store(" + a + ", " + b + ".idiv(" + c +
+						"), err))" + fail;
+				case OP_IMOD:
+					return "if(!aot::store(" + a + ", " + b + ".imod(" + c +
+						"), err))" + fail;
+				
+				case OP_INC: case OP_INC_I: case OP_INC_R:
+				case OP_DEC: case OP_DEC_I: case OP_DEC_R:
+					return std::string("if(!aot::") + binary(op.op) + "(" +
+						a + ", " + b + ", err))" + fail;
+				
+				default:
+					if(auto name = binary(op.op)) {
+						return std::string("if(!aot::") + name + "(" +
+							a + ", " + b + ", " + c + ", err))" + fail;
+					}
+					throw std::runtime_error(
+						std::string("Can't translate ") + op_name(op.op)
+					);
+			}
+		}
+		
+		/**
+		 * Instructions which are jumped to, and so need a label.
+		**/
+		std::vector<bool> targets(Function* fn) {
+			std::vector<bool> t(fn->code.size());
+			for(size_t i = 0; i < fn->code.size(); ++i) {
+				auto op = fn->code[i];
+				if(op.op == OP_JMP || op.op == OP_IF) {
+					t[i + 1 + op.sbx()] = true;
+				}
+				else if(op.op == OP_TAILCALL && op.b + 1u <= fn->slots) {
+					t[0] = true;
+				}
+			}
+			for(auto& h : fn->handlers) {
+				t[h.target] = true;
+			}
+			return t;
+		}
+		
+		void function(size_t k) {
+			Function* fn = fns[k];
+			std::string name = "f" + std::to_string(k);
+			uint slots = std::max(fn->slots, 1u);
+			
+			out += "\n// " + (fn->name == ATOM_EMPTY?
+				std::string("<anonymous>") : atom_name(fn->name)) + "\n";
+			out += "static Result " + name +
+				"(Environment* env, Value* args, uint n) {\n";
+			
+			if(!fn->constants.empty()) {
+				out += "\tstatic const Value K[] = {\n";
+				for(auto& v : fn->constants) {
+					out += "\t\t" + literal(v) + ",\n";
+				}
+				out += "\t};\n";
+			}
+			if(!fn->caches.empty()) {
+				out += "\tstatic InlineCache C[] = {\n";
+				for(auto& ic : fn->caches) {
+					auto& key = atom_name(ic.key);
+					out += "\t\tInlineCache(intern(" + quote(key) + ", " +
+						std::to_string(key.size()) + ")),\n";
+				}
+				out += "\t};\n";
+			}
+			
+			out += "\tValue r[" + std::to_string(slots) + "], err;\n";
+			out += "\tgc::Scope scope(env->heap, r, " +
+				std::to_string(slots) + ");\n";
+			out += "\tfor(uint i = 0; i < n && i < " + std::to_string(slots) +
+				"; ++i) {\n\t\tr[i] = std::move(args[i]);\n\t}\n";
+			
+			auto t = targets(fn);
+			bool failed = false;
+			for(size_t i = 0; i < fn->code.size(); ++i) {
+				if(t[i]) {
+					out += label(i) + ":\n";
+				}
+				auto s = statement(k, fn, i);
+				failed = failed || s.find("goto fail;") != std::string::npos;
+				out += "\t// " + fn->code[i].disasm() + "\n";
+				if(!s.empty()) {
+					out += "\t" + s + "\n";
+				}
+			}
+			
+			for(size_t h = 0; h < fn->handlers.size(); ++h) {
+				auto& hd = fn->handlers[h];
+				out += "H" + std::to_string(h) + ":\n";
+				out += "\t" + reg(hd.reg) + " = std::move(err);\n";
+				out += "\tgoto " + label(hd.target) + ";\n";
+			}
+			if(failed) {
+				out += "fail:\n\treturn Result::failure(std::move(err));\n";
+			}
+			out += "}\n";
+		}
+		
+		std::string translate(Function* root) {
+			collect(root);
+			
+			out += "// Translated by espc\n";
+			out += "#include <iostream>\n\n#include \"aot.hpp\"\n\n";
+			out += "using namespace esp;\n\n";
+			out += "static Function* F[" + std::to_string(fns.size()) + "];\n";
+			
+			for(size_t k = 0; k < fns.size(); ++k) {
+				function(k);
+			}
+			
+			out += "\nint main() {\n";
+			out += "\tUnit* unit = new Unit();\n";
+			for(size_t k = 0; k < fns.size(); ++k) {
+				auto f = "F[" + std::to_string(k) + "]";
+				auto& name = atom_name(fns[k]->name);
+				out += "\t" + f + " = unit->arena.make<Function>(unit" +
+					(k? ", true" : "") + ");\n";
+				out += "\t" + f + "->name = intern(" + quote(name) + ", " +
+					std::to_string(name.size()) + ");\n";
+				out += "\t" + f + "->slots = " +
+					std::to_string(fns[k]->slots) + ";\n";
+				out += "\t" + f + "->compiled = f" + std::to_string(k) + ";\n";
+			}
+			out +=
+				"\tunit->release();\n"
+				"\t\n"
+				"\tint status = 0;\n"
+				"\t{\n"
+				"\t\tEnvironment env;\n"
+				"\t\tResult res = env.call(F[0], Value::nil, Span<const Value>());\n"
+				"\t\tif(res.isFailure()) {\n"
+				"\t\t\tstd::cerr << \"Failed: \" << res.toString() << std::endl;\n"
+				"\t\t\tstatus = 1;\n"
+				"\t\t}\n"
+				"\t\telse {\n"
+				"\t\t\tstd::cout << res.toString() << std::endl;\n"
+				"\t\t}\n"
+				"\t}\n"
+				"\t\n"
+				"\tF[0]->release();\n"
+				"\treturn status;\n"
+				"}\n";
+			return out;
+		}
+	};
+}
+
+std::string translate(Function* fn) {
+	return Translator().translate(fn);
+}
+
+}
+}
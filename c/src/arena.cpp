@@ -0,0 +1,51 @@
+#include <cstdlib>
+#include <algorithm>
+
+#include "arena.hpp"
+
+namespace esp {
+
+Arena::Arena()
+	:chunks(nullptr), cleanups(nullptr), cur(nullptr), end(nullptr),
+	next(MIN_CHUNK), total(0) {}
+
+Arena::~Arena() {
+	for(auto c = cleanups; c; c = c->next) {
+		c->fn(c->ptr, c->count);
+	}
+	
+	while(chunks) {
+		auto c = chunks;
+		chunks = c->next;
+		std::free(c);
+	}
+}
+
+void* Arena::alloc(size_t n, size_t align) {
+	auto p = (char*)(((uintptr_t)cur + align - 1) & ~(uintptr_t)(align - 1));
+	if(!cur || p + n > end) {
+		grow(n + align);
+		p = (char*)(((uintptr_t)cur + align - 1) & ~(uintptr_t)(align - 1));
+	}
+	
+	cur = p + n;
+	return p;
+}
+
+void Arena::grow(size_t min) {
+	size_t size = std::max(next, min + sizeof(Chunk));
+	auto c = (Chunk*)std::malloc(size);
+	if(!c) {
+		throw std::bad_alloc();
+	}
+	
+	c->next = chunks;
+	chunks = c;
+	cur = (char*)(c + 1);
+	end = (char*)c + size;
+	
+	total += size;
+	next = std::min(next*2, MAX_CHUNK);
+}
+
+}
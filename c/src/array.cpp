@@ -0,0 +1,261 @@
+/**
+ * @file array.cpp
+ *
+ * Element-wise operators follow the scalar ones exactly: the left
+ *  operand decides between int and real arithmetic, / is always real,
+ *  and ints only compare as ints with other ints. Anything the packed
+ *  kernels can't express, including int overflow, takes the generic
+ *  path through Value's operators.
+**/
+
+#include <vector>
+#include <algorithm>
+
+#include "value.hpp"
+
+namespace esp {
+
+Array* Array::alloc(Kind k, size_t n) {
+	size_t elem = k == INTS? sizeof(int64_t) :
+		k == REALS? sizeof(double) : sizeof(Value);
+	void* mem = ::operator new(sizeof(Array) + n*elem);
+	auto a = new(mem) Array(k, n);
+	
+	if(k == BOXED) {
+		auto v = a->values();
+		for(size_t i = 0; i < n; ++i) {
+			new(&v[i]) Value();
+		}
+	}
+	return a;
+}
+
+/**
+ * Store v in out if it's an int which fits in 64 bits.
+**/
+static bool int64_of(const Value& v, int64_t& out) {
+	if(v.isSmallInt()) {
+		out = v.asSmallInt();
+		return true;
+	}
+	return v.isInt() && v.asBoxedInt()->value.toInt64(out);
+}
+
+Array* Array::pack(const Value* v, size_t n) {
+	bool ints = n > 0, reals = n > 0;
+	int64_t i64;
+	for(size_t i = 0; i < n && (ints || reals); ++i) {
+		ints = ints && int64_of(v[i], i64);
+		reals = reals && v[i].isReal();
+	}
+	
+	Array* a;
+	if(ints) {
+		a = alloc(INTS, n);
+		for(size_t i = 0; i < n; ++i) {
+			int64_of(v[i], a->ints()[i]);
+		}
+	}
+	else if(reals) {
+		a = alloc(REALS, n);
+		for(size_t i = 0; i < n; ++i) {
+			a->reals()[i] = v[i].asReal();
+		}
+	}
+	else {
+		a = alloc(BOXED, n);
+		std::copy(v, v + n, a->values());
+	}
+	return a;
+}
+
+Value Array::at(size_t i) {
+	switch(kind) {
+		case INTS: return Value(ints()[i]);
+		case REALS: return Value(reals()[i]);
+		default: return values()[i];
+	}
+}
+
+void Array::destroy() {
+	if(kind == BOXED) {
+		auto v = values();
+		for(size_t i = 0; i < length; ++i) {
+			v[i].~Value();
+		}
+	}
+	this->~Array();
+	::operator delete(this);
+}
+
+void Object::barrierArray(Array* a) {
+	if(a->kind == Array::BOXED) {
+		for(size_t i = 0; i < a->length; ++i) {
+			writeBarrier(a->values()[i]);
+		}
+	}
+}
+
+namespace {
+	/**
+	 * One side of an element-wise operation, an array or a broadcast
+	 *  scalar.
+	**/
+	struct Operand {
+		enum Kind {
+			INT, REAL, OTHER
+		};
+		
+		Value& value;
+		Array* array;
+		Kind kind;
+		
+		/**
+		 * Storage for a packed scalar.
+		**/
+		int64_t i;
+		double r;
+		
+		Operand(Value& v):value(v), array(nullptr), kind(OTHER) {
+			if(v.isArray()) {
+				array = v.asArray();
+				if(array->kind == Array::INTS) {
+					kind = INT;
+				}
+				else if(array->kind == Array::REALS) {
+					kind = REAL;
+				}
+			}
+			else if(int64_of(v, i)) {
+				kind = INT;
+			}
+			else if(v.isReal()) {
+				r = v.asReal();
+				kind = REAL;
+			}
+		}
+		
+		inline bool isVector() const {
+			return array;
+		}
+		
+		inline Value at(size_t k) {
+			return array? array->at(k) : value;
+		}
+		
+		/**
+		 * The operand as packed reals, converting ints into tmp.
+		**/
+		const double* reals(std::vector<double>& tmp, size_t n) {
+			if(kind == REAL) {
+				return array? array->reals() : &r;
+			}
+			
+			const int64_t* src = array? array->ints() : &i;
+			tmp.resize(array? n : 1);
+			for(size_t k = 0; k < tmp.size(); ++k) {
+				tmp[k] = src[k];
+			}
+			return tmp.data();
+		}
+		
+		/**
+		 * The operand as packed ints, truncating reals into tmp like
+		 *  Value::toInt.
+		**/
+		const int64_t* ints(std::vector<int64_t>& tmp, size_t n) {
+			if(kind == INT) {
+				return array? array->ints() : &i;
+			}
+			
+			const double* src = array? array->reals() : &r;
+			tmp.resize(array? n : 1);
+			for(size_t k = 0; k < tmp.size(); ++k) {
+				tmp[k] = (int64_t)src[k];
+			}
+			return tmp.data();
+		}
+	};
+	
+	Result scalar_op(simd::Op op, Value& x, Value& y) {
+		switch(op) {
+			case simd::ADD: return x + y;
+			case simd::SUB: return x - y;
+			case simd::MUL: return x*y;
+			case simd::DIV: return x/y;
+			case simd::LT: return x < y;
+			case simd::LTE: return x <= y;
+			case simd::GT: return x > y;
+			case simd::GTE: return x >= y;
+			case simd::EQ: return x == y;
+			default: return x != y;
+		}
+	}
+	
+	Value bools(const std::vector<uint8_t>& mask) {
+		auto res = Array::alloc(Array::BOXED, mask.size());
+		for(size_t k = 0; k < mask.size(); ++k) {
+			res->values()[k] = Value((bool)mask[k]);
+		}
+		return Value::adopt(res);
+	}
+}
+
+Result Array::apply(simd::Op op, Value& l, Value& r) {
+	Operand a(l), b(r);
+	
+	size_t n = a.isVector() && b.isVector()?
+		std::min(a.array->length, b.array->length) :
+		a.isVector()? a.array->length : b.array->length;
+	
+	if(a.kind != Operand::OTHER && b.kind != Operand::OTHER) {
+		std::vector<double> ta, tb;
+		std::vector<int64_t> ia, ib;
+		bool va = a.isVector(), vb = b.isVector();
+		
+		if(op >= simd::LT) {
+			std::vector<uint8_t> mask(n);
+			if(a.kind == Operand::INT && b.kind == Operand::INT) {
+				simd::compareInts(
+					op, a.ints(ia, n), va, b.ints(ib, n), vb, mask.data(), n
+				);
+			}
+			else {
+				simd::compareReals(
+					op, a.reals(ta, n), va, b.reals(tb, n), vb,
+					mask.data(), n
+				);
+			}
+			return bools(mask);
+		}
+		
+		if(op == simd::DIV || a.kind == Operand::REAL) {
+			auto res = alloc(REALS, n);
+			simd::reals(
+				op, a.reals(ta, n), va, b.reals(tb, n), vb, res->reals(), n
+			);
+			return Value::adopt(res);
+		}
+		
+		auto res = alloc(INTS, n);
+		if(simd::ints(
+			op, a.ints(ia, n), va, b.ints(ib, n), vb, res->ints(), n
+		)) {
+			return Value::adopt(res);
+		}
+		res->destroy();
+	}
+	
+	std::vector<Value> out(n);
+	for(size_t k = 0; k < n; ++k) {
+		Value x = a.at(k), y = b.at(k);
+		auto res = scalar_op(op, x, y);
+		if(res.isFailure()) {
+			return res;
+		}
+		out[k] = std::move(res);
+	}
+	return Value::adopt(pack(out.data(), n));
+}
+
+} /* namespace esp */
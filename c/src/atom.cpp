@@ -0,0 +1,101 @@
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <string_view>
+
+#include "atom.hpp"
+#include "value.hpp"
+
+namespace esp {
+
+namespace {
+	/**
+	 * The global atom table. Names live in a deque, which never moves its
+	 *  elements, so the index can key on views of them.
+	 *
+	 * Every thread interns into the same table, so it's locked, and its
+	 *  values are immortal so any thread can copy them.
+	**/
+	struct AtomTable {
+		std::mutex lock;
+		std::deque<std::string> names;
+		std::vector<Value> values;
+		std::unordered_map<std::string_view, Atom> ids;
+		
+		AtomTable() {
+			static const char* const builtins[ATOM_BUILTIN_COUNT] = {
+				"",
+				"toBool", "toInt", "toReal", "toString", "()",
+				
+				"+", "-", "*", "/", "//", "%", "%%",
+				">", ">=", "<", "<=", "!=", "==",
+				"&", "|", "^", "<<", ">>",
+				"-@", "+@", "~@", "!@"
+			};
+			
+			for(auto name : builtins) {
+				add(name);
+			}
+		}
+		
+		Atom add(std::string_view s) {
+			Atom a = values.size();
+			names.emplace_back(s);
+			values.emplace_back(names.back());
+			values.back().makeImmortal();
+			ids.emplace(names.back(), a);
+			return a;
+		}
+		
+		Atom intern(std::string_view s) {
+			std::lock_guard<std::mutex> guard(lock);
+			auto it = ids.find(s);
+			if(it != ids.end()) {
+				return it->second;
+			}
+			return add(s);
+		}
+		
+		bool find(std::string_view s, Atom& a) {
+			std::lock_guard<std::mutex> guard(lock);
+			auto it = ids.find(s);
+			if(it == ids.end()) {
+				return false;
+			}
+			a = it->second;
+			return true;
+		}
+	};
+	
+	AtomTable& table() {
+		static AtomTable t;
+		return t;
+	}
+}
+
+Atom intern(const std::string& s) {
+	return table().intern(s);
+}
+
+Atom intern(const char* s, size_t len) {
+	return table().intern(std::string_view(s, len));
+}
+
+bool find_atom(const std::string& s, Atom& a) {
+	return table().find(s, a);
+}
+
+const std::string& atom_name(Atom a) {
+	auto& t = table();
+	std::lock_guard<std::mutex> guard(t.lock);
+	return t.names[a];
+}
+
+Value atom_value(Atom a) {
+	auto& t = table();
+	std::lock_guard<std::mutex> guard(t.lock);
+	return t.values[a];
+}
+
+}
@@ -0,0 +1,357 @@
+/**
+ * @file bigint.cpp
+ *
+ * Schoolbook kernels over 32 bit limbs. Operands in the VM are rarely
+ *  more than a few limbs wide, so none of the asymptotically faster
+ *  algorithms would pay for themselves.
+**/
+
+#include <algorithm>
+
+#include "bigint.hpp"
+
+namespace esp {
+
+typedef std::vector<uint32_t> Limbs;
+
+static int compare_mag(const Limbs& a, const Limbs& b) {
+	if(a.size() != b.size()) {
+		return a.size() < b.size()? -1 : 1;
+	}
+	for(size_t i = a.size(); i-- > 0;) {
+		if(a[i] != b[i]) {
+			return a[i] < b[i]? -1 : 1;
+		}
+	}
+	return 0;
+}
+
+static Limbs add_mag(const Limbs& a, const Limbs& b) {
+	const Limbs& big = a.size() < b.size()? b : a;
+	const Limbs& small = a.size() < b.size()? a : b;
+	
+	Limbs r(big.size() + 1);
+	uint64_t carry = 0;
+	for(size_t i = 0; i < big.size(); ++i) {
+		carry += (uint64_t)big[i] + (i < small.size()? small[i] : 0);
+		r[i] = (uint32_t)carry;
+		carry >>= 32;
+	}
+	r[big.size()] = (uint32_t)carry;
+	return r;
+}
+
+/**
+ * a - b where |a| >= |b|.
+**/
+static Limbs sub_mag(const Limbs& a, const Limbs& b) {
+	Limbs r(a.size());
+	int64_t borrow = 0;
+	for(size_t i = 0; i < a.size(); ++i) {
+		int64_t t = (int64_t)a[i] - borrow - (i < b.size()? b[i] : 0);
+		borrow = t < 0;
+		r[i] = (uint32_t)t;
+	}
+	return r;
+}
+
+/**
+ * Divide m in place by a single limb, returning the remainder.
+**/
+static uint32_t div_small(Limbs& m, uint32_t d) {
+	uint64_t r = 0;
+	for(size_t i = m.size(); i-- > 0;) {
+		uint64_t cur = (r << 32) | m[i];
+		m[i] = (uint32_t)(cur/d);
+		r = cur%d;
+	}
+	while(!m.empty() && !m.back()) {
+		m.pop_back();
+	}
+	return (uint32_t)r;
+}
+
+/**
+ * Knuth's algorithm D for |u| >= |v| where v has at least two limbs.
+**/
+static void div_mag(const Limbs& u, const Limbs& v, Limbs& q, Limbs& r) {
+	size_t n = v.size(), m = u.size();
+	int s = __builtin_clz(v[n - 1]);
+	
+	// Normalize so the divisor's top bit is set
+	Limbs vn(n), un(m + 1);
+	for(size_t i = n - 1; i > 0; --i) {
+		vn[i] = (v[i] << s) | (s? v[i - 1] >> (32 - s) : 0);
+	}
+	vn[0] = v[0] << s;
+	
+	un[m] = s? u[m - 1] >> (32 - s) : 0;
+	for(size_t i = m - 1; i > 0; --i) {
+		un[i] = (u[i] << s) | (s? u[i - 1] >> (32 - s) : 0);
+	}
+	un[0] = u[0] << s;
+	
+	q.assign(m - n + 1, 0);
+	
+	for(size_t j = m - n + 1; j-- > 0;) {
+		uint64_t num = ((uint64_t)un[j + n] << 32) | un[j + n - 1];
+		uint64_t qhat = num/vn[n - 1], rhat = num%vn[n - 1];
+		
+		while(qhat >> 32 ||
+			qhat*vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+			--qhat;
+			rhat += vn[n - 1];
+			if(rhat >> 32) {
+				break;
+			}
+		}
+		
+		// Multiply and subtract
+		int64_t borrow = 0, t;
+		uint64_t carry = 0;
+		for(size_t i = 0; i < n; ++i) {
+			uint64_t p = qhat*vn[i] + carry;
+			carry = p >> 32;
+			t = (int64_t)un[i + j] - borrow - (int64_t)(p & 0xffffffff);
+			un[i + j] = (uint32_t)t;
+			borrow = t < 0;
+		}
+		t = (int64_t)un[j + n] - borrow - (int64_t)carry;
+		un[j + n] = (uint32_t)t;
+		
+		q[j] = (uint32_t)qhat;
+		
+		// qhat was one too large, add the divisor back
+		if(t < 0) {
+			--q[j];
+			uint64_t c = 0;
+			for(size_t i = 0; i < n; ++i) {
+				c += (uint64_t)un[i + j] + vn[i];
+				un[i + j] = (uint32_t)c;
+				c >>= 32;
+			}
+			un[j + n] += (uint32_t)c;
+		}
+	}
+	
+	r.resize(n);
+	for(size_t i = 0; i < n - 1; ++i) {
+		r[i] = (un[i] >> s) | (s? un[i + 1] << (32 - s) : 0);
+	}
+	r[n - 1] = un[n - 1] >> s;
+}
+
+BigInt::BigInt(int64_t v):neg(v < 0) {
+	uint64_t m = neg? 0 - (uint64_t)v : (uint64_t)v;
+	mag.push_back((uint32_t)m);
+	mag.push_back((uint32_t)(m >> 32));
+	trim();
+}
+
+void BigInt::trim() {
+	while(!mag.empty() && !mag.back()) {
+		mag.pop_back();
+	}
+	if(mag.empty()) {
+		neg = false;
+	}
+}
+
+bool BigInt::toInt64(int64_t& out) const {
+	if(mag.size() > 2) {
+		return false;
+	}
+	
+	uint64_t m = wrap();
+	if(neg) {
+		m = 0 - m;
+		if(m > (uint64_t)1 << 63) {
+			return false;
+		}
+	}
+	else if(m >> 63) {
+		return false;
+	}
+	
+	out = wrap();
+	return true;
+}
+
+int64_t BigInt::wrap() const {
+	uint64_t m = 0;
+	if(mag.size() > 0) {
+		m = mag[0];
+	}
+	if(mag.size() > 1) {
+		m |= (uint64_t)mag[1] << 32;
+	}
+	return (int64_t)(neg? 0 - m : m);
+}
+
+double BigInt::toReal() const {
+	double r = 0;
+	for(size_t i = mag.size(); i-- > 0;) {
+		r = r*4294967296.0 + mag[i];
+	}
+	return neg? -r : r;
+}
+
+std::string BigInt::toString() const {
+	if(isZero()) {
+		return "0";
+	}
+	
+	// Peel off 9 decimal digits at a time
+	Limbs m = mag;
+	std::string out;
+	while(!m.empty()) {
+		uint32_t chunk = div_small(m, 1000000000);
+		for(int i = 0; i < 9 && (chunk || !m.empty()); ++i) {
+			out.push_back('0' + chunk%10);
+			chunk /= 10;
+		}
+	}
+	if(neg) {
+		out.push_back('-');
+	}
+	
+	std::reverse(out.begin(), out.end());
+	return out;
+}
+
+int BigInt::compare(const BigInt& a, const BigInt& b) {
+	if(a.neg != b.neg) {
+		return a.neg? -1 : 1;
+	}
+	int c = compare_mag(a.mag, b.mag);
+	return a.neg? -c : c;
+}
+
+void BigInt::divmod(const BigInt& a, const BigInt& b, BigInt* q, BigInt* r) {
+	BigInt qr, rr;
+	
+	if(compare_mag(a.mag, b.mag) < 0) {
+		rr = a;
+	}
+	else if(b.mag.size() == 1) {
+		qr.mag = a.mag;
+		uint32_t rem = div_small(qr.mag, b.mag[0]);
+		if(rem) {
+			rr.mag.push_back(rem);
+		}
+	}
+	else {
+		div_mag(a.mag, b.mag, qr.mag, rr.mag);
+	}
+	
+	qr.neg = a.neg != b.neg;
+	qr.trim();
+	rr.neg = a.neg;
+	rr.trim();
+	
+	if(q) {
+		*q = std::move(qr);
+	}
+	if(r) {
+		*r = std::move(rr);
+	}
+}
+
+BigInt BigInt::operator-() const {
+	BigInt r = *this;
+	r.neg = !neg;
+	r.trim();
+	return r;
+}
+
+BigInt BigInt::shl(uint64_t n) const {
+	if(isZero()) {
+		return *this;
+	}
+	
+	size_t limbs = n/32;
+	int bits = n%32;
+	
+	BigInt r;
+	r.neg = neg;
+	r.mag.assign(limbs + mag.size() + 1, 0);
+	for(size_t i = 0; i < mag.size(); ++i) {
+		uint64_t v = (uint64_t)mag[i] << bits;
+		r.mag[i + limbs] |= (uint32_t)v;
+		r.mag[i + limbs + 1] = (uint32_t)(v >> 32);
+	}
+	r.trim();
+	return r;
+}
+
+BigInt BigInt::shr(uint64_t n) const {
+	// floor(a/2^n) = -(((-a) - 1) >> n) - 1 for negative a
+	if(neg) {
+		BigInt one(1);
+		return -((-*this - one).shr(n)) - one;
+	}
+	
+	size_t limbs = n/32;
+	int bits = n%32;
+	
+	BigInt r;
+	if(limbs >= mag.size()) {
+		return r;
+	}
+	
+	r.mag.resize(mag.size() - limbs);
+	for(size_t i = 0; i < r.mag.size(); ++i) {
+		uint64_t v = mag[i + limbs];
+		if(i + limbs + 1 < mag.size()) {
+			v |= (uint64_t)mag[i + limbs + 1] << 32;
+		}
+		r.mag[i] = (uint32_t)(v >> bits);
+	}
+	r.trim();
+	return r;
+}
+
+BigInt operator+(const BigInt& a, const BigInt& b) {
+	BigInt r;
+	if(a.neg == b.neg) {
+		r.mag = add_mag(a.mag, b.mag);
+		r.neg = a.neg;
+	}
+	else if(compare_mag(a.mag, b.mag) >= 0) {
+		r.mag = sub_mag(a.mag, b.mag);
+		r.neg = a.neg;
+	}
+	else {
+		r.mag = sub_mag(b.mag, a.mag);
+		r.neg = b.neg;
+	}
+	r.trim();
+	return r;
+}
+
+BigInt operator-(const BigInt& a, const BigInt& b) {
+	return a + -b;
+}
+
+BigInt operator*(const BigInt& a, const BigInt& b) {
+	BigInt r;
+	if(a.isZero() || b.isZero()) {
+		return r;
+	}
+	
+	r.mag.assign(a.mag.size() + b.mag.size(), 0);
+	for(size_t i = 0; i < a.mag.size(); ++i) {
+		uint64_t carry = 0;
+		for(size_t j = 0; j < b.mag.size(); ++j) {
+			carry += (uint64_t)a.mag[i]*b.mag[j] + r.mag[i + j];
+			r.mag[i + j] = (uint32_t)carry;
+			carry >>= 32;
+		}
+		r.mag[i + b.mag.size()] = (uint32_t)carry;
+	}
+	r.neg = a.neg != b.neg;
+	r.trim();
+	return r;
+}
+
+} /* namespace esp */
@@ -0,0 +1,458 @@
+/**
+ * @file cache.cpp
+ *
+ * A cache is a header followed by flat sections, each an array of one
+ *  kind of record: the functions of the program, the code, handlers,
+ *  constants, caches and nested function indices of all of them one
+ *  after another, and the bytes of every name and literal. A function's
+ *  record holds the range of each section which is its own, so loading
+ *  one is a pass over the records with no parsing, and code and handlers
+ *  are already in the layout Function uses.
+ *
+ * Everything is in the byte order and instruction layout of the build
+ *  which wrote it, which the header records so another build finds the
+ *  cache stale rather than misreading it.
+**/
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.hpp"
+#include "vm.hpp"
+
+namespace esp {
+namespace cache {
+
+using namespace vm;
+
+namespace {
+	constexpr char MAGIC[4] = {'E', 'S', 'P', 'B'};
+	constexpr uint32_t ORDER = 0x01020304;
+	
+	/**
+	 * count elements starting at at, a byte offset for sections and an
+	 *  index for a function's ranges of them.
+	**/
+	struct Range {
+		uint32_t at, count;
+	};
+	
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint64_t source;
+		
+		/**
+		 * ORDER as written, and the sizes of the records used in place.
+		**/
+		uint32_t order;
+		uint16_t operation, handler;
+		
+		Range functions, code, handlers, constants, caches, refs, bytes;
+	};
+	
+	struct Record {
+		/**
+		 * In bytes.
+		**/
+		Range name;
+		uint32_t slots, rawSize, rawSlots, opt;
+		Range code, handlers, constants, caches, functions;
+	};
+	
+	/**
+	 * An immediate is its bits. Strings and big ints are their tag, with
+	 *  the sign of a big int in the low bit, and their bytes or limbs.
+	**/
+	struct Constant {
+		uint64_t bits;
+		Range data;
+	};
+	
+	/**
+	 * Owned by the unit's arena, which unmaps it when the unit is freed.
+	**/
+	struct Mapping {
+		void* ptr;
+		size_t length;
+		
+		Mapping(void* p, size_t n):ptr(p), length(n) {}
+		~Mapping() {
+			munmap(ptr, length);
+		}
+	};
+	
+	struct Writer {
+		std::vector<Function*> fns;
+		std::unordered_map<Function*, uint32_t> index;
+		
+		std::vector<Record> records;
+		std::vector<Operation> code;
+		std::vector<Handler> handlers;
+		std::vector<Constant> constants;
+		std::vector<Range> caches;
+		std::vector<uint32_t> refs;
+		std::string bytes;
+		
+		void collect(Function* fn) {
+			if(index.count(fn)) {
+				return;
+			}
+			index[fn] = fns.size();
+			fns.push_back(fn);
+			for(auto f : fn->functions) {
+				collect(f);
+			}
+		}
+		
+		Range str(std::string_view s) {
+			Range r{(uint32_t)bytes.size(), (uint32_t)s.size()};
+			bytes.append(s.data(), s.size());
+			return r;
+		}
+		
+		Constant constant(Value& v) {
+			// Its address would mean nothing once loaded
+			if(v.isObject()) {
+				throw std::runtime_error("Can't cache an object constant");
+			}
+			if(!v.isShared()) {
+				return {v.bits, {0, 0}};
+			}
+			if(v.isString()) {
+				return {Value::tagged(Value::TAG_STRING),
+					str(v.asString()->flat())};
+			}
+			if(v.tag() == Value::TAG_BIGINT) {
+				auto& b = v.asBoxedInt()->value;
+				Constant c{Value::tagged(Value::TAG_BIGINT) | b.neg,
+					{(uint32_t)bytes.size(), (uint32_t)b.mag.size()}};
+				bytes.append((const char*)b.mag.data(), b.mag.size()*4);
+				return c;
+			}
+			throw std::runtime_error("Can't cache constant " + v.toString());
+		}
+		
+		template<typename T>
+		static Range range(const std::vector<T>& v, size_t before) {
+			return {(uint32_t)before, (uint32_t)(v.size() - before)};
+		}
+		
+		void add(Function* fn) {
+			Record rec;
+			rec.name = str(atom_name(fn->name));
+			rec.slots = fn->slots;
+			rec.rawSize = fn->rawSize;
+			rec.rawSlots = fn->rawSlots;
+			rec.opt = fn->opt;
+			
+			size_t at = code.size();
+			code.insert(code.end(), fn->code.begin(), fn->code.end());
+			rec.code = range(code, at);
+			
+			at = handlers.size();
+			handlers.insert(
+				handlers.end(), fn->handlers.begin(), fn->handlers.end()
+			);
+			rec.handlers = range(handlers, at);
+			
+			at = constants.size();
+			for(auto& v : fn->constants) {
+				constants.push_back(constant(v));
+			}
+			rec.constants = range(constants, at);
+			
+			at = caches.size();
+			for(auto& ic : fn->caches) {
+				caches.push_back(str(atom_name(ic.key)));
+			}
+			rec.caches = range(caches, at);
+			
+			at = refs.size();
+			for(auto f : fn->functions) {
+				refs.push_back(index[f]);
+			}
+			rec.functions = range(refs, at);
+			
+			records.push_back(rec);
+		}
+		
+		/**
+		 * Append a section aligned for any record.
+		**/
+		template<typename T>
+		static Range section(std::string& out, const T* data, size_t n) {
+			out.resize((out.size() + 7) & ~(size_t)7);
+			Range r{(uint32_t)out.size(), (uint32_t)n};
+			out.append((const char*)data, n*sizeof(T));
+			return r;
+		}
+		
+		std::string write(Function* root, uint64_t source) {
+			collect(root);
+			for(auto fn : fns) {
+				add(fn);
+			}
+			
+			Header h;
+			memset(&h, 0, sizeof(h));
+			memcpy(h.magic, MAGIC, sizeof(MAGIC));
+			h.version = VERSION;
+			h.source = source;
+			h.order = ORDER;
+			h.operation = sizeof(Operation);
+			h.handler = sizeof(Handler);
+			
+			std::string out(sizeof(h), '\0');
+			h.functions = section(out, records.data(), records.size());
+			h.code = section(out, code.data(), code.size());
+			h.handlers = section(out, handlers.data(), handlers.size());
+			h.constants = section(out, constants.data(), constants.size());
+			h.caches = section(out, caches.data(), caches.size());
+			h.refs = section(out, refs.data(), refs.size());
+			h.bytes = section(out, bytes.data(), bytes.size());
+			memcpy(&out[0], &h, sizeof(h));
+			
+			if(out.size() > UINT32_MAX) {
+				throw std::runtime_error("Program too large to cache");
+			}
+			return out;
+		}
+	};
+	
+	[[noreturn]] void malformed() {
+		throw std::runtime_error("Malformed bytecode cache");
+	}
+	
+	struct Reader {
+		const char* base;
+		size_t size;
+		const Header* head;
+		
+		/**
+		 * A section's records, checked to lie in the file.
+		**/
+		template<typename T>
+		const T* section(Range r) {
+			if(r.at % alignof(T) || r.at > size ||
+				r.count > (size - r.at)/sizeof(T)) {
+				malformed();
+			}
+			return (const T*)(base + r.at);
+		}
+		
+		/**
+		 * Check a function's range of a section of n records.
+		**/
+		static void check(Range r, uint32_t n) {
+			if(r.at > n || r.count > n - r.at) {
+				malformed();
+			}
+		}
+		
+		std::string_view str(Range r) {
+			check(r, head->bytes.count);
+			return {base + head->bytes.at + r.at, r.count};
+		}
+		
+		Value constant(const Constant& c) {
+			if(c.bits == Value::tagged(Value::TAG_STRING)) {
+				return Value(std::string(str(c.data)));
+			}
+			if((c.bits & ~1ull) == Value::tagged(Value::TAG_BIGINT)) {
+				if(c.data.count > UINT32_MAX/4) {
+					malformed();
+				}
+				auto limbs = str({c.data.at, c.data.count*4});
+				BigInt b;
+				b.neg = c.bits & 1;
+				b.mag.resize(c.data.count);
+				memcpy(b.mag.data(), limbs.data(), limbs.size());
+				return Value(std::move(b));
+			}
+			
+			// Any other pointer would be to nothing, the tags from BIGINT
+			//  to OBJECT being all of them, see Value::isShared
+			if(c.bits - Value::tagged(Value::TAG_BIGINT) <
+				(5ull << Value::TAG_SHIFT)) {
+				malformed();
+			}
+			return Value::fromBits(c.bits);
+		}
+		
+		/**
+		 * The program's functions, the first owning a reference to the
+		 *  unit once it's made.
+		**/
+		std::vector<Function*> fns;
+		
+		void build(Unit* unit) {
+			auto records = section<Record>(head->functions);
+			auto code = section<Operation>(head->code);
+			auto handlers = section<Handler>(head->handlers);
+			auto constants = section<Constant>(head->constants);
+			auto caches = section<Range>(head->caches);
+			auto refs = section<uint32_t>(head->refs);
+			section<char>(head->bytes);
+			
+			auto& arena = unit->arena;
+			fns.resize(head->functions.count);
+			fns[0] = arena.make<Function>(unit);
+			for(uint32_t i = 1; i < head->functions.count; ++i) {
+				fns[i] = arena.make<Function>(unit, true);
+			}
+			
+			for(uint32_t i = 0; i < head->functions.count; ++i) {
+				auto& rec = records[i];
+				auto fn = fns[i];
+				
+				check(rec.code, head->code.count);
+				check(rec.handlers, head->handlers.count);
+				check(rec.constants, head->constants.count);
+				check(rec.caches, head->caches.count);
+				check(rec.functions, head->refs.count);
+				if(rec.code.count == 0 || rec.slots == 0 ||
+					rec.slots > UINT8_MAX + 1 || rec.opt > OPT_FULL) {
+					malformed();
+				}
+				
+				auto name = str(rec.name);
+				fn->name = intern(name.data(), name.size());
+				fn->slots = rec.slots;
+				fn->rawSize = rec.rawSize;
+				fn->rawSlots = rec.rawSlots;
+				fn->opt = (OptLevel)rec.opt;
+				fn->tier = fn->opt == OPT_FULL? TIER_OPTIMIZED : TIER_INTERPRETED;
+				
+				// Used in place, copied by the mapping a page at a time
+				//  as quickening writes to it
+				fn->code = {(Operation*)code + rec.code.at, rec.code.count};
+				for(auto& op : fn->code) {
+					if(op.op >= OPCODE_COUNT) {
+						malformed();
+					}
+				}
+				
+				fn->handlers = {
+					(Handler*)handlers + rec.handlers.at, rec.handlers.count
+				};
+				for(auto& h : fn->handlers) {
+					if(h.begin > h.end || h.end > rec.code.count ||
+						h.target >= rec.code.count || h.reg >= rec.slots) {
+						malformed();
+					}
+				}
+				
+				std::vector<Value> values;
+				values.reserve(rec.constants.count);
+				for(uint32_t k = 0; k < rec.constants.count; ++k) {
+					values.push_back(constant(constants[rec.constants.at + k]));
+				}
+				fn->constants = arena.copy(values.data(), values.size());
+				
+				std::vector<InlineCache> ics;
+				ics.reserve(rec.caches.count);
+				for(uint32_t k = 0; k < rec.caches.count; ++k) {
+					auto key = str(caches[rec.caches.at + k]);
+					ics.emplace_back(intern(key.data(), key.size()));
+				}
+				fn->caches = arena.copy(ics.data(), ics.size());
+				
+				std::vector<Function*> nested;
+				nested.reserve(rec.functions.count);
+				for(uint32_t k = 0; k < rec.functions.count; ++k) {
+					uint32_t f = refs[rec.functions.at + k];
+					if(f == 0 || f >= head->functions.count) {
+						malformed();
+					}
+					nested.push_back(fns[f]);
+				}
+				fn->functions = arena.copy(nested.data(), nested.size());
+				
+				prepare(fn);
+			}
+		}
+	};
+}
+
+uint64_t hash(std::string_view source) {
+	// FNV-1a
+	uint64_t h = 0xcbf29ce484222325ull;
+	for(unsigned char c : source) {
+		h = (h ^ c)*0x100000001b3ull;
+	}
+	return h;
+}
+
+std::string serialize(Function* fn, uint64_t source) {
+	return Writer().write(fn, source);
+}
+
+void write(const std::string& path, Function* fn, uint64_t source) {
+	std::string data = serialize(fn, source);
+	std::ofstream out(path, std::ios::binary);
+	if(!out.write(data.data(), data.size()) || !out.flush()) {
+		throw std::runtime_error("Can't write bytecode cache " + path);
+	}
+}
+
+Function* load(const std::string& path, uint64_t source) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0) {
+		return nullptr;
+	}
+	
+	struct stat st;
+	if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Header)) {
+		close(fd);
+		return nullptr;
+	}
+	
+	size_t size = st.st_size;
+	void* ptr = mmap(
+		nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0
+	);
+	close(fd);
+	if(ptr == MAP_FAILED) {
+		return nullptr;
+	}
+	
+	auto head = (const Header*)ptr;
+	if(memcmp(head->magic, MAGIC, sizeof(MAGIC)) ||
+		head->version != VERSION || head->order != ORDER ||
+		head->operation != sizeof(Operation) ||
+		head->handler != sizeof(Handler) ||
+		(source && head->source != source) || head->functions.count == 0) {
+		munmap(ptr, size);
+		return nullptr;
+	}
+	
+	Unit* unit = new Unit();
+	unit->arena.make<Mapping>(ptr, size);
+	
+	Reader reader{(const char*)ptr, size, head, {}};
+	try {
+		reader.build(unit);
+	}
+	catch(...) {
+		if(!reader.fns.empty() && reader.fns[0]) {
+			reader.fns[0]->release();
+		}
+		unit->release();
+		throw;
+	}
+	
+	unit->release();
+	return reader.fns[0];
+}
+
+}
+}
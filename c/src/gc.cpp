@@ -0,0 +1,505 @@
+#include <bitset>
+#include <cstdlib>
+#include <algorithm>
+
+#include "gc.hpp"
+#include "value.hpp"
+
+namespace esp {
+namespace gc {
+
+constexpr size_t BLOCK_BYTES = 1 << 15;
+
+/**
+ * A block of fixed-size object cells. Blocks are aligned to their size
+ *  so the block of a cell can be found by masking its address.
+**/
+struct Block {
+	uint live;
+	/**
+	 * Whether the current major sweep has reached this block.
+	**/
+	bool swept;
+	/**
+	 * Whether this block is spare or the allocation cursor's.
+	**/
+	bool reserved;
+	/**
+	 * Whether this block is in the heap's available list.
+	**/
+	bool listed;
+	
+	static constexpr size_t CELLS =
+		(BLOCK_BYTES - 64 - sizeof(std::bitset<256>))/sizeof(Object);
+	
+	std::bitset<CELLS> used;
+	
+	alignas(Object) unsigned char storage[CELLS][sizeof(Object)];
+	
+	inline Object* at(size_t i) {
+		return (Object*)storage[i];
+	}
+	
+	static inline Block* of(Object* o) {
+		return (Block*)((uintptr_t)o & ~(BLOCK_BYTES - 1));
+	}
+	
+	static Block* create() {
+		auto mem = std::aligned_alloc(BLOCK_BYTES, BLOCK_BYTES);
+		if(!mem) {
+			throw std::bad_alloc();
+		}
+		
+		auto b = new(mem) Block();
+		b->live = 0;
+		b->swept = true;
+		b->reserved = false;
+		b->listed = false;
+		return b;
+	}
+	
+	static void destroy(Block* b) {
+		for(size_t i = 0; i < CELLS; ++i) {
+			if(b->used[i]) {
+				b->at(i)->~Object();
+			}
+		}
+		b->~Block();
+		std::free(b);
+	}
+};
+
+static_assert(sizeof(Block) <= BLOCK_BYTES, "Block overflows its alignment");
+
+/**
+ * Call visit on v if it's an object, or on each object in it if it's an
+ *  array. Arrays are immutable, so they can't form cycles of their own.
+**/
+template<typename F>
+static void visit_value(const Value& v, F&& visit) {
+	if(v.isObject()) {
+		visit(v.asObject());
+	}
+	else if(v.isArray()) {
+		auto a = v.asArray();
+		if(a->kind == Array::BOXED) {
+			for(size_t i = 0; i < a->length; ++i) {
+				visit_value(a->values()[i], visit);
+			}
+		}
+	}
+}
+
+/**
+ * Call visit on each object referenced by o.
+**/
+template<typename F>
+static void scan(Object* o, F&& visit) {
+	if(auto s = o->slots) {
+		for(uint i = 0; i < s->size; ++i) {
+			visit_value(s->values()[i], visit);
+		}
+	}
+	o->dict.each([&visit](Atom, const Value& v) {
+		visit_value(v, visit);
+	});
+}
+
+Heap::Heap(Environment* e)
+	:env(e), phase(IDLE), current(nullptr), cursor(0), limit(0),
+	scopes(nullptr),
+	sweepIndex(0), oldCount(0), threshold(MIN_THRESHOLD) {}
+
+Heap::~Heap() {
+	for(auto b : blocks) {
+		Block::destroy(b);
+	}
+}
+
+Object* Heap::alloc() {
+	step();
+	
+	if(young.size() >= NURSERY_CELLS) {
+		minor();
+	}
+	
+	auto o = new(nextCell()) Object();
+	o->heap = this;
+	o->gen = YOUNG;
+	young.push_back(o);
+	
+	return o;
+}
+
+Object* Heap::nextCell() {
+	while(cursor == limit) {
+		if(!current || !nextRun()) {
+			nextBlock();
+		}
+	}
+	
+	current->used.set(cursor);
+	++current->live;
+	return current->at(cursor++);
+}
+
+/**
+ * Move the cursor to the next run of free cells in the current block,
+ *  returning false if there's none.
+**/
+bool Heap::nextRun() {
+	auto& used = current->used;
+	while(cursor < Block::CELLS && used[cursor]) {
+		++cursor;
+	}
+	if(cursor == Block::CELLS) {
+		return false;
+	}
+	
+	limit = cursor;
+	while(limit < Block::CELLS && !used[limit]) {
+		++limit;
+	}
+	return true;
+}
+
+/**
+ * Give up the current block for a spare one, then an available one,
+ *  then a new one.
+**/
+void Heap::nextBlock() {
+	// Cells behind the cursor may have been freed since it passed them
+	if(current) {
+		current->reserved = false;
+		offer(current);
+		recycle(current);
+	}
+	
+	current = nullptr;
+	if(!spare.empty()) {
+		current = spare.back();
+		spare.pop_back();
+	}
+	else if(!available.empty()) {
+		current = available.back();
+		available.pop_back();
+		current->listed = false;
+	}
+	else {
+		current = Block::create();
+		blocks.push_back(current);
+	}
+	
+	// An empty block is one run
+	current->reserved = true;
+	cursor = 0;
+	limit = current->live? 0 : Block::CELLS;
+}
+
+void Heap::free(Object* o) {
+	if(o->gen == OLD) {
+		--oldCount;
+		
+		// The last entry takes its place
+		if(o->remembered) {
+			auto last = remembered.back();
+			last->rememberedAt = o->rememberedAt;
+			remembered[o->rememberedAt] = last;
+			remembered.pop_back();
+		}
+	}
+	
+	auto b = Block::of(o);
+	o->~Object();
+	b->used.reset(o - b->at(0));
+	--b->live;
+	offer(b);
+}
+
+/**
+ * Make b available to allocate from if it's less than half full.
+**/
+void Heap::offer(Block* b) {
+	if(!b->reserved && !b->listed && b->live < Block::CELLS/2) {
+		b->listed = true;
+		available.push_back(b);
+	}
+}
+
+/**
+ * Return an empty block to the spare list or the system.
+**/
+void Heap::recycle(Block* b) {
+	if(b->live || b->reserved) {
+		return;
+	}
+	
+	if(b->listed) {
+		b->listed = false;
+		available.erase(std::find(available.begin(), available.end(), b));
+	}
+	
+	if(spare.size() < SPARE_BLOCKS) {
+		b->reserved = true;
+		spare.push_back(b);
+	}
+	else {
+		auto it = std::find(blocks.begin(), blocks.end(), b);
+		
+		// Keep the sweep cursor pointing at the same unswept block
+		if(phase == SWEEPING && (size_t)(it - blocks.begin()) < sweepIndex) {
+			--sweepIndex;
+		}
+		
+		blocks.erase(it);
+		Block::destroy(b);
+	}
+}
+
+void Heap::barrier(Object* target, Object* child) {
+	if(child->gen == YOUNG) {
+		if(!target->remembered) {
+			target->remembered = true;
+			target->rememberedAt = remembered.size();
+			remembered.push_back(target);
+		}
+	}
+	else if(
+		phase == MARKING && target->color == BLACK &&
+		child->gen == OLD && child->color == WHITE
+	) {
+		child->color = GRAY;
+		gray.push_back(child);
+	}
+}
+
+void Heap::traceRoots(const std::function<void(const Value&)>& visit) {
+	env->traceRoots(visit);
+	
+	for(auto h : roots) {
+		visit(*h->value);
+	}
+	for(auto s = scopes; s; s = s->prev) {
+		for(uint i = 0; i < s->n; ++i) {
+			visit(s->values[i]);
+		}
+	}
+}
+
+void Heap::minor() {
+	std::vector<Object*> work;
+	auto mark = [&work](Object* o) {
+		if(o->gen == YOUNG && !o->marked) {
+			o->marked = true;
+			work.push_back(o);
+		}
+	};
+	
+	traceRoots([&mark](const Value& v) {
+		visit_value(v, mark);
+	});
+	
+	for(auto o : remembered) {
+		o->remembered = false;
+		scan(o, mark);
+	}
+	remembered.clear();
+	
+	while(!work.empty()) {
+		auto o = work.back();
+		work.pop_back();
+		scan(o, mark);
+	}
+	
+	// Promote survivors in place. Survivors of a nursery collection in
+	//  the middle of marking still need scanning, and in the middle of
+	//  sweeping they mustn't look dead to the blocks left to sweep.
+	for(auto o : young) {
+		if(o->marked) {
+			o->marked = false;
+			o->gen = OLD;
+			++oldCount;
+			
+			if(phase == MARKING) {
+				o->color = GRAY;
+				gray.push_back(o);
+			}
+			else if(phase == SWEEPING && !Block::of(o)->swept) {
+				o->color = BLACK;
+			}
+			else {
+				o->color = WHITE;
+			}
+		}
+		else {
+			free(o);
+		}
+	}
+	young.clear();
+	
+	for(size_t i = blocks.size(); i-- > 0;) {
+		recycle(blocks[i]);
+	}
+	
+	++stats.minor;
+}
+
+void Heap::step() {
+	switch(phase) {
+		case IDLE:
+			if(oldCount >= threshold) {
+				startMark();
+			}
+			break;
+		
+		case MARKING:
+			markStep(MARK_STEP);
+			if(gray.empty()) {
+				finishMark();
+			}
+			break;
+		
+		case SWEEPING:
+			sweepStep(SWEEP_STEP);
+			break;
+	}
+}
+
+void Heap::shade(Object* o) {
+	if(o->gen == OLD && o->color == WHITE) {
+		o->color = GRAY;
+		gray.push_back(o);
+	}
+}
+
+void Heap::shade(const Value& v) {
+	visit_value(v, [this](Object* o) {
+		shade(o);
+	});
+}
+
+void Heap::startMark() {
+	phase = MARKING;
+	traceRoots([this](const Value& v) {
+		shade(v);
+	});
+}
+
+void Heap::markStep(uint n) {
+	auto visit = [this](Object* o) {
+		shade(o);
+	};
+	
+	while(n-- && !gray.empty()) {
+		auto o = gray.back();
+		gray.pop_back();
+		
+		o->color = BLACK;
+		scan(o, visit);
+	}
+}
+
+/**
+ * Stores into roots and young objects aren't barriered, so once the gray
+ *  set empties they're rescanned for old objects the slices haven't
+ *  seen. Marking is over if that finds none, otherwise it goes on in
+ *  slices, so the pause is bounded by the roots and the nursery rather
+ *  than the old generation. Every rescan which doesn't finish shades
+ *  an old object, which stays marked, so it does finish.
+**/
+void Heap::finishMark() {
+	traceRoots([this](const Value& v) {
+		shade(v);
+	});
+	
+	auto visit = [this](Object* o) {
+		shade(o);
+	};
+	for(auto o : young) {
+		scan(o, visit);
+	}
+	
+	if(!gray.empty()) {
+		return;
+	}
+	
+	for(auto b : blocks) {
+		b->swept = false;
+	}
+	
+	phase = SWEEPING;
+	sweepIndex = 0;
+}
+
+void Heap::sweepStep(uint n) {
+	while(n-- && sweepIndex < blocks.size()) {
+		auto b = blocks[sweepIndex++];
+		b->swept = true;
+		
+		for(size_t i = 0; i < Block::CELLS; ++i) {
+			if(!b->used[i]) {
+				continue;
+			}
+			
+			auto o = b->at(i);
+			if(o->gen != OLD) {
+				continue;
+			}
+			
+			if(o->color == WHITE) {
+				free(o);
+			}
+			else {
+				o->color = WHITE;
+			}
+		}
+		
+		recycle(b);
+	}
+	
+	if(sweepIndex >= blocks.size()) {
+		phase = IDLE;
+		threshold = std::max(MIN_THRESHOLD, oldCount*2);
+		++stats.major;
+	}
+}
+
+void Heap::collect() {
+	minor();
+	
+	if(phase == IDLE) {
+		startMark();
+	}
+	while(phase == MARKING) {
+		markStep(~0u);
+		finishMark();
+	}
+	while(phase == SWEEPING) {
+		sweepStep(~0u);
+	}
+}
+
+Heap::Stats Heap::getStats() {
+	stats.young = young.size();
+	stats.old = oldCount;
+	stats.blocks = blocks.size();
+	return stats;
+}
+
+Handle::Handle(Heap& h, Value* v):heap(h), value(v), at(h.roots.size()) {
+	heap.roots.push_back(this);
+}
+
+/**
+ * The last root takes its place.
+**/
+Handle::~Handle() {
+	auto& roots = heap.roots;
+	auto last = roots.back();
+	last->at = at;
+	roots[at] = last;
+	roots.pop_back();
+}
+
+} /* namespace gc */
+} /* namespace esp */
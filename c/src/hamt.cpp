@@ -0,0 +1,288 @@
+#include <vector>
+#include <utility>
+#include <cassert>
+
+#include "hamt.hpp"
+#include "value.hpp"
+
+namespace esp {
+
+namespace {
+	constexpr int BITS = 5;
+	constexpr uint32_t MASK = (1u << BITS) - 1;
+	
+	/**
+	 * Multiplying by an odd constant is a bijection, so distinct atoms
+	 *  never share a hash while sequential ones still spread across the
+	 *  root.
+	**/
+	inline uint32_t hash(Atom key) {
+		return key*0x9e3779b1u;
+	}
+	
+	inline uint32_t bitpos(uint32_t h, int shift) {
+		return 1u << ((h >> shift) & MASK);
+	}
+	
+	/**
+	 * Index of bit's entry within the compressed array of map.
+	**/
+	inline int index(uint32_t map, uint32_t bit) {
+		return __builtin_popcount(map & (bit - 1));
+	}
+}
+
+/**
+ * A trie node. Bits of datamap mark inline entries and bits of nodemap
+ *  mark subtries, each stored densely in bit order. A subtrie always
+ *  holds at least two entries, anything smaller is inlined into its
+ *  parent.
+**/
+struct HamtNode : public Shared {
+	uint32_t datamap = 0, nodemap = 0;
+	std::vector<std::pair<Atom, Value>> data;
+	std::vector<HamtNode*> nodes;
+	
+	HamtNode() = default;
+	
+	HamtNode(const HamtNode& n)
+		:Shared(), datamap(n.datamap), nodemap(n.nodemap),
+		data(n.data), nodes(n.nodes) {
+		for(auto c : nodes) {
+			c->incref();
+		}
+	}
+	
+	~HamtNode() {
+		for(auto c : nodes) {
+			c->release();
+		}
+	}
+	
+	inline void release() {
+		if(decref()) {
+			delete this;
+		}
+	}
+	
+	void each(const std::function<void(Atom, const Value&)>& visit) const {
+		for(auto& e : data) {
+			visit(e.first, e.second);
+		}
+		for(auto c : nodes) {
+			c->each(visit);
+		}
+	}
+};
+
+/**
+ * Make n exclusively ours, copying it if it's shared.
+**/
+static HamtNode* own(HamtNode*& n) {
+	if(n->refs > 1) {
+		auto c = new HamtNode(*n);
+		n->decref();
+		n = c;
+	}
+	return n;
+}
+
+/**
+ * Build the subtrie holding two entries whose hashes agree below shift.
+**/
+static HamtNode* join(
+	Atom k1, const Value& v1, uint32_t h1,
+	Atom k2, const Value& v2, uint32_t h2, int shift
+) {
+	// Distinct hashes always differ within the 32 bits
+	assert(shift < 32);
+	
+	auto n = new HamtNode();
+	uint32_t b1 = bitpos(h1, shift), b2 = bitpos(h2, shift);
+	
+	if(b1 == b2) {
+		n->nodemap = b1;
+		n->nodes.push_back(join(k1, v1, h1, k2, v2, h2, shift + BITS));
+	}
+	else {
+		n->datamap = b1 | b2;
+		if(b1 < b2) {
+			n->data.emplace_back(k1, v1);
+			n->data.emplace_back(k2, v2);
+		}
+		else {
+			n->data.emplace_back(k2, v2);
+			n->data.emplace_back(k1, v1);
+		}
+	}
+	
+	return n;
+}
+
+static bool insert(
+	HamtNode*& n, Atom key, uint32_t h, const Value& v, int shift
+) {
+	auto node = own(n);
+	uint32_t bit = bitpos(h, shift);
+	
+	if(node->datamap & bit) {
+		int i = index(node->datamap, bit);
+		auto& e = node->data[i];
+		if(e.first == key) {
+			e.second = v;
+			return false;
+		}
+		
+		auto sub = join(
+			e.first, e.second, hash(e.first), key, v, h, shift + BITS
+		);
+		node->data.erase(node->data.begin() + i);
+		node->datamap ^= bit;
+		node->nodemap |= bit;
+		node->nodes.insert(
+			node->nodes.begin() + index(node->nodemap, bit), sub
+		);
+		return true;
+	}
+	
+	if(node->nodemap & bit) {
+		return insert(
+			node->nodes[index(node->nodemap, bit)], key, h, v, shift + BITS
+		);
+	}
+	
+	node->datamap |= bit;
+	node->data.emplace(
+		node->data.begin() + index(node->datamap, bit), key, v
+	);
+	return true;
+}
+
+/**
+ * Remove key, which must be present.
+**/
+static void remove(HamtNode*& n, Atom key, uint32_t h, int shift) {
+	auto node = own(n);
+	uint32_t bit = bitpos(h, shift);
+	
+	if(node->datamap & bit) {
+		node->data.erase(node->data.begin() + index(node->datamap, bit));
+		node->datamap ^= bit;
+		return;
+	}
+	
+	int i = index(node->nodemap, bit);
+	auto& child = node->nodes[i];
+	remove(child, key, h, shift + BITS);
+	
+	// Keep the trie canonical by pulling a lone entry up
+	if(child->nodes.empty() && child->data.size() == 1) {
+		auto e = std::move(child->data[0]);
+		child->release();
+		
+		node->nodes.erase(node->nodes.begin() + i);
+		node->nodemap ^= bit;
+		node->datamap |= bit;
+		node->data.emplace(
+			node->data.begin() + index(node->datamap, bit), std::move(e)
+		);
+	}
+}
+
+Hamt::Hamt():root(nullptr), count(0) {}
+
+Hamt::Hamt(const Hamt& h):root(h.root), count(h.count) {
+	if(root) {
+		root->incref();
+	}
+}
+
+Hamt::Hamt(Hamt&& h):root(h.root), count(h.count) {
+	h.root = nullptr;
+	h.count = 0;
+}
+
+Hamt::~Hamt() {
+	clear();
+}
+
+Hamt& Hamt::operator=(const Hamt& h) {
+	if(h.root) {
+		h.root->incref();
+	}
+	clear();
+	root = h.root;
+	count = h.count;
+	return *this;
+}
+
+Hamt& Hamt::operator=(Hamt&& h) {
+	if(this != &h) {
+		clear();
+		std::swap(root, h.root);
+		std::swap(count, h.count);
+	}
+	return *this;
+}
+
+const Value* Hamt::find(Atom key) const {
+	uint32_t h = hash(key);
+	auto n = root;
+	
+	for(int shift = 0; n; shift += BITS) {
+		uint32_t bit = bitpos(h, shift);
+		if(n->datamap & bit) {
+			auto& e = n->data[index(n->datamap, bit)];
+			return e.first == key? &e.second : nullptr;
+		}
+		if(!(n->nodemap & bit)) {
+			break;
+		}
+		n = n->nodes[index(n->nodemap, bit)];
+	}
+	
+	return nullptr;
+}
+
+bool Hamt::set(Atom key, const Value& v) {
+	if(!root) {
+		root = new HamtNode();
+	}
+	
+	if(insert(root, key, hash(key), v, 0)) {
+		++count;
+		return true;
+	}
+	return false;
+}
+
+bool Hamt::del(Atom key) {
+	// Check first so a miss doesn't copy the path of a shared trie
+	if(!find(key)) {
+		return false;
+	}
+	
+	if(--count == 0) {
+		clear();
+	}
+	else {
+		remove(root, key, hash(key), 0);
+	}
+	return true;
+}
+
+void Hamt::clear() {
+	if(root) {
+		root->release();
+		root = nullptr;
+	}
+	count = 0;
+}
+
+void Hamt::each(const std::function<void(Atom, const Value&)>& visit) const {
+	if(root) {
+		root->each(visit);
+	}
+}
+
+} /* namespace esp */
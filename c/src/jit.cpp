@@ -0,0 +1,1064 @@
+/**
+ * @file jit.cpp
+ *
+ * A template compiler: every instruction becomes a fixed sequence of
+ *  machine code working on the same register window as the interpreter,
+ *  so either one can take over from the other at any instruction. Int
+ *  and real arithmetic runs inline behind guards on both operands' tags,
+ *  anything else calls a helper doing what the interpreter would, and
+ *  the helpers' calls are kept out of line after the function's code.
+ *
+ * Calls, returns and fail leave the machine code, returning the index of
+ *  the instruction for the interpreter to run. The interpreter enters
+ *  the callee's machine code itself, so script recursion still never
+ *  recurses natively.
+ *
+ * C++ exceptions can't unwind through the generated code, which has no
+ *  unwind tables, so helpers which might throw catch it and leave with
+ *  THREW for the interpreter to rethrow it once it's back.
+ *
+ * In the generated code rbx holds the registers, r12 the environment and
+ *  r13 where a failure goes. The prologue's three pushes leave the stack
+ *  aligned for calls.
+**/
+
+#include <deque>
+#include <cstring>
+#include <functional>
+#include <exception>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define ESP_JIT 1
+#endif
+
+#include "jit.hpp"
+#include "value.hpp"
+
+namespace esp {
+namespace jit {
+
+using namespace vm;
+
+Code::Code(uint8_t* m, size_t n, std::vector<uint32_t> o)
+	:mem(m), length(n), offsets(std::move(o)) {}
+
+#ifdef ESP_JIT
+
+Code::~Code() {
+	munmap(mem, length);
+}
+
+bool available() {
+	return true;
+}
+
+namespace {
+	enum Reg {
+		RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+		R8, R9, R10, R11, R12, R13, R14, R15
+	};
+	
+	/**
+	 * Condition codes of jcc and setcc.
+	**/
+	enum Cond {
+		CC_O = 0x0, CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5,
+		CC_A = 0x7, CC_NP = 0xb, CC_L = 0xc, CC_GE = 0xd, CC_LE = 0xe,
+		CC_G = 0xf
+	};
+	
+	/**
+	 * Opcodes of the two operand ALU instructions, op rm, reg.
+	**/
+	enum Alu : uint8_t {
+		ADD = 0x01, OR = 0x09, AND = 0x21, SUB = 0x29, CMP = 0x39, MOV = 0x89
+	};
+	
+	/**
+	 * The /digit of shifts and of ALU instructions with an immediate.
+	**/
+	enum Ext {
+		EXT_ADD = 0, EXT_SUB = 5, EXT_CMP = 7,
+		EXT_SHL = 4, EXT_SHR = 5, EXT_SAR = 7
+	};
+	
+	/**
+	 * SSE2 scalar double instructions, xmm0 to xmm7 only.
+	**/
+	enum Sse : uint8_t {
+		ADDSD = 0x58, MULSD = 0x59, SUBSD = 0x5c, DIVSD = 0x5e,
+		UCOMISD = 0x2e
+	};
+	
+	/**
+	 * A position in the code, which jumps can refer to before it's
+	 *  bound. Their displacements are patched in when it is.
+	**/
+	struct Label {
+		long pos = -1;
+		std::vector<size_t> fixups;
+	};
+	
+	/**
+	 * Encodes just the instructions the compiler needs. Every one is
+	 *  64 bit and memory operands are always [rbx + disp32].
+	**/
+	struct Assembler {
+		std::vector<uint8_t> buf;
+		
+		void byte(uint8_t b) {
+			buf.push_back(b);
+		}
+		void dword(uint32_t d) {
+			for(int i = 0; i < 4; ++i) {
+				byte(d >> 8*i);
+			}
+		}
+		void qword(uint64_t q) {
+			dword(q);
+			dword(q >> 32);
+		}
+		
+		void rex(int reg, int rm) {
+			byte(0x48 | (reg >> 3) << 2 | rm >> 3);
+		}
+		void modrm(int mod, int reg, int rm) {
+			byte(mod << 6 | (reg & 7) << 3 | (rm & 7));
+		}
+		
+		void load(Reg r, int32_t disp) {
+			rex(r, RBX);
+			byte(0x8b);
+			modrm(2, r, RBX);
+			dword(disp);
+		}
+		void store(int32_t disp, Reg r) {
+			rex(r, RBX);
+			byte(0x89);
+			modrm(2, r, RBX);
+			dword(disp);
+		}
+		void lea(Reg r, int32_t disp) {
+			rex(r, RBX);
+			byte(0x8d);
+			modrm(2, r, RBX);
+			dword(disp);
+		}
+		/**
+		 * mov r, [base], base not being rsp, rbp, r12 or r13.
+		**/
+		void loadFrom(Reg r, Reg base) {
+			rex(r, base);
+			byte(0x8b);
+			modrm(0, r, base);
+		}
+		/**
+		 * add qword [base], 1, with the same restriction on base.
+		**/
+		void incAt(Reg base) {
+			rex(0, base);
+			byte(0x83);
+			modrm(0, EXT_ADD, base);
+			byte(1);
+		}
+		
+		void movabs(Reg r, uint64_t v) {
+			byte(0x48 | r >> 3);
+			byte(0xb8 + (r & 7));
+			qword(v);
+		}
+		void mov32(Reg r, uint32_t v) {
+			if(r >= R8) {
+				byte(0x41);
+			}
+			byte(0xb8 + (r & 7));
+			dword(v);
+		}
+		
+		void alu(Alu op, Reg dst, Reg src) {
+			rex(src, dst);
+			byte(op);
+			modrm(3, src, dst);
+		}
+		void imm8(Ext ext, Reg r, int8_t v) {
+			rex(0, r);
+			byte(0x83);
+			modrm(3, ext, r);
+			byte(v);
+		}
+		void cmp32(Reg r, int32_t v) {
+			rex(0, r);
+			byte(0x81);
+			modrm(3, EXT_CMP, r);
+			dword(v);
+		}
+		void shift(Ext ext, Reg r, uint8_t n) {
+			rex(0, r);
+			byte(0xc1);
+			modrm(3, ext, r);
+			byte(n);
+		}
+		void imul(Reg dst, Reg src) {
+			rex(dst, src);
+			byte(0x0f);
+			byte(0xaf);
+			modrm(3, dst, src);
+		}
+		/**
+		 * Sign extend rax into rdx, then divide rdx:rax by r leaving
+		 *  the quotient in rax and the remainder in rdx.
+		**/
+		void cqo() {
+			byte(0x48);
+			byte(0x99);
+		}
+		void idiv(Reg r) {
+			rex(0, r);
+			byte(0xf7);
+			modrm(3, 7, r);
+		}
+		
+		/**
+		 * eax = cond? 1 : 0, leaving the flags alone.
+		**/
+		void setcc(Cond c) {
+			byte(0x0f);
+			byte(0x90 | c);
+			modrm(3, 0, RAX);
+			byte(0x0f);
+			byte(0xb6);
+			modrm(3, RAX, RAX);
+		}
+		void testEax() {
+			byte(0x85);
+			byte(0xc0);
+		}
+		void orEax(uint32_t v) {
+			byte(0x0d);
+			dword(v);
+		}
+		void cmpEax(uint32_t v) {
+			byte(0x3d);
+			dword(v);
+		}
+		
+		void sse(Sse op, int x, int y) {
+			byte(op == UCOMISD? 0x66 : 0xf2);
+			byte(0x0f);
+			byte(op);
+			modrm(3, x, y);
+		}
+		void movqToXmm(int x, Reg r) {
+			byte(0x66);
+			rex(x, r);
+			byte(0x0f);
+			byte(0x6e);
+			modrm(3, x, r);
+		}
+		void movqFromXmm(Reg r, int x) {
+			byte(0x66);
+			rex(x, r);
+			byte(0x0f);
+			byte(0x7e);
+			modrm(3, x, r);
+		}
+		void cvtsi2sd(int x, Reg r) {
+			byte(0xf2);
+			rex(x, r);
+			byte(0x0f);
+			byte(0x2a);
+			modrm(3, x, r);
+		}
+		
+		void call(const void* fn) {
+			movabs(RAX, (uint64_t)fn);
+			byte(0xff);
+			modrm(3, 2, RAX);
+		}
+		void jmp(Label& l) {
+			byte(0xe9);
+			ref(l);
+		}
+		void jcc(Cond c, Label& l) {
+			byte(0x0f);
+			byte(0x80 | c);
+			ref(l);
+		}
+		
+		void ref(Label& l) {
+			if(l.pos >= 0) {
+				dword(l.pos - (long)(buf.size() + 4));
+			}
+			else {
+				l.fixups.push_back(buf.size());
+				dword(0);
+			}
+		}
+		void bind(Label& l) {
+			l.pos = buf.size();
+			for(auto at : l.fixups) {
+				uint32_t d = l.pos - (long)(at + 4);
+				std::memcpy(&buf[at], &d, sizeof(d));
+			}
+			l.fixups.clear();
+		}
+	};
+	
+	/**
+	 * What the slow paths call, each doing what the interpreter does for
+	 *  the same instruction. Those which can throw return 0 if they
+	 *  didn't, or else the status to leave with.
+	**/
+	
+	thread_local std::exception_ptr pending;
+	
+	template<typename F>
+	uint32_t guard(F f) {
+		try {
+			return f();
+		}
+		catch(...) {
+			pending = std::current_exception();
+			return THREW;
+		}
+	}
+	
+	/**
+	 * Store immediate bits over a value which may need releasing.
+	**/
+	void assign(Value* dst, uint64_t bits) {
+		*dst = Value::fromBits(bits);
+	}
+	void copy(Value* dst, const Value* src) {
+		*dst = *src;
+	}
+	uint32_t object(Value* dst, Environment* env) {
+		return guard([=] {
+			*dst = Value(env->newObject());
+			return 0;
+		});
+	}
+	/**
+	 * A tail call of the running function with n arguments from reg[a]
+	 *  on, replacing its registers like OP_TAILCALL does.
+	**/
+	void retail(Value* reg, uint32_t a, uint32_t n, uint32_t slots) {
+		reg[-1] = reg[a];
+		for(uint32_t i = 0; i < n; ++i) {
+			reg[i] = std::move(reg[a + 1 + i]);
+		}
+		for(uint32_t i = n; i < slots; ++i) {
+			reg[i] = Value::nil;
+		}
+	}
+	uint32_t func(Value* dst, Function* fn) {
+		*dst = Value(fn);
+		return 0;
+	}
+	/**
+	 * 1 if v is truthy, 0 if not.
+	**/
+	uint32_t truth(Value* v) {
+		return guard([=] {
+			return (uint32_t)v->toBool();
+		});
+	}
+	
+	uint32_t getattr(Value* obj, InlineCache* ic) {
+		return guard([=] {
+			*obj = vm::getattr(*ic, *obj);
+			return 0;
+		});
+	}
+	uint32_t setattr(Value* obj, InlineCache* ic) {
+		return guard([=] {
+			vm::setattr(*ic, obj[0], obj[1]);
+			return 0;
+		});
+	}
+	uint32_t hasattr(Value* obj, InlineCache* ic) {
+		return guard([=] {
+			*obj = Value(vm::hasattr(*ic, *obj));
+			return 0;
+		});
+	}
+	uint32_t delattr(Value* obj, InlineCache* ic) {
+		return guard([=] {
+			*obj = Value(obj->del(ic->key));
+			return 0;
+		});
+	}
+	
+	/**
+	 * Operators through Value, any quickened form doing the same as its
+	 *  generic one, returning FAILED with the failure in err if it fails.
+	**/
+	uint32_t run_generic(Value* reg, uint32_t bits, Value* err) {
+		Operation op = Operation::fromBits(bits);
+		Value &l = reg[op.b], &r = reg[op.c];
+		
+		Result res;
+		switch(op.op) {
+			case OP_INC: case OP_INC_I: case OP_INC_R:
+				res = l + Value::fromSmallInt(1);
+				break;
+			case OP_DEC: case OP_DEC_I: case OP_DEC_R:
+				res = l - Value::fromSmallInt(1);
+				break;
+			
+			case OP_ADD: case OP_ADD_II: case OP_ADD_RR: case OP_ADD_SS:
+				res = l + r;
+				break;
+			case OP_SUB: case OP_SUB_II: case OP_SUB_RR: res = l - r; break;
+			case OP_MUL: case OP_MUL_II: case OP_MUL_RR: res = l*r; break;
+			case OP_DIV: case OP_DIV_II: case OP_DIV_RR: res = l/r; break;
+			case OP_MOD: case OP_MOD_II: case OP_MOD_RR: res = l%r; break;
+			case OP_IDIV: res = l.idiv(r); break;
+			case OP_IMOD: res = l.imod(r); break;
+			
+			case OP_GT: case OP_GT_II: case OP_GT_RR: res = l > r; break;
+			case OP_GTE: case OP_GTE_II: case OP_GTE_RR: res = l >= r; break;
+			case OP_LT: case OP_LT_II: case OP_LT_RR: res = l < r; break;
+			case OP_LTE: case OP_LTE_II: case OP_LTE_RR: res = l <= r; break;
+			case OP_EQ: case OP_EQ_II: case OP_EQ_RR: res = l == r; break;
+			default: res = l != r; break;
+		}
+		
+		if(res.isFailure()) {
+			*err = std::move(res);
+			return FAILED;
+		}
+		reg[op.a] = std::move(res);
+		return 0;
+	}
+	uint32_t generic(Value* reg, uint32_t bits, Value* err) {
+		return guard([=] {
+			return run_generic(reg, bits, err);
+		});
+	}
+	
+	/**
+	 * The operator of a binary or step opcode, generic or quickened.
+	**/
+	enum Kind {
+		K_ADD, K_SUB, K_MUL, K_DIV, K_MOD, K_GENERIC,
+		K_GT, K_GTE, K_LT, K_LTE, K_EQ, K_NE,
+		K_INC, K_DEC, K_NONE
+	};
+	
+	Kind kind_of(Opcode op) {
+		switch(op) {
+			case OP_ADD: case OP_ADD_II: case OP_ADD_RR: case OP_ADD_SS:
+				return K_ADD;
+			case OP_SUB: case OP_SUB_II: case OP_SUB_RR: return K_SUB;
+			case OP_MUL: case OP_MUL_II: case OP_MUL_RR: return K_MUL;
+			case OP_DIV: case OP_DIV_II: case OP_DIV_RR: return K_DIV;
+			case OP_MOD: case OP_MOD_II: case OP_MOD_RR: return K_MOD;
+			case OP_IDIV: case OP_IMOD: return K_GENERIC;
+			
+			case OP_GT: case OP_GT_II: case OP_GT_RR: return K_GT;
+			case OP_GTE: case OP_GTE_II: case OP_GTE_RR: return K_GTE;
+			case OP_LT: case OP_LT_II: case OP_LT_RR: return K_LT;
+			case OP_LTE: case OP_LTE_II: case OP_LTE_RR: return K_LTE;
+			case OP_EQ: case OP_EQ_II: case OP_EQ_RR: return K_EQ;
+			case OP_NE: case OP_NE_II: case OP_NE_RR: return K_NE;
+			
+			case OP_INC: case OP_INC_I: case OP_INC_R: return K_INC;
+			case OP_DEC: case OP_DEC_I: case OP_DEC_R: return K_DEC;
+			
+			default: return K_NONE;
+		}
+	}
+	
+	constexpr uint64_t INT_TAG = Value::tagged(Value::TAG_INT);
+	constexpr uint64_t SHARED_TAG = Value::tagged(Value::TAG_BIGINT);
+	constexpr int SHIFT = 64 - Value::TAG_SHIFT;
+	
+	struct Compiler {
+		Function* fn;
+		Assembler as;
+		
+		/**
+		 * Labels are referred to by address, so they need storage which
+		 *  doesn't move.
+		**/
+		std::deque<Label> labels;
+		Label* leave;
+		
+		/**
+		 * Slow paths, emitted after all the instructions.
+		**/
+		std::vector<std::function<void()>> cold;
+		
+		Compiler(Function* f):fn(f) {
+			labels.resize(f->code.size() + 1);
+			leave = &label();
+		}
+		
+		Label& label() {
+			labels.emplace_back();
+			return labels.back();
+		}
+		Label& at(size_t i) {
+			return labels[i];
+		}
+		
+		static int32_t slot(int r) {
+			return r*sizeof(Value);
+		}
+		
+		/**
+		 * Return i to the interpreter.
+		**/
+		void exitAt(size_t i) {
+			as.mov32(RAX, i);
+			as.jmp(*leave);
+		}
+		
+		/**
+		 * After a helper for instruction i, leave with the status it
+		 *  returned unless it's 0.
+		**/
+		void check(size_t i) {
+			Label& failed = label();
+			as.testEax();
+			as.jcc(CC_NE, failed);
+			cold.push_back([=, &failed] {
+				as.bind(failed);
+				as.orEax(i);
+				as.jmp(*leave);
+			});
+		}
+		
+		void ifNotInt(Reg r, Label& l) {
+			as.alu(MOV, RDX, r);
+			as.shift(EXT_SHR, RDX, Value::TAG_SHIFT);
+			as.cmp32(RDX, INT_TAG >> Value::TAG_SHIFT);
+			as.jcc(CC_NE, l);
+		}
+		void ifNotReal(Reg r, Label& l) {
+			as.movabs(RDX, Value::BOX);
+			as.alu(CMP, r, RDX);
+			as.jcc(CC_AE, l);
+		}
+		/**
+		 * Clobbers r.
+		**/
+		void ifShared(Reg r, Label& l) {
+			as.movabs(RDX, SHARED_TAG);
+			as.alu(SUB, r, RDX);
+			as.movabs(RDX, 4ull << Value::TAG_SHIFT);
+			as.alu(CMP, r, RDX);
+			as.jcc(CC_B, l);
+		}
+		
+		void unbox(Reg r) {
+			as.shift(EXT_SHL, r, SHIFT);
+			as.shift(EXT_SAR, r, SHIFT);
+		}
+		/**
+		 * Box the int in rax, or go to l if it doesn't fit.
+		**/
+		void boxInt(Label& l) {
+			as.alu(MOV, RDX, RAX);
+			unbox(RDX);
+			as.alu(CMP, RDX, RAX);
+			as.jcc(CC_NE, l);
+			as.shift(EXT_SHL, RAX, SHIFT);
+			as.shift(EXT_SHR, RAX, SHIFT);
+			as.movabs(RDX, INT_TAG);
+			as.alu(OR, RAX, RDX);
+		}
+		/**
+		 * Box the real in xmm0 into rax, canonicalizing NaN.
+		**/
+		void boxReal() {
+			Label& ok = label();
+			as.movqFromXmm(RAX, 0);
+			as.sse(UCOMISD, 0, 0);
+			as.jcc(CC_NP, ok);
+			as.movabs(RAX, Value::CANON_NAN);
+			as.bind(ok);
+		}
+		/**
+		 * rax = FALSE_BITS + eax, eax being 0 or 1.
+		**/
+		void boxBool() {
+			as.movabs(RDX, Value::FALSE_BITS);
+			as.alu(ADD, RAX, RDX);
+		}
+		
+		/**
+		 * reg[a] = rax, which holds an immediate. Only a shared value
+		 *  being overwritten needs a call to release it.
+		**/
+		void store(int a) {
+			Label &slow = label(), &done = label();
+			as.load(RCX, slot(a));
+			ifShared(RCX, slow);
+			as.store(slot(a), RAX);
+			as.bind(done);
+			
+			cold.push_back([=, &slow, &done] {
+				as.bind(slow);
+				as.lea(RDI, slot(a));
+				as.alu(MOV, RSI, RAX);
+				as.call((void*)assign);
+				as.jmp(done);
+			});
+		}
+		
+		/**
+		 * reg[a] = *src, src having been loaded into rsi. Copies which
+		 *  don't touch a reference count stay inline.
+		**/
+		void copyFrom(int a) {
+			Label &slow = label(), &done = label();
+			as.loadFrom(RAX, RSI);
+			as.alu(MOV, RCX, RAX);
+			ifShared(RCX, slow);
+			as.load(RCX, slot(a));
+			ifShared(RCX, slow);
+			as.store(slot(a), RAX);
+			as.bind(done);
+			
+			cold.push_back([=, &slow, &done] {
+				as.bind(slow);
+				as.lea(RDI, slot(a));
+				as.call((void*)copy);
+				as.jmp(done);
+			});
+		}
+		
+		/**
+		 * Loop back to the start if tail call i calls this function with
+		 *  no more arguments than it has registers, so the frame and its
+		 *  window stay the same, counting it like the interpreter does
+		 *  unless it's frozen. Anything else falls through.
+		**/
+		void selfTail(size_t i) {
+			Operation op = fn->code[i];
+			uint32_t n = op.b + 1;
+			if(n > fn->slots) {
+				return;
+			}
+			
+			Label& other = label();
+			as.load(RAX, slot(op.a));
+			as.movabs(RDX, Value::tagged(Value::TAG_FUNCTION) | (uint64_t)fn);
+			as.alu(CMP, RAX, RDX);
+			as.jcc(CC_NE, other);
+			if(!fn->frozen) {
+				as.movabs(RAX, (uint64_t)&fn->loops);
+				as.incAt(RAX);
+			}
+			as.alu(MOV, RDI, RBX);
+			as.mov32(RSI, op.a);
+			as.mov32(RDX, n);
+			as.mov32(RCX, fn->slots);
+			as.call((void*)retail);
+			as.jmp(at(0));
+			as.bind(other);
+		}
+		
+		/**
+		 * Call the helper for instruction i taking the value at reg[a]
+		 *  and something else.
+		**/
+		void helper(size_t i, const void* fn, int a, uint64_t arg) {
+			as.lea(RDI, slot(a));
+			as.movabs(RSI, arg);
+			as.call(fn);
+			check(i);
+		}
+		
+		/**
+		 * The generic path of instruction i, continuing at done unless
+		 *  it fails or throws.
+		**/
+		void slowPath(size_t i, Label& slow, Label& done) {
+			Operation op = fn->code[i];
+			cold.push_back([=, &slow, &done] {
+				as.bind(slow);
+				as.alu(MOV, RDI, RBX);
+				as.mov32(RSI, op.bits());
+				as.alu(MOV, RDX, R13);
+				as.call((void*)generic);
+				as.testEax();
+				as.jcc(CC_E, done);
+				as.orEax(i);
+				as.jmp(*leave);
+			});
+		}
+		
+		/**
+		 * xmm0 op= xmm1 for arithmetic, or eax = xmm0 op xmm1 for
+		 *  comparisons, which are false when either is NaN.
+		**/
+		void realOp(Kind k) {
+			switch(k) {
+				case K_ADD: as.sse(ADDSD, 0, 1); break;
+				case K_SUB: as.sse(SUBSD, 0, 1); break;
+				case K_MUL: as.sse(MULSD, 0, 1); break;
+				case K_DIV: as.sse(DIVSD, 0, 1); break;
+				case K_MOD: as.call((void*)(double(*)(double, double))std::fmod); break;
+				
+				// Unordered sets CF, so above and above-or-equal are false
+				case K_GT: as.sse(UCOMISD, 0, 1); as.setcc(CC_A); break;
+				case K_GTE: as.sse(UCOMISD, 0, 1); as.setcc(CC_AE); break;
+				case K_LT: as.sse(UCOMISD, 1, 0); as.setcc(CC_A); break;
+				case K_LTE: as.sse(UCOMISD, 1, 0); as.setcc(CC_AE); break;
+				
+				// But it also sets ZF, so equality checks PF
+				case K_EQ:
+				case K_NE: {
+					Label& ordered = label();
+					as.sse(UCOMISD, 0, 1);
+					as.setcc(k == K_EQ? CC_E : CC_NE);
+					as.jcc(CC_NP, ordered);
+					as.mov32(RAX, k == K_NE);
+					as.bind(ordered);
+					break;
+				}
+				
+				default: break;
+			}
+		}
+		
+		/**
+		 * Binary operators with both operands immediate ints or both
+		 *  reals inline, the left one's type deciding like Value's
+		 *  operators do, and anything else through generic().
+		**/
+		void binary(size_t i, Kind k) {
+			auto& op = fn->code[i];
+			Label &slow = label(), &reals = label(), &box = label(),
+				&done = label();
+			bool compare = k >= K_GT;
+			
+			as.load(RAX, slot(op.b));
+			as.load(RCX, slot(op.c));
+			if(k != K_GENERIC) {
+				ifNotInt(RAX, reals);
+				ifNotInt(RCX, slow);
+				
+				if(k == K_EQ || k == K_NE) {
+					as.alu(CMP, RAX, RCX);
+					as.setcc(k == K_EQ? CC_E : CC_NE);
+					boxBool();
+				}
+				else if(compare) {
+					as.shift(EXT_SHL, RAX, SHIFT);
+					as.shift(EXT_SHL, RCX, SHIFT);
+					as.alu(CMP, RAX, RCX);
+					as.setcc(
+						k == K_GT? CC_G : k == K_GTE? CC_GE :
+						k == K_LT? CC_L : CC_LE
+					);
+					boxBool();
+				}
+				else if(k == K_MOD) {
+					// Ints take an exact remainder, which fits the
+					//  immediate, and a zero divisor the generic path
+					unbox(RAX);
+					unbox(RCX);
+					as.cmp32(RCX, 0);
+					as.jcc(CC_E, slow);
+					as.cqo();
+					as.idiv(RCX);
+					as.alu(MOV, RAX, RDX);
+					boxInt(slow);
+				}
+				else if(k == K_DIV) {
+					// Ints divide as reals
+					unbox(RAX);
+					unbox(RCX);
+					as.cvtsi2sd(0, RAX);
+					as.cvtsi2sd(1, RCX);
+					realOp(k);
+					boxReal();
+				}
+				else {
+					unbox(RAX);
+					unbox(RCX);
+					if(k == K_MUL) {
+						as.imul(RAX, RCX);
+						as.jcc(CC_O, slow);
+					}
+					else {
+						as.alu(k == K_ADD? ADD : SUB, RAX, RCX);
+					}
+					boxInt(slow);
+				}
+				as.jmp(box);
+				
+				as.bind(reals);
+				ifNotReal(RAX, slow);
+				ifNotReal(RCX, slow);
+				as.movqToXmm(0, RAX);
+				as.movqToXmm(1, RCX);
+				realOp(k);
+				if(!compare) {
+					boxReal();
+				}
+				else {
+					boxBool();
+				}
+				
+				as.bind(box);
+				store(op.a);
+				as.jmp(done);
+			}
+			else {
+				as.jmp(slow);
+			}
+			
+			slowPath(i, slow, done);
+			as.bind(done);
+		}
+		
+		/**
+		 * a <- b plus or minus 1, which Value's operators see as an int
+		 *  on the right.
+		**/
+		void step(size_t i, Kind k) {
+			auto& op = fn->code[i];
+			Label &slow = label(), &reals = label(), &box = label(),
+				&done = label();
+			
+			as.load(RAX, slot(op.b));
+			ifNotInt(RAX, reals);
+			unbox(RAX);
+			as.imm8(k == K_INC? EXT_ADD : EXT_SUB, RAX, 1);
+			boxInt(slow);
+			as.jmp(box);
+			
+			as.bind(reals);
+			ifNotReal(RAX, slow);
+			as.movqToXmm(0, RAX);
+			as.movabs(RCX, Value::fromReal(1).bits);
+			as.movqToXmm(1, RCX);
+			as.sse(k == K_INC? ADDSD : SUBSD, 0, 1);
+			boxReal();
+			
+			as.bind(box);
+			store(op.a);
+			as.jmp(done);
+			
+			slowPath(i, slow, done);
+			as.bind(done);
+		}
+		
+		/**
+		 * Jump to the target when the condition is falsy.
+		**/
+		void branch(size_t i) {
+			auto& op = fn->code[i];
+			Label& target = at(i + 1 + op.sbx());
+			Label &slow = label(), &next = label();
+			
+			as.load(RAX, slot(op.a));
+			as.movabs(RCX, Value::TRUE_BITS);
+			as.alu(CMP, RAX, RCX);
+			as.jcc(CC_E, next);
+			as.movabs(RCX, Value::FALSE_BITS);
+			as.alu(CMP, RAX, RCX);
+			as.jcc(CC_E, target);
+			as.jmp(slow);
+			as.bind(next);
+			
+			cold.push_back([=, &slow, &next, &target] {
+				as.bind(slow);
+				as.lea(RDI, slot(op.a));
+				as.call((void*)truth);
+				as.cmpEax(1);
+				as.jcc(CC_E, next);
+				as.testEax();
+				as.jcc(CC_E, target);
+				as.orEax(i);
+				as.jmp(*leave);
+			});
+		}
+		
+		/**
+		 * Emit instruction i, false if it isn't compiled.
+		**/
+		bool emit(size_t i) {
+			auto& op = fn->code[i];
+			switch(op.op) {
+				case OP_NOP:
+					return true;
+				
+				case OP_NIL:
+					as.movabs(RAX, Value::NIL_BITS);
+					store(op.a);
+					return true;
+				case OP_BOOL:
+					as.movabs(RAX, Value::fromBool(op.b).bits);
+					store(op.a);
+					return true;
+				case OP_IMM:
+					as.movabs(RAX, Value::fromSmallInt(op.sbx()).bits);
+					store(op.a);
+					return true;
+				
+				case OP_MOVE:
+					as.lea(RSI, slot(op.b));
+					copyFrom(op.a);
+					return true;
+				case OP_CONST:
+					as.movabs(RSI, (uint64_t)&fn->constants[op.bx()]);
+					copyFrom(op.a);
+					return true;
+				
+				case OP_OBJECT:
+					as.lea(RDI, slot(op.a));
+					as.alu(MOV, RSI, R12);
+					as.call((void*)object);
+					check(i);
+					return true;
+				case OP_FUNC:
+					helper(i, (void*)func, op.a, (uint64_t)fn->functions[op.bx()]);
+					return true;
+				
+				case OP_JMP:
+					as.jmp(at(i + 1 + op.sbx()));
+					return true;
+				case OP_IF:
+					branch(i);
+					return true;
+				
+				case OP_TAILCALL:
+					selfTail(i);
+					exitAt(i);
+					return true;
+				case OP_CALL:
+				case OP_RETURN:
+				case OP_FAIL:
+					exitAt(i);
+					return true;
+				
+				case OP_GETATTR:
+					helper(i, (void*)getattr, op.a, (uint64_t)&fn->caches[op.bx()]);
+					return true;
+				case OP_SETATTR:
+					helper(i, (void*)setattr, op.a, (uint64_t)&fn->caches[op.bx()]);
+					return true;
+				case OP_HASATTR:
+					helper(i, (void*)hasattr, op.a, (uint64_t)&fn->caches[op.bx()]);
+					return true;
+				case OP_DELATTR:
+					helper(i, (void*)delattr, op.a, (uint64_t)&fn->caches[op.bx()]);
+					return true;
+				
+				default: {
+					Kind k = kind_of(op.op);
+					if(k == K_NONE) {
+						return false;
+					}
+					if(k == K_INC || k == K_DEC) {
+						step(i, k);
+					}
+					else {
+						binary(i, k);
+					}
+					return true;
+				}
+			}
+		}
+		
+		/**
+		 * The entry point saves the callee-saved registers it uses and
+		 *  jumps to the instruction to start at.
+		**/
+		bool compile() {
+			as.byte(0x53); // push rbx
+			as.byte(0x41); as.byte(0x54); // push r12
+			as.byte(0x41); as.byte(0x55); // push r13
+			as.alu(MOV, RBX, RDI);
+			as.alu(MOV, R12, RSI);
+			as.alu(MOV, R13, RDX);
+			as.byte(0xff); as.modrm(3, 4, RCX); // jmp rcx
+			
+			as.bind(*leave);
+			as.byte(0x41); as.byte(0x5d); // pop r13
+			as.byte(0x41); as.byte(0x5c); // pop r12
+			as.byte(0x5b); // pop rbx
+			as.byte(0xc3); // ret
+			
+			for(size_t i = 0; i < fn->code.size(); ++i) {
+				as.bind(at(i));
+				if(!emit(i)) {
+					return false;
+				}
+			}
+			
+			// Slow paths can add labels but not more slow paths
+			for(auto& c : cold) {
+				c();
+			}
+			return true;
+		}
+	};
+}
+
+Code* compile(Function* fn) {
+	Compiler c(fn);
+	if(fn->code.empty() || !c.compile()) {
+		return nullptr;
+	}
+	
+	std::vector<uint32_t> offsets(fn->code.size());
+	for(size_t i = 0; i < offsets.size(); ++i) {
+		offsets[i] = c.at(i).pos;
+	}
+	
+	// Written while only writable, then flipped to only executable
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t length = (c.as.buf.size() + page - 1)/page*page;
+	void* mem = mmap(
+		nullptr, length, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0
+	);
+	if(mem == MAP_FAILED) {
+		return nullptr;
+	}
+	std::memcpy(mem, c.as.buf.data(), c.as.buf.size());
+	if(mprotect(mem, length, PROT_READ | PROT_EXEC) != 0) {
+		munmap(mem, length);
+		return nullptr;
+	}
+	
+	return fn->unit->arena.make<Code>(
+		(uint8_t*)mem, length, std::move(offsets)
+	);
+}
+
+void rethrow() {
+	auto e = pending;
+	pending = nullptr;
+	std::rethrow_exception(e);
+}
+
+#else
+
+Code::~Code() {}
+
+void rethrow() {
+	std::terminate();
+}
+
+bool available() {
+	return false;
+}
+
+Code* compile(Function* fn) {
+	return nullptr;
+}
+
+#endif
+
+} /* namespace jit */
+} /* namespace esp */
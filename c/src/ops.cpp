@@ -11,10 +11,13 @@ const char* op_name(Opcode op) {
 		case OP_NIL: return "OP_NIL";
 		case OP_BOOL: return "OP_BOOL";
 		case OP_MOVE: return "OP_MOVE";
+		case OP_OBJECT: return "OP_OBJECT";
+		case OP_FUNC: return "OP_FUNC";
 		
 		case OP_JMP: return "OP_JMP";
 		case OP_IF: return "OP_IF";
 		case OP_CALL: return "OP_CALL";
+		case OP_TAILCALL: return "OP_TAILCALL";
 		case OP_RETURN: return "OP_RETURN";
 		case OP_FAIL: return "OP_FAIL";
 		case OP_GETATTR: return "OP_GETATTR";
@@ -51,18 +54,47 @@ const char* op_name(Opcode op) {
 		
 		case OP_SHL: return "OP_SHL";
 		case OP_SHR: return "OP_SHR";
+		
+		case OP_ADD_II: return "OP_ADD_II";
+		case OP_ADD_RR: return "OP_ADD_RR";
+		case OP_ADD_SS: return "OP_ADD_SS";
+		case OP_SUB_II: return "OP_SUB_II";
+		case OP_SUB_RR: return "OP_SUB_RR";
+		case OP_MUL_II: return "OP_MUL_II";
+		case OP_MUL_RR: return "OP_MUL_RR";
+		case OP_DIV_II: return "OP_DIV_II";
+		case OP_DIV_RR: return "OP_DIV_RR";
+		case OP_MOD_II: return "OP_MOD_II";
+		case OP_MOD_RR: return "OP_MOD_RR";
+		
+		case OP_GT_II: return "OP_GT_II";
+		case OP_GT_RR: return "OP_GT_RR";
+		case OP_GTE_II: return "OP_GTE_II";
+		case OP_GTE_RR: return "OP_GTE_RR";
+		case OP_LT_II: return "OP_LT_II";
+		case OP_LT_RR: return "OP_LT_RR";
+		case OP_LTE_II: return "OP_LTE_II";
+		case OP_LTE_RR: return "OP_LTE_RR";
+		case OP_EQ_II: return "OP_EQ_II";
+		case OP_EQ_RR: return "OP_EQ_RR";
+		case OP_NE_II: return "OP_NE_II";
+		case OP_NE_RR: return "OP_NE_RR";
+		
+		case OP_INC_I: return "OP_INC_I";
+		case OP_INC_R: return "OP_INC_R";
+		case OP_DEC_I: return "OP_DEC_I";
+		case OP_DEC_R: return "OP_DEC_R";
 	}
 }
 	
 Operation::Operation() {}
 Operation::Operation(Opcode oc, int x, int y, int z)
 	:op(oc), a(x), b(y), c(z) {}
+Operation::Operation(Opcode oc, int x, int bx)
+	:op(oc), a(x), b(bx & 0xff), c((bx >> 8) & 0xff) {}
 
 std::string regit(int x) {
-	if(x == -1) {
-		return "top";
-	}
-	return std::to_string(x);
+	return 'r' + std::to_string(x);
 }
 #define UNARY(mn) regit(a) + (" <- " mn " ") + regit(b)
 #define BINARY(mn) regit(a) + (" <- " mn " ") + regit(b) + ' ' + regit(c)
@@ -73,18 +105,138 @@ std::string Operation::disasm() {
 		case OP_NOP:
 			return "nop";
 		case OP_CONST:
-			return "const";
+			return regit(a) + " <- const #" + std::to_string(bx());
 		case OP_IMM:
-			return UNARY("imm");
+			return regit(a) + " <- imm " + std::to_string(sbx());
 		case OP_NIL:
 			return regit(a) + " <- nil";
 		case OP_BOOL:
 			return regit(a) + " <- " + (b? "true" : "false");
 		case OP_MOVE:
 			return UNARY("mov");
+		case OP_OBJECT:
+			return regit(a) + " <- object";
+		case OP_FUNC:
+			return regit(a) + " <- func #" + std::to_string(bx());
+		
+		case OP_GETATTR:
+			return regit(a) + " <- getattr " + regit(a) + " ic" + std::to_string(bx());
+		case OP_SETATTR:
+			return "setattr " + regit(a) + " ic" + std::to_string(bx()) + ' ' + regit(a + 1);
+		case OP_HASATTR:
+			return regit(a) + " <- hasattr " + regit(a) + " ic" + std::to_string(bx());
+		case OP_DELATTR:
+			return regit(a) + " <- delattr " + regit(a) + " ic" + std::to_string(bx());
+		
+		case OP_JMP:
+			return "jmp +" + std::to_string(sbx());
+		case OP_IF:
+			return "if " + regit(a) + " else jmp +" + std::to_string(sbx());
+		
+		case OP_CALL:
+		case OP_TAILCALL: {
+			// Self and the arguments follow the callee
+			std::string s = op == OP_CALL?
+				regit(a) + " <- call " : std::string("tailcall ");
+			s += regit(a) + '(';
+			for(int i = 0; i <= b; ++i) {
+				s += (i? ", " : "") + regit(a + 1 + i);
+			}
+			return s + ')';
+		}
+		case OP_RETURN:
+			return "return " + regit(a);
+		case OP_FAIL:
+			return "fail " + regit(a);
 		
 		case OP_ADD:
 			return BINARY("add");
+		case OP_SUB:
+			return BINARY("sub");
+		case OP_MUL:
+			return BINARY("mul");
+		case OP_DIV:
+			return BINARY("div");
+		case OP_IDIV:
+			return BINARY("idiv");
+		case OP_MOD:
+			return BINARY("mod");
+		case OP_IMOD:
+			return BINARY("imod");
+		
+		case OP_GT:
+			return BINARY("gt");
+		case OP_GTE:
+			return BINARY("gte");
+		case OP_LT:
+			return BINARY("lt");
+		case OP_LTE:
+			return BINARY("lte");
+		case OP_EQ:
+			return BINARY("eq");
+		case OP_NE:
+			return BINARY("ne");
+		
+		case OP_INC:
+			return UNARY("inc");
+		case OP_DEC:
+			return UNARY("dec");
+		
+		// Quickened
+		case OP_ADD_II:
+			return BINARY("add.ii");
+		case OP_ADD_RR:
+			return BINARY("add.rr");
+		case OP_ADD_SS:
+			return BINARY("add.ss");
+		case OP_SUB_II:
+			return BINARY("sub.ii");
+		case OP_SUB_RR:
+			return BINARY("sub.rr");
+		case OP_MUL_II:
+			return BINARY("mul.ii");
+		case OP_MUL_RR:
+			return BINARY("mul.rr");
+		case OP_DIV_II:
+			return BINARY("div.ii");
+		case OP_DIV_RR:
+			return BINARY("div.rr");
+		case OP_MOD_II:
+			return BINARY("mod.ii");
+		case OP_MOD_RR:
+			return BINARY("mod.rr");
+		case OP_GT_II:
+			return BINARY("gt.ii");
+		case OP_GT_RR:
+			return BINARY("gt.rr");
+		case OP_GTE_II:
+			return BINARY("gte.ii");
+		case OP_GTE_RR:
+			return BINARY("gte.rr");
+		case OP_LT_II:
+			return BINARY("lt.ii");
+		case OP_LT_RR:
+			return BINARY("lt.rr");
+		case OP_LTE_II:
+			return BINARY("lte.ii");
+		case OP_LTE_RR:
+			return BINARY("lte.rr");
+		case OP_EQ_II:
+			return BINARY("eq.ii");
+		case OP_EQ_RR:
+			return BINARY("eq.rr");
+		case OP_NE_II:
+			return BINARY("ne.ii");
+		case OP_NE_RR:
+			return BINARY("ne.rr");
+		case OP_INC_I:
+			return UNARY("inc.i");
+		case OP_INC_R:
+			return UNARY("inc.r");
+		case OP_DEC_I:
+			return UNARY("dec.i");
+		case OP_DEC_R:
+			return UNARY("dec.r");
 		
 		default:
 			return op_name(op);
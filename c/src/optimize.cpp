@@ -0,0 +1,689 @@
+/**
+ * @file optimize.cpp
+ *
+ * Every pass works on the flat instruction vector, marking instructions
+ *  dead rather than erasing them, and sweep() then removes them while
+ *  retargeting the jumps. Registers are few (at most 256), so liveness
+ *  uses one bitset per instruction.
+**/
+
+#include <bitset>
+#include <algorithm>
+
+#include "optimize.hpp"
+
+namespace esp {
+namespace vm {
+
+namespace {
+	typedef std::bitset<UINT8_MAX + 1> Regs;
+	typedef uint8_t Operation::* Field;
+	
+	/**
+	 * How an instruction uses registers. Reads through fields can be
+	 *  renamed by copy propagation, while fixed ones are read in place or
+	 *  by position, like SETATTR's value after its object.
+	**/
+	struct Use {
+		int write = -1;
+		
+		Field reads[2];
+		int nreads = 0;
+		
+		Regs fixed;
+		
+		/**
+		 * Registers from this one up are overwritten, like those a call
+		 *  hands to the callee.
+		**/
+		int clobbers = UINT8_MAX + 1;
+		
+		/**
+		 * Free of side effects, so it can go if its result is unused.
+		**/
+		bool pure = false;
+		
+		inline void read(Field f) {
+			reads[nreads++] = f;
+		}
+		inline void pin(int r) {
+			fixed.set(r);
+		}
+		
+		/**
+		 * Every register the instruction overwrites.
+		**/
+		inline Regs killed() const {
+			Regs k = clobbers > UINT8_MAX? Regs() : ~Regs() << clobbers;
+			if(write >= 0) {
+				k.set(write);
+			}
+			return k;
+		}
+	};
+	
+	/**
+	 * Describe op's register use, returning false for opcodes the passes
+	 *  don't understand.
+	**/
+	bool describe(const Operation& op, Use& u) {
+		switch(op.op) {
+			case OP_NOP:
+				u.pure = true;
+				return true;
+			
+			case OP_NIL:
+			case OP_BOOL:
+			case OP_IMM:
+			case OP_CONST:
+			case OP_OBJECT:
+			case OP_FUNC:
+				u.write = op.a;
+				u.pure = true;
+				return true;
+			
+			case OP_MOVE:
+				u.write = op.a;
+				u.read(&Operation::b);
+				u.pure = true;
+				return true;
+			
+			case OP_JMP:
+				return true;
+			
+			case OP_IF:
+			case OP_RETURN:
+			case OP_FAIL:
+				u.read(&Operation::a);
+				return true;
+			
+			case OP_GETATTR:
+			case OP_HASATTR:
+			case OP_DELATTR:
+				u.write = op.a;
+				u.pin(op.a);
+				return true;
+			
+			case OP_SETATTR:
+				u.pin(op.a);
+				u.pin(op.a + 1);
+				return true;
+			
+			case OP_NEG: case OP_POS: case OP_INV: case OP_NOT:
+			case OP_INC: case OP_DEC:
+			case OP_INC_I: case OP_INC_R: case OP_DEC_I: case OP_DEC_R:
+				u.write = op.a;
+				u.read(&Operation::b);
+				return true;
+			
+			// The callee, self and arguments are read by position and the
+			//  callee's registers start right after the callee
+			case OP_CALL:
+				u.write = op.a;
+				u.clobbers = op.a + 1;
+				// fallthrough
+			case OP_TAILCALL:
+				for(int r = op.a; r <= op.a + 1 + op.b; ++r) {
+					u.pin(r);
+				}
+				return true;
+			
+			case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV:
+			case OP_IDIV: case OP_MOD: case OP_IMOD:
+			case OP_AND: case OP_OR: case OP_BAND: case OP_BOR: case OP_BXOR:
+			case OP_GT: case OP_GTE: case OP_LT: case OP_LTE:
+			case OP_EQ: case OP_NE: case OP_SHL: case OP_SHR:
+			case OP_ADD_II: case OP_ADD_RR: case OP_ADD_SS:
+			case OP_SUB_II: case OP_SUB_RR: case OP_MUL_II: case OP_MUL_RR:
+			case OP_DIV_II: case OP_DIV_RR: case OP_MOD_II: case OP_MOD_RR:
+			case OP_GT_II: case OP_GT_RR: case OP_GTE_II: case OP_GTE_RR:
+			case OP_LT_II: case OP_LT_RR: case OP_LTE_II: case OP_LTE_RR:
+			case OP_EQ_II: case OP_EQ_RR: case OP_NE_II: case OP_NE_RR:
+				u.write = op.a;
+				u.read(&Operation::b);
+				u.read(&Operation::c);
+				return true;
+			
+			default:
+				return false;
+		}
+	}
+	
+	inline bool isJump(const Operation& op) {
+		return op.op == OP_JMP || op.op == OP_IF;
+	}
+	
+	inline bool isLoad(const Operation& op) {
+		switch(op.op) {
+			case OP_NIL:
+			case OP_BOOL:
+			case OP_IMM:
+			case OP_CONST:
+			case OP_FUNC:
+				return true;
+			
+			default:
+				return false;
+		}
+	}
+	
+	inline size_t target(const std::vector<Operation>& code, size_t i) {
+		return i + 1 + code[i].sbx();
+	}
+	
+	/**
+	 * Point the jump at i to t, returning false if it's out of range.
+	**/
+	bool retarget(std::vector<Operation>& code, size_t i, size_t t) {
+		long off = (long)t - (long)i - 1;
+		if(off < INT16_MIN || off > INT16_MAX) {
+			return false;
+		}
+		code[i] = Operation(code[i].op, code[i].a, (int)off);
+		return true;
+	}
+	
+	template<typename F>
+	void successors(const std::vector<Operation>& code, size_t i, F f) {
+		switch(code[i].op) {
+			case OP_JMP:
+				f(target(code, i));
+				break;
+			case OP_IF:
+				f(i + 1);
+				f(target(code, i));
+				break;
+			case OP_TAILCALL:
+			case OP_RETURN:
+			case OP_FAIL:
+				break;
+			
+			default:
+				f(i + 1);
+				break;
+		}
+	}
+	
+	struct Optimizer {
+		std::vector<Operation>& code;
+		std::vector<Handler>& handlers;
+		std::vector<Use> uses;
+		std::vector<bool> dead;
+		
+		/**
+		 * Registers live before and after each instruction.
+		**/
+		std::vector<Regs> in, out;
+		
+		/**
+		 * Registers the function uses, which bounds the passes' loops
+		 *  over them. Every one it uses is below slots.
+		**/
+		int nregs;
+		
+		Optimizer(std::vector<Operation>& c, std::vector<Handler>& h, uint slots):
+			code(c), handlers(h), nregs(std::min(slots, (uint)UINT8_MAX + 1)) {}
+		
+		/**
+		 * Call f with each handler which catches a failure at i, any
+		 *  instruction in a protected range being able to fail.
+		**/
+		template<typename F>
+		void raises(size_t i, F f) {
+			for(auto& h : handlers) {
+				if(h.begin <= i && i < h.end) {
+					f(h);
+				}
+			}
+		}
+		
+		/**
+		 * Describe every instruction, false if any is unknown.
+		**/
+		bool describeAll() {
+			uses.assign(code.size(), Use());
+			dead.assign(code.size(), false);
+			for(size_t i = 0; i < code.size(); ++i) {
+				if(!describe(code[i], uses[i])) {
+					return false;
+				}
+			}
+			return true;
+		}
+		
+		/**
+		 * Remove dead instructions and retarget the jumps around them.
+		 *  Jumps to a removed instruction go to the next one kept.
+		**/
+		bool sweep() {
+			if(std::find(dead.begin(), dead.end(), true) == dead.end()) {
+				return false;
+			}
+			
+			std::vector<size_t> index(code.size() + 1);
+			size_t n = 0;
+			for(size_t i = 0; i < code.size(); ++i) {
+				index[i] = n;
+				n += !dead[i];
+			}
+			index[code.size()] = n;
+			
+			std::vector<Operation> kept;
+			kept.reserve(n);
+			for(size_t i = 0; i < code.size(); ++i) {
+				if(dead[i]) {
+					continue;
+				}
+				
+				kept.push_back(code[i]);
+				if(isJump(code[i])) {
+					retarget(kept, kept.size() - 1, index[target(code, i)]);
+				}
+			}
+			
+			code.swap(kept);
+			
+			std::vector<Handler> live;
+			for(auto h : handlers) {
+				h.begin = index[h.begin];
+				h.end = index[h.end];
+				h.target = index[h.target];
+				if(h.begin < h.end) {
+					live.push_back(h);
+				}
+			}
+			handlers.swap(live);
+			
+			describeAll();
+			return true;
+		}
+		
+		/**
+		 * Jumps to jumps go straight to the final target, jumps to a
+		 *  return become the return and jumps to the next instruction
+		 *  become NOPs.
+		**/
+		bool threadJumps() {
+			bool changed = false;
+			for(size_t i = 0; i < code.size(); ++i) {
+				if(!isJump(code[i])) {
+					continue;
+				}
+				
+				size_t t = target(code, i);
+				for(size_t n = 0; n < code.size() && code[t].op == OP_JMP; ++n) {
+					t = target(code, t);
+				}
+				
+				if(code[i].op == OP_JMP && code[t].op == OP_RETURN) {
+					code[i] = code[t];
+					describe(code[i], uses[i] = Use());
+					changed = true;
+				}
+				else if(code[i].op == OP_JMP && t == i + 1) {
+					code[i] = Operation(OP_NOP, 0, 0, 0);
+					uses[i] = Use();
+					uses[i].pure = true;
+					changed = true;
+				}
+				else if(t != target(code, i)) {
+					changed = retarget(code, i, t) || changed;
+				}
+			}
+			return changed;
+		}
+		
+		/**
+		 * Mark NOPs and instructions no path from the entry reaches, like
+		 *  those after a RETURN or FAIL.
+		**/
+		void markUnreachable() {
+			std::vector<bool> seen(code.size(), false);
+			std::vector<size_t> work = {0};
+			while(!work.empty()) {
+				size_t i = work.back();
+				work.pop_back();
+				if(i >= code.size() || seen[i]) {
+					continue;
+				}
+				seen[i] = true;
+				successors(code, i, [&](size_t s) {
+					work.push_back(s);
+				});
+				raises(i, [&](const Handler& h) {
+					work.push_back(h.target);
+				});
+			}
+			
+			for(size_t i = 0; i < code.size(); ++i) {
+				if(!seen[i] || code[i].op == OP_NOP) {
+					dead[i] = true;
+				}
+			}
+		}
+		
+		/**
+		 * Instructions which start a basic block.
+		**/
+		std::vector<bool> leaders() {
+			std::vector<bool> lead(code.size() + 1, false);
+			lead[0] = true;
+			for(size_t i = 0; i < code.size(); ++i) {
+				if(isJump(code[i])) {
+					lead[target(code, i)] = true;
+					lead[i + 1] = true;
+				}
+			}
+			for(auto& h : handlers) {
+				lead[h.target] = true;
+			}
+			return lead;
+		}
+		
+		/**
+		 * One forward pass over each basic block tracking which registers
+		 *  hold a loaded literal or a copy of another register. Loads of
+		 *  what a register already holds are dropped, and with copies
+		 *  reads of a copy are renamed to the original.
+		**/
+		void forwardLocal(bool copies) {
+			auto lead = leaders();
+			int copy[UINT8_MAX + 1];
+			Operation held[UINT8_MAX + 1];
+			bool holds[UINT8_MAX + 1];
+			
+			for(size_t i = 0; i < code.size(); ++i) {
+				if(lead[i]) {
+					std::fill(copy, copy + nregs, -1);
+					std::fill(holds, holds + nregs, false);
+				}
+				if(dead[i]) {
+					continue;
+				}
+				
+				auto& op = code[i];
+				auto& u = uses[i];
+				
+				if(copies) {
+					for(int k = 0; k < u.nreads; ++k) {
+						int r = op.*u.reads[k];
+						if(copy[r] >= 0) {
+							op.*u.reads[k] = copy[r];
+						}
+					}
+				}
+				
+				if(isLoad(op) && holds[op.a] && held[op.a].op == op.op &&
+					held[op.a].b == op.b && held[op.a].c == op.c) {
+					dead[i] = true;
+					continue;
+				}
+				if(op.op == OP_MOVE &&
+					(op.a == op.b || copy[op.a] == op.b || copy[op.b] == op.a)) {
+					dead[i] = true;
+					continue;
+				}
+				
+				int w = u.write;
+				if(w < 0) {
+					continue;
+				}
+				
+				Regs killed = u.killed();
+				for(int r = 0; r < nregs; ++r) {
+					if(killed.test(r)) {
+						copy[r] = -1;
+						holds[r] = false;
+					}
+					else if(copy[r] >= 0 && killed.test(copy[r])) {
+						copy[r] = -1;
+					}
+				}
+				
+				if(isLoad(op)) {
+					holds[w] = true;
+					held[w] = op;
+				}
+				else if(op.op == OP_MOVE) {
+					if(copies) {
+						copy[w] = op.b;
+					}
+					if(holds[op.b]) {
+						holds[w] = true;
+						held[w] = held[op.b];
+						held[w].a = w;
+					}
+				}
+			}
+		}
+		
+		/**
+		 * Backward dataflow until the live sets stop changing. What a
+		 *  handler needs is live before an instruction it protects, which
+		 *  might fail before writing anything, and the register it puts
+		 *  the failure in isn't.
+		**/
+		void liveness() {
+			size_t n = code.size();
+			in.assign(n, Regs());
+			out.assign(n, Regs());
+			
+			for(bool changed = true; changed;) {
+				changed = false;
+				for(size_t i = n; i-- > 0;) {
+					Regs o, caught;
+					successors(code, i, [&](size_t s) {
+						if(s < n) {
+							o |= in[s];
+						}
+					});
+					raises(i, [&](const Handler& h) {
+						Regs t = in[h.target];
+						t.reset(h.reg);
+						caught |= t;
+					});
+					o |= caught;
+					
+					// Instructions marked dead are already gone
+					Regs x = o;
+					auto& u = uses[i];
+					if(!dead[i]) {
+						x = (o & ~u.killed()) | u.fixed | caught;
+						for(int k = 0; k < u.nreads; ++k) {
+							x.set(code[i].*u.reads[k]);
+						}
+					}
+					
+					if(x != in[i] || o != out[i]) {
+						in[i] = x;
+						out[i] = o;
+						changed = true;
+					}
+				}
+			}
+		}
+		
+		/**
+		 * Mark pure instructions whose result is never read.
+		**/
+		bool markDeadStores() {
+			liveness();
+			bool changed = false;
+			for(size_t i = 0; i < code.size(); ++i) {
+				auto& u = uses[i];
+				if(!dead[i] && u.pure && u.write >= 0 && !out[i].test(u.write)) {
+					dead[i] = true;
+					changed = true;
+				}
+			}
+			return changed;
+		}
+		
+		/**
+		 * Greedy coloring of the interference graph. Registers live on
+		 *  entry hold self and the arguments and those read in place by
+		 *  position keep their numbers, the rest take the lowest color no
+		 *  neighbor has, preferring that of a register they're moved
+		 *  from or to so the move disappears. Anything live across a call
+		 *  interferes with the registers the callee takes over, and
+		 *  handlers receive failures in fixed registers.
+		**/
+		void coalesce(uint& slots) {
+			liveness();
+			size_t n = code.size();
+			const int R = nregs;
+			
+			std::vector<Regs> interferes(R);
+			Regs used, pinned = n? in[0] : Regs();
+			std::vector<std::vector<int>> moves(R);
+			for(auto& h : handlers) {
+				used.set(h.reg);
+				pinned.set(h.reg);
+			}
+			
+			for(size_t i = 0; i < n; ++i) {
+				auto& u = uses[i];
+				auto& op = code[i];
+				
+				for(int k = 0; k < u.nreads; ++k) {
+					used.set(op.*u.reads[k]);
+				}
+				used |= u.fixed;
+				pinned |= u.fixed;
+				if(u.write < 0) {
+					continue;
+				}
+				
+				if(u.clobbers <= UINT8_MAX) {
+					Regs clobbered = u.killed();
+					clobbered.reset(u.write);
+					pinned |= clobbered;
+					for(int r = 0; r < R; ++r) {
+						if(out[i].test(r)) {
+							interferes[r] |= clobbered;
+						}
+					}
+					for(int c = u.clobbers; c < R; ++c) {
+						interferes[c] |= out[i];
+					}
+				}
+				
+				// A move's source can share its destination's register
+				Regs live = out[i];
+				live.reset(u.write);
+				if(op.op == OP_MOVE) {
+					live.reset(op.b);
+				}
+				
+				used.set(u.write);
+				interferes[u.write] |= live;
+				for(int r = 0; r < R; ++r) {
+					if(live.test(r)) {
+						interferes[r].set(u.write);
+					}
+				}
+				
+				if(op.op == OP_MOVE) {
+					moves[op.a].push_back(op.b);
+					moves[op.b].push_back(op.a);
+				}
+			}
+			
+			std::vector<std::vector<int>> neighbors(R);
+			for(int r = 0; r < R; ++r) {
+				for(int x = 0; x < R; ++x) {
+					if(interferes[r].test(x)) {
+						neighbors[r].push_back(x);
+					}
+				}
+			}
+			
+			std::vector<int> color(R, -1);
+			for(int r = 0; r < R; ++r) {
+				if(pinned.test(r)) {
+					color[r] = r;
+				}
+			}
+			
+			for(int r = 0; r < R; ++r) {
+				if(!used.test(r) || color[r] >= 0) {
+					continue;
+				}
+				
+				Regs taken;
+				for(int x : neighbors[r]) {
+					if(color[x] >= 0) {
+						taken.set(color[x]);
+					}
+				}
+				
+				for(int m : moves[r]) {
+					if(color[m] >= 0 && !taken.test(color[m])) {
+						color[r] = color[m];
+						break;
+					}
+				}
+				for(int c = 0; color[r] < 0; ++c) {
+					if(!taken.test(c)) {
+						color[r] = c;
+					}
+				}
+			}
+			
+			uint top = 0;
+			for(int r = 0; r < R; ++r) {
+				if(used.test(r)) {
+					top = std::max(top, (uint)color[r] + 1);
+				}
+			}
+			
+			for(size_t i = 0; i < n; ++i) {
+				auto& u = uses[i];
+				auto& op = code[i];
+				for(int k = 0; k < u.nreads; ++k) {
+					op.*u.reads[k] = color[op.*u.reads[k]];
+				}
+				if(u.write >= 0) {
+					op.a = color[op.a];
+				}
+				if(op.op == OP_MOVE && op.a == op.b) {
+					dead[i] = true;
+				}
+			}
+			
+			slots = std::min(slots, top);
+		}
+	};
+}
+
+void optimize(
+	std::vector<Operation>& code, std::vector<Handler>& handlers,
+	uint& slots, OptLevel level
+) {
+	Optimizer opt(code, handlers, slots);
+	if(level == OPT_NONE || code.empty() || !opt.describeAll()) {
+		return;
+	}
+	
+	bool full = level >= OPT_FULL;
+	for(int pass = 0; pass < 8; ++pass) {
+		bool changed = opt.threadJumps();
+		opt.markUnreachable();
+		opt.forwardLocal(full);
+		if(full) {
+			opt.markDeadStores();
+		}
+		
+		if(!opt.sweep() && !changed) {
+			break;
+		}
+	}
+	
+	if(full) {
+		opt.coalesce(slots);
+		opt.sweep();
+	}
+}
+
+}
+}
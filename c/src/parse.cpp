@@ -1,44 +1,554 @@
+#include <algorithm>
+#include <unordered_map>
+
 #include "parse.hpp"
 #include "token.hpp"
 #include "ops.hpp"
+#include "atom.hpp"
 
 namespace esp {
 namespace vm {
 
 /**
- * Structure of all the data used to build a function.
+ * Structure of all the data used to build a function. Everything is
+ *  accumulated here and copied into the unit's arena at exactly its
+ *  final size by finish().
+ *
+ * Code is three-address, each instruction naming its destination and
+ *  source registers. Temporaries are allocated like a stack: an
+ *  expression's result lands in the first register it allocates and
+ *  everything above that is free again once it's done, so slots only
+ *  needs to track the high water mark.
+ *
+ * Operands are 8 bits, or 16 for constant and cache indices, so a
+ *  function is limited to 256 registers and 65536 of each.
+ *
+ * Names are bound to a register, like parameters, or to a function
+ *  declared by let. There are no closures, so functions nested in this
+ *  one can load the functions it declares but not its registers.
+ *
+ * Handlers are added once the code they protect is complete, so nested
+ *  ones come before those around them, the order unwinding searches.
 **/
 struct FunctionBuilder {
+	/**
+	 * The compile-time contents of a register and the index of the
+	 *  instruction which loaded it. Valid until the register is written
+	 *  again or control flow merges.
+	**/
+	struct Known {
+		bool valid = false;
+		Value value;
+		size_t at;
+	};
+	
+	struct Local {
+		Atom name;
+		int reg;
+		Function* fn;
+	};
+	
 	FunctionBuilder* outer;
+	Unit* unit;
+	OptLevel opt;
+	
+	/**
+	 * Allocated up front for nested functions so their name can be bound
+	 *  before their body is compiled, by finish() for the outermost.
+	**/
 	Function* func;
 	
-	FunctionBuilder(FunctionBuilder* outer=nullptr) {
-		outer = outer;
-		func = new Function();
+	std::vector<Operation> code;
+	std::vector<Value> constants;
+	std::vector<InlineCache> caches;
+	std::vector<Function*> functions;
+	std::vector<Handler> handlers;
+	uint slots;
+	
+	/**
+	 * The next free register.
+	**/
+	int top;
+	
+	Known known[UINT8_MAX + 1];
+	
+	/**
+	 * Pool index of each distinct literal, see poolKey.
+	**/
+	std::unordered_map<std::string, int> pooled;
+	
+	/**
+	 * Names in scope, innermost last.
+	**/
+	std::vector<Local> locals;
+	
+	FunctionBuilder(Unit* u, OptLevel l, FunctionBuilder* o=nullptr)
+		:outer(o), unit(u), opt(l), slots(0), top(0) {
+		func = o? u->arena.make<Function>(u, true) : nullptr;
+	}
+	
+	/**
+	 * Allocate a temporary register.
+	**/
+	int reg() {
+		if(top > UINT8_MAX) {
+			throw std::runtime_error("Expression needs too many registers");
+		}
+		int r = top++;
+		slots = std::max(slots, (uint)top);
+		return r;
+	}
+	
+	/**
+	 * Free every register from r up.
+	**/
+	void release(int r) {
+		top = r;
+	}
+	
+	Function* finish() {
+		uint rawSize = code.size(), rawSlots = slots;
+		markTailCalls();
+		optimize(code, handlers, slots, opt);
+		compact();
+		
+		auto& arena = unit->arena;
+		if(!func) {
+			func = arena.make<Function>(unit);
+		}
+		func->rawSize = rawSize;
+		func->rawSlots = rawSlots;
+		
+		func->code = arena.copy(code.data(), code.size());
+		func->constants = arena.copy(constants.data(), constants.size());
+		func->caches = arena.copy(caches.data(), caches.size());
+		func->functions = arena.copy(functions.data(), functions.size());
+		func->handlers = arena.copy(handlers.data(), handlers.size());
+		func->slots = slots;
+		func->opt = opt;
+		func->tier = opt == OPT_FULL? TIER_OPTIMIZED : TIER_INTERPRETED;
+		
+		prepare(func);
+		return func;
+	}
+	
+	/**
+	 * A call whose result is returned right away, directly or through
+	 *  jumps, becomes a tail call reusing this function's frame. This is
+	 *  a guarantee rather than an optimization, so it's done at every
+	 *  level. Calls a handler protects need their frame to catch in.
+	**/
+	void markTailCalls() {
+		for(auto& op : code) {
+			if(op.op != OP_CALL || isProtected(&op - code.data())) {
+				continue;
+			}
+			
+			// Code ends in a return, so this stays in range
+			auto next = &op + 1;
+			for(size_t n = 0; n < code.size(); ++n) {
+				if(next->op == OP_JMP) {
+					next += 1 + next->sbx();
+				}
+				else if(next->op == OP_NOP) {
+					++next;
+				}
+				else {
+					break;
+				}
+			}
+			
+			if(next->op == OP_RETURN && next->a == op.a) {
+				op.op = OP_TAILCALL;
+			}
+		}
+	}
+	
+	bool isProtected(size_t at) {
+		for(auto& h : handlers) {
+			if(h.begin <= at && at < h.end) {
+				return true;
+			}
+		}
+		return false;
+	}
+	
+	/**
+	 * Drop the constants and caches which only folded or discarded code
+	 *  used, renumbering the rest in order of first use.
+	**/
+	void compact() {
+		std::vector<int> cmap(constants.size(), -1), imap(caches.size(), -1);
+		std::vector<Value> cs;
+		std::vector<InlineCache> ics;
+		
+		for(auto& op : code) {
+			switch(op.op) {
+				case OP_CONST: {
+					int& m = cmap[op.bx()];
+					if(m < 0) {
+						m = cs.size();
+						cs.push_back(constants[op.bx()]);
+					}
+					op = Operation(op.op, op.a, m);
+					break;
+				}
+				
+				case OP_GETATTR:
+				case OP_SETATTR:
+				case OP_HASATTR:
+				case OP_DELATTR: {
+					int& m = imap[op.bx()];
+					if(m < 0) {
+						m = ics.size();
+						ics.push_back(caches[op.bx()]);
+					}
+					op = Operation(op.op, op.a, m);
+					break;
+				}
+				
+				default: break;
+			}
+		}
+		
+		constants.swap(cs);
+		caches.swap(ics);
+		pooled.clear();
+	}
+	
+	void forget(int r) {
+		known[r].valid = false;
+		known[r].value = Value::nil;
+	}
+	
+	/**
+	 * Control can arrive at the next instruction from elsewhere, so no
+	 *  register is known any more.
+	**/
+	void label() {
+		for(int r = 0; r <= UINT8_MAX; ++r) {
+			forget(r);
+		}
+	}
+	
+	/**
+	 * Remove the code emitted since mark, like a branch which can't run.
+	**/
+	void discard(size_t mark) {
+		code.resize(mark);
+		handlers.erase(
+			std::remove_if(handlers.begin(), handlers.end(),
+				[mark](const Handler& h) { return h.begin >= mark; }
+			),
+			handlers.end()
+		);
+		for(int r = 0; r <= UINT8_MAX; ++r) {
+			if(known[r].valid && known[r].at >= mark) {
+				forget(r);
+			}
+		}
 	}
 	
 	void push(Opcode op, int a, int b, int c) {
-		func->code.push_back(Operation(op, a, b, c));
+		code.push_back(Operation(op, a, b, c));
+		forget(a);
+	}
+	void push(Opcode op, int a, int bx) {
+		code.push_back(Operation(op, a, bx));
+		forget(a);
+	}
+	
+	/**
+	 * Literals are deduplicated by type and contents. Reals use their
+	 *  bits so 0.0 and -0.0 stay distinct.
+	**/
+	static std::string poolKey(Value& v) {
+		if(v.isString()) {
+			return 's' + v.toString();
+		}
+		if(v.isInt()) {
+			return 'i' + v.toString();
+		}
+		return 'r' + std::string((const char*)&v.bits, sizeof(v.bits));
+	}
+	
+	int constant(Value v) {
+		auto key = poolKey(v);
+		auto it = pooled.find(key);
+		if(it != pooled.end()) {
+			return it->second;
+		}
+		
+		if(constants.size() > UINT16_MAX) {
+			throw std::runtime_error("Too many constants");
+		}
+		constants.push_back(v);
+		return pooled[key] = constants.size() - 1;
+	}
+	
+	/**
+	 * Load a constant with the smallest instruction which can hold it,
+	 *  ints which don't fit the signed 16 bit operand going in the pool.
+	**/
+	void pushValue(int dst, Value v) {
+		if(v.isNil()) {
+			push(OP_NIL, dst, 0, 0);
+		}
+		else if(v.isBool()) {
+			push(OP_BOOL, dst, v.asBool(), 0);
+		}
+		else if(
+			v.isSmallInt() &&
+			v.asSmallInt() >= INT16_MIN && v.asSmallInt() <= INT16_MAX
+		) {
+			push(OP_IMM, dst, (int)v.asSmallInt());
+		}
+		else {
+			push(OP_CONST, dst, constant(v));
+		}
+		
+		known[dst].valid = true;
+		known[dst].value = v;
+		known[dst].at = code.size() - 1;
+	}
+	void pushObject(int dst) {
+		push(vm::OP_OBJECT, dst, 0, 0);
 	}
-	void pushNil() {
-		push(vm::OP_NIL, -1, 0, 0);
+	void pushFunc(int dst, Function* fn) {
+		size_t i = std::find(functions.begin(), functions.end(), fn) -
+			functions.begin();
+		if(i == functions.size()) {
+			if(i > UINT16_MAX) {
+				throw std::runtime_error("Too many functions");
+			}
+			functions.push_back(fn);
+		}
+		push(vm::OP_FUNC, dst, (int)i);
 	}
-	void pushBool(bool b) {
-		push(vm::OP_BOOL, -1, b, 0);
+	
+	void bind(Atom name, int r) {
+		locals.push_back({name, r, nullptr});
 	}
-	void pushInt(int i) {
-		push(vm::OP_IMM, -1, i, 0);
+	void bind(Atom name, Function* fn) {
+		locals.push_back({name, -1, fn});
 	}
-	void pushBinop(Opcode op) {
-		push(op, -1, -1, -1);
+	
+	/**
+	 * Load what a name is bound to, looking through the enclosing
+	 *  functions for those declared by let.
+	**/
+	void pushName(int dst, Atom name) {
+		for(auto b = this; b; b = b->outer) {
+			for(auto it = b->locals.rbegin(); it != b->locals.rend(); ++it) {
+				if(it->name != name) {
+					continue;
+				}
+				
+				if(it->fn) {
+					pushFunc(dst, it->fn);
+				}
+				else if(b == this) {
+					push(vm::OP_MOVE, dst, it->reg, 0);
+				}
+				else {
+					throw std::runtime_error(
+						"Can't use " + atom_name(name) + " of an enclosing function"
+					);
+				}
+				return;
+			}
+		}
+		
+		throw std::runtime_error("Undefined name " + atom_name(name));
+	}
+	/**
+	 * Allocate an inline cache for one attribute access site.
+	**/
+	int cache(Atom a) {
+		if(caches.size() > UINT16_MAX) {
+			throw std::runtime_error("Too many attribute accesses");
+		}
+		caches.emplace_back(a);
+		return caches.size() - 1;
+	}
+	/**
+	 * Attribute ops need the operand bits for their cache, so they work
+	 *  in place on the object's register.
+	**/
+	void pushGetattr(int dst, int obj, Atom a) {
+		if(dst != obj) {
+			push(vm::OP_MOVE, dst, obj, 0);
+		}
+		push(vm::OP_GETATTR, dst, cache(a));
+	}
+	/**
+	 * The value is taken from the register after the object.
+	**/
+	void pushSetattr(int obj, Atom a, int val) {
+		assert(val == obj + 1);
+		push(vm::OP_SETATTR, obj, cache(a));
+	}
+	
+	/**
+	 * Apply a binary operator to constants with Value's own semantics,
+	 *  returning false if it can't be done at compile time.
+	**/
+	static bool evaluate(Opcode op, Value l, Value r, Value& out) {
+		// Repeated strings could be arbitrarily large
+		if(op == OP_MUL && (l.isString() || r.isString())) {
+			return false;
+		}
+		
+		Result res;
+		switch(op) {
+			case OP_ADD: res = l + r; break;
+			case OP_SUB: res = l - r; break;
+			case OP_MUL: res = l*r; break;
+			case OP_DIV: res = l/r; break;
+			case OP_IDIV: res = l.idiv(r); break;
+			case OP_MOD: res = l%r; break;
+			case OP_IMOD: res = l.imod(r); break;
+			case OP_GT: res = l > r; break;
+			case OP_GTE: res = l >= r; break;
+			case OP_LT: res = l < r; break;
+			case OP_LTE: res = l <= r; break;
+			case OP_EQ: res = l == r; break;
+			case OP_NE: res = l != r; break;
+			
+			default: return false;
+		}
+		
+		if(res.isFailure()) {
+			return false;
+		}
+		out = res;
+		return true;
+	}
+	
+	/**
+	 * Operators on two constants loaded by the last two instructions are
+	 *  folded into a load of the result. Adding or subtracting a literal
+	 *  1 compiles to OP_INC or OP_DEC instead of loading the temporary.
+	**/
+	void pushBinop(Opcode op, int dst, int lhs, int rhs) {
+		Known &l = known[lhs], &r = known[rhs];
+		bool rlast = r.valid && r.at + 1 == code.size();
+		
+		Value v;
+		if(rlast && l.valid && l.at + 1 == r.at &&
+			evaluate(op, l.value, r.value, v)) {
+			code.resize(l.at);
+			forget(lhs);
+			forget(rhs);
+			pushValue(dst, v);
+			return;
+		}
+		
+		if((op == OP_ADD || op == OP_SUB) && rlast && lhs != rhs &&
+			r.value.isSmallInt() && r.value.asSmallInt() == 1) {
+			code.pop_back();
+			forget(rhs);
+			push(op == OP_ADD? OP_INC : OP_DEC, dst, lhs, 0);
+			return;
+		}
+		
+		push(op, dst, lhs, rhs);
+	}
+	
+	/**
+	 * Emit a forward jump, returning its index for patch().
+	**/
+	size_t pushJump(Opcode op, int cond) {
+		push(op, cond, 0);
+		return code.size() - 1;
+	}
+	
+	/**
+	 * Point the jump at index at to the next instruction emitted.
+	**/
+	void patch(size_t at) {
+		size_t off = code.size() - at - 1;
+		if(off > INT16_MAX) {
+			throw std::runtime_error("Jump too far");
+		}
+		code[at] = Operation(code[at].op, code[at].a, (int)off);
+		label();
+	}
+	
+	/**
+	 * If r holds a constant, drop its load if it's the last instruction
+	 *  and store its truth in out.
+	**/
+	bool constCondition(int r, bool& out) {
+		if(!known[r].valid) {
+			return false;
+		}
+		
+		out = known[r].value.toBool();
+		if(known[r].at + 1 == code.size()) {
+			code.pop_back();
+		}
+		forget(r);
+		return true;
+	}
+	
+	/**
+	 * Call the function in r with self and argc arguments in the
+	 *  registers after it. The callee's frame starts right after r, so
+	 *  every register above r is clobbered and the result lands in r.
+	**/
+	void pushCall(int r, int argc) {
+		push(vm::OP_CALL, r, argc, 0);
+		for(int x = r + 1; x <= UINT8_MAX; ++x) {
+			forget(x);
+		}
+	}
+	
+	void pushReturn(int r) {
+		push(vm::OP_RETURN, r, 0, 0);
+	}
+	
+	/**
+	 * Failures in the code from begin to the end so far continue at the
+	 *  next instruction emitted, with the failure in r. Nothing runs on
+	 *  entering the range, so empty ones aren't worth a handler.
+	**/
+	void pushHandler(size_t begin, int r) {
+		if(code.size() > UINT32_MAX) {
+			throw std::runtime_error("Function too long");
+		}
+		if(begin < code.size()) {
+			handlers.push_back({
+				(uint32_t)begin, (uint32_t)code.size(), 0, (uint8_t)r
+			});
+		}
+	}
+	
+	/**
+	 * Point the handler at index at to the next instruction emitted.
+	**/
+	void patchHandler(size_t at) {
+		handlers[at].target = code.size();
+		label();
 	}
 };
 
 struct Parser {
-	FunctionBuilder builder;
+	Unit* unit;
+	FunctionBuilder root;
 	Lexer lexer;
 	
-	Parser(const std::string& code):lexer(code.c_str()) {}
+	/**
+	 * The function being compiled, root or one nested in it.
+	**/
+	FunctionBuilder* builder;
+	
+	Parser(const std::string& code, OptLevel opt)
+		:unit(new Unit()), root(unit, opt), lexer(code.c_str()), builder(&root) {}
+	
+	~Parser() {
+		unit->release();
+	}
 	
 	bool match(TokenType tt) {
 		if(lexer.lookahead.type == tt) {
@@ -48,38 +558,423 @@ struct Parser {
 		
 		return false;
 	}
-
-	int parseAtom() {
+	
+	bool matchSymbol(Symbol sym) {
+		if(lexer.lookahead.type == TT_OP && lexer.lookahead.value.sym == sym) {
+			lexer.consumeToken();
+			return true;
+		}
+		
+		return false;
+	}
+	
+	void expectSymbol(Symbol sym, const char* what) {
+		if(!matchSymbol(sym)) {
+			debug::print("Unexpected token", lexer.lookahead);
+			throw std::runtime_error(what);
+		}
+	}
+	
+	/**
+	 * Any of the three interchangeable grouping brackets.
+	**/
+	Symbol matchOpen() {
+		if(lexer.lookahead.type == TT_OP) {
+			switch(lexer.lookahead.value.sym) {
+				case TK_LPAREN:
+					lexer.consumeToken();
+					return TK_RPAREN;
+				case TK_LBRACKET:
+					lexer.consumeToken();
+					return TK_RBRACKET;
+				case TK_LBRACE:
+					lexer.consumeToken();
+					return TK_RBRACE;
+				
+				default: break;
+			}
+		}
+		return TK_NONE;
+	}
+	
+	/**
+	 * Property keys are identifiers or strings, both interned.
+	**/
+	Atom parseKey() {
+		Atom key;
+		switch(lexer.lookahead.type) {
+			case TT_IDENT:
+				key = lexer.lookahead.value.atom;
+				break;
+			case TT_STRING:
+				key = intern(lexer.str);
+				break;
+			
+			default:
+				debug::print("Unexpected token", lexer.lookahead);
+				throw std::runtime_error("Expected a property name");
+		}
+		
+		lexer.consumeToken();
+		return key;
+	}
+	
+	int parseObject() {
+		auto close = matchOpen();
+		if(close == TK_NONE) {
+			throw std::runtime_error("Expected object literal");
+		}
+		
+		int obj = builder->reg();
+		builder->pushObject(obj);
+		if(matchSymbol(close)) {
+			return obj;
+		}
+		
+		do {
+			Atom key = parseKey();
+			expectSymbol(TK_COLON, "Expected ':' in object literal");
+			int val = parseExpression(0);
+			builder->pushSetattr(obj, key, val);
+			builder->release(val);
+		} while(matchSymbol(TK_COMMA));
+		
+		expectSymbol(close, "Unclosed object literal");
+		return obj;
+	}
+	
+	/**
+	 * if C [then] A [else B], nil when C is false and there's no else.
+	 *  Both branches leave their result in the condition's register. A
+	 *  constant condition emits no jumps and only keeps the code of the
+	 *  branch which is taken.
+	**/
+	int parseIf() {
+		int dst = parseExpression(0);
+		matchSymbol(TK_THEN);
+		
+		bool truth;
+		if(builder->constCondition(dst, truth)) {
+			builder->release(dst);
+			size_t mark = builder->code.size();
+			parseExpression(0);
+			if(!truth) {
+				builder->discard(mark);
+			}
+			
+			builder->release(dst);
+			if(matchSymbol(TK_ELSE)) {
+				mark = builder->code.size();
+				parseExpression(0);
+				if(truth) {
+					builder->discard(mark);
+				}
+			}
+			else if(!truth) {
+				builder->pushValue(dst, Value::nil);
+			}
+			
+			builder->release(dst + 1);
+			return dst;
+		}
+		
+		size_t skip = builder->pushJump(OP_IF, dst);
+		builder->release(dst);
+		parseExpression(0);
+		size_t end = builder->pushJump(OP_JMP, 0);
+		
+		builder->patch(skip);
+		builder->release(dst);
+		if(matchSymbol(TK_ELSE)) {
+			parseExpression(0);
+		}
+		else {
+			builder->pushValue(dst, Value::nil);
+		}
+		builder->patch(end);
+		
+		builder->release(dst + 1);
+		return dst;
+	}
+	
+	/**
+	 * try X [catch (e) Y | else Y], the result of X unless it fails.
+	 *  Then it's Y with e bound to the failure, or nil without a catch
+	 *  or else. The protected code is only X, so entering it costs
+	 *  nothing and X jumps over the handler when it's done.
+	**/
+	int parseTry() {
+		size_t begin = builder->code.size();
+		int dst = parseExpression(0);
+		size_t at = builder->handlers.size();
+		builder->pushHandler(begin, dst);
+		bool caught = builder->handlers.size() > at;
+		
+		size_t skip = builder->pushJump(OP_JMP, 0);
+		if(caught) {
+			builder->patchHandler(at);
+		}
+		builder->release(dst);
+		
+		if(matchSymbol(TK_CATCH)) {
+			auto close = matchOpen();
+			if(close == TK_NONE || lexer.lookahead.type != TT_IDENT) {
+				throw std::runtime_error("Expected a name to catch");
+			}
+			size_t scope = builder->locals.size();
+			builder->bind(lexer.lookahead.value.atom, builder->reg());
+			lexer.consumeToken();
+			expectSymbol(close, "Unclosed catch");
+			
+			int r = parseExpression(0);
+			builder->push(OP_MOVE, dst, r, 0);
+			builder->locals.resize(scope);
+		}
+		else if(matchSymbol(TK_ELSE)) {
+			parseExpression(0);
+		}
+		else {
+			builder->pushValue(dst, Value::nil);
+		}
+		
+		// Nothing was protected, so neither the handler nor the jump over
+		//  it are needed
+		if(caught) {
+			builder->patch(skip);
+		}
+		else {
+			builder->discard(skip);
+		}
+		
+		builder->release(dst + 1);
+		return dst;
+	}
+	
+	/**
+	 * fail X unwinds to the innermost handler with X, or out of the
+	 *  call as a failed Result.
+	**/
+	int parseFail() {
+		int r = parseExpression(0);
+		builder->push(OP_FAIL, r, 0, 0);
+		return r;
+	}
+	
+	/**
+	 * let [name](params) body, a function whose name is visible in its
+	 *  own body and after it. Self is r0 and the parameters follow it.
+	**/
+	int parseLet() {
+		Atom name = ATOM_EMPTY;
+		if(lexer.lookahead.type == TT_IDENT) {
+			name = lexer.lookahead.value.atom;
+			lexer.consumeToken();
+		}
+		
+		FunctionBuilder fb(unit, builder->opt, builder);
+		fb.func->name = name;
+		if(name != ATOM_EMPTY) {
+			builder->bind(name, fb.func);
+		}
+		
+		auto close = matchOpen();
+		if(close == TK_NONE) {
+			throw std::runtime_error("Expected parameters");
+		}
+		fb.reg();
+		if(!matchSymbol(close)) {
+			do {
+				if(lexer.lookahead.type != TT_IDENT) {
+					debug::print("Unexpected token", lexer.lookahead);
+					throw std::runtime_error("Expected a parameter name");
+				}
+				fb.bind(lexer.lookahead.value.atom, fb.reg());
+				lexer.consumeToken();
+			} while(matchSymbol(TK_COMMA));
+			expectSymbol(close, "Unclosed parameters");
+		}
+		
+		auto outer = builder;
+		builder = &fb;
+		fb.pushReturn(parseExpression(0));
+		builder = outer;
+		
+		int dst = builder->reg();
+		builder->pushFunc(dst, fb.finish());
+		return dst;
+	}
+	
+	/**
+	 * Self is always nil for now, and the arguments are evaluated
+	 *  straight into the registers after it.
+	**/
+	void parseCall(int callee) {
+		builder->release(callee + 1);
+		builder->pushValue(builder->reg(), Value::nil);
+		
+		int argc = 0;
+		if(!matchSymbol(TK_RPAREN)) {
+			do {
+				if(argc == UINT8_MAX) {
+					throw std::runtime_error("Too many arguments");
+				}
+				builder->release(callee + 2 + argc++);
+				parseExpression(0);
+			} while(matchSymbol(TK_COMMA));
+			expectSymbol(TK_RPAREN, "Unclosed call");
+		}
+		
+		builder->pushCall(callee, argc);
+		builder->release(callee + 1);
+	}
+	
+	int parseString() {
+		std::string s = lexer.str;
+		lexer.consumeToken();
+		
+		// Adjacent strings are appended
+		while(lexer.lookahead.type == TT_STRING) {
+			s += lexer.str;
+			lexer.consumeToken();
+		}
+		
+		int dst = builder->reg();
+		builder->pushValue(dst, Value(s));
+		return dst;
+	}
+	
+	/**
+	 * Converts the digits of a TT_BIGINT lookahead, nine at a time so
+	 *  each step is one limb wide.
+	**/
+	BigInt parseBigInt() {
+		const char* digits = lexer.lookahead.origin.cur;
+		size_t len = lexer.lookahead.length;
+		BigInt v;
+		
+		for(size_t i = 0; i < len;) {
+			int64_t chunk = 0, scale = 1;
+			for(int n = 0; n < 9 && i < len; ++n, ++i) {
+				chunk = chunk*10 + (digits[i] - '0');
+				scale *= 10;
+			}
+			v = v*BigInt(scale) + BigInt(chunk);
+		}
+		
+		return v;
+	}
+	
+	/**
+	 * Each parse function returns the register holding its result, which
+	 *  is the first one it allocated.
+	**/
+	int parsePrimary() {
+		int dst;
 		switch(lexer.lookahead.type) {
 			case TT_NIL:
-				builder.pushNil();
-				return -1;
+				builder->pushValue(dst = builder->reg(), Value::nil);
+				lexer.consumeToken();
+				return dst;
 			
 			case TT_BOOL:
-				builder.pushBool(lexer.lookahead.value.b);
-				return -1;
+				builder->pushValue(dst = builder->reg(), Value(lexer.lookahead.value.b));
+				lexer.consumeToken();
+				return dst;
 			
 			case TT_INT:
-				builder.pushInt(lexer.lookahead.value.i);
-				return -1;
+				builder->pushValue(dst = builder->reg(), Value(lexer.lookahead.value.i));
+				lexer.consumeToken();
+				return dst;
+			
+			case TT_BIGINT:
+				builder->pushValue(dst = builder->reg(), Value(parseBigInt()));
+				lexer.consumeToken();
+				return dst;
+			
+			case TT_REAL:
+				builder->pushValue(
+					dst = builder->reg(), Value(lexer.lookahead.value.r)
+				);
+				lexer.consumeToken();
+				return dst;
+			
+			case TT_STRING:
+				return parseString();
+			
+			case TT_IDENT:
+				builder->pushName(dst = builder->reg(), lexer.lookahead.value.atom);
+				lexer.consumeToken();
+				return dst;
+			
+			case TT_OP:
+				if(matchSymbol(TK_DOLLAR)) {
+					return parseObject();
+				}
+				else if(matchSymbol(TK_IF)) {
+					return parseIf();
+				}
+				else if(matchSymbol(TK_LET)) {
+					return parseLet();
+				}
+				else if(matchSymbol(TK_TRY)) {
+					return parseTry();
+				}
+				else if(matchSymbol(TK_FAIL)) {
+					return parseFail();
+				}
+				else {
+					auto close = matchOpen();
+					if(close != TK_NONE) {
+						// Names declared in a group end with it
+						size_t scope = builder->locals.size();
+						int r = parseSequence();
+						expectSymbol(close, "Unclosed group");
+						builder->locals.resize(scope);
+						return r;
+					}
+				}
+				// fallthrough
 			
 			default:
 				debug::print("Unexpected token", lexer.lookahead);
 				throw std::runtime_error("Not an atom");
 		}
 	}
-
+	
+	int parseAtom() {
+		int r = parsePrimary();
+		
+		for(;;) {
+			if(matchSymbol(TK_DOT)) {
+				builder->pushGetattr(r, r, parseKey());
+			}
+			else if(matchSymbol(TK_LPAREN)) {
+				parseCall(r);
+			}
+			else {
+				return r;
+			}
+		}
+	}
+	
 	struct BinaryOp {
 		Opcode op;
 		int precedence;
 		bool leftassoc;
 	};
-
+	
 	#define LEFT true
 	#define RIGHT false
-
+	
 	BinaryOp binaryOpProps(Symbol op) {
 		switch(op) {
+			case TK_LT: return {OP_LT, 0, LEFT};
+			case TK_LTE: return {OP_LTE, 0, LEFT};
+			case TK_GT: return {OP_GT, 0, LEFT};
+			case TK_GTE: return {OP_GTE, 0, LEFT};
+			case TK_EQ: return {OP_EQ, 0, LEFT};
+			case TK_NE: return {OP_NE, 0, LEFT};
+			
 			case TK_PLUS: return {OP_ADD, 1, LEFT};
 			case TK_MINUS: return {OP_SUB, 1, LEFT};
 			case TK_ASTERISK: return {OP_MUL, 2, LEFT};
@@ -90,40 +985,53 @@ struct Parser {
 				return {OP_NOP, 0, LEFT};
 		}
 	}
-
+	
 	bool parseBinaryOp(BinaryOp* binop) {
 		if(lexer.lookahead.type == TT_OP) {
 			*binop = binaryOpProps(lexer.lookahead.value.sym);
-			return true;
+			return binop->op != OP_NOP;
 		}
 		
 		return false;
 	}
-
+	
 	int parseExpression(int minprec) {
 		BinaryOp binop;
 		
 		int lhs = parseAtom();
-		lexer.consumeToken();
 		while(
 			parseBinaryOp(&binop) && binop.precedence >= minprec
 		) {
 			lexer.consumeToken();
-			parseExpression(binop.precedence + binop.leftassoc);
-			builder.pushBinop(binop.op);
-			lhs = -1;
+			int rhs = parseExpression(binop.precedence + binop.leftassoc);
+			builder->pushBinop(binop.op, lhs, lhs, rhs);
+			builder->release(lhs + 1);
 		}
 		
 		return lhs;
 	}
+	
+	/**
+	 * Expressions separated by semicolons, the value of the last.
+	**/
+	int parseSequence() {
+		int r = parseExpression(0);
+		while(matchSymbol(TK_SEMICOLON)) {
+			builder->release(r);
+			parseExpression(0);
+		}
+		
+		builder->release(r + 1);
+		return r;
+	}
 };
 
 } /* namespace vm */
 
-Function* parse(const std::string& code) {
-	vm::Parser p(code);
-	p.parseExpression(0);
-	return p.builder.func;
+Function* parse(const std::string& code, vm::OptLevel opt) {
+	vm::Parser p(code, opt);
+	p.root.pushReturn(p.parseSequence());
+	return p.root.finish();
 }
 
 } /* namespace esp */
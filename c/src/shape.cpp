@@ -0,0 +1,104 @@
+#include <mutex>
+
+#include "shape.hpp"
+
+namespace esp {
+
+/**
+ * Shapes this small are scanned rather than hashed.
+**/
+constexpr uint LINEAR_SLOTS = 8;
+
+/**
+ * Held to add a transition to any shape.
+**/
+static std::mutex transition_lock;
+
+/**
+ * Held to add to any inline cache, which is rare enough to share one.
+**/
+static std::mutex cache_lock;
+
+Shape::Shape(Shape* p, Atom key):parent(p), transitionCount(0) {
+	if(p) {
+		keys = p->keys;
+		keys.push_back(key);
+		
+		if(keys.size() > LINEAR_SLOTS) {
+			for(uint i = 0; i < keys.size(); ++i) {
+				index.emplace(keys[i], i);
+			}
+		}
+	}
+}
+
+Shape* Shape::root() {
+	static Shape* r = new Shape(nullptr, ATOM_EMPTY);
+	return r;
+}
+
+int Shape::lookup(Atom key) const {
+	if(keys.size() > LINEAR_SLOTS) {
+		auto it = index.find(key);
+		return it == index.end()? -1 : (int)it->second;
+	}
+	
+	for(uint i = 0; i < keys.size(); ++i) {
+		if(keys[i] == key) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+Shape* Shape::child(Atom key) const {
+	uint n = transitionCount.load(std::memory_order_acquire);
+	for(uint i = 0; i < n; ++i) {
+		if(transitions[i].key == key) {
+			return transitions[i].next;
+		}
+	}
+	return nullptr;
+}
+
+Shape* Shape::add(Atom key) {
+	if(auto next = child(key)) {
+		return next;
+	}
+	
+	// Another thread may have added it since
+	std::lock_guard<std::mutex> guard(transition_lock);
+	if(auto next = child(key)) {
+		return next;
+	}
+	
+	uint n = transitionCount.load(std::memory_order_relaxed);
+	if(size() >= MAX_SLOTS || n >= MAX_TRANSITIONS) {
+		return nullptr;
+	}
+	
+	auto next = new Shape(this, key);
+	transitions[n] = {key, next};
+	transitionCount.store(n + 1, std::memory_order_release);
+	return next;
+}
+
+void InlineCache::insert(Shape* shape, Shape* next, int slot) {
+	std::lock_guard<std::mutex> guard(cache_lock);
+	
+	// Another thread may have just added the same shape
+	if(find(shape)) {
+		return;
+	}
+	
+	int n = count.load(std::memory_order_relaxed);
+	if(n < WAYS) {
+		entries[n] = {shape, next, slot};
+		count.store(n + 1, std::memory_order_release);
+	}
+	else {
+		count.store(WAYS + 1, std::memory_order_relaxed);
+	}
+}
+
+}
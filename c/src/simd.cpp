@@ -0,0 +1,453 @@
+/**
+ * @file simd.cpp
+ *
+ * Every kernel is a template over its operator, so the operator switch
+ *  folds away and each instruction set gets one tight loop per op. The
+ *  SSE2 and AVX2 versions handle whole vectors and hand the tail to the
+ *  scalar version. AVX2 is compiled with a target attribute rather than
+ *  a global -mavx2 so the binary still runs on CPUs without it.
+**/
+
+#include <algorithm>
+#include <atomic>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define ESP_X86 1
+#endif
+
+#include "simd.hpp"
+
+namespace esp {
+namespace simd {
+
+typedef void (*RealFn)(
+	const double*, bool, const double*, bool, double*, size_t
+);
+typedef bool (*IntFn)(
+	const int64_t*, bool, const int64_t*, bool, int64_t*, size_t
+);
+typedef void (*CompareRealFn)(
+	const double*, bool, const double*, bool, uint8_t*, size_t
+);
+typedef void (*CompareIntFn)(
+	const int64_t*, bool, const int64_t*, bool, uint8_t*, size_t
+);
+
+/**
+ * Kernels of one level, comparisons indexed from LT.
+**/
+struct Kernels {
+	RealFn reals[4];
+	IntFn ints[3];
+	CompareRealFn compareReals[6];
+	CompareIntFn compareInts[6];
+};
+
+template<Op OP, typename T>
+static inline T arith(T a, T b) {
+	switch(OP) {
+		case ADD: return a + b;
+		case SUB: return a - b;
+		case MUL: return a*b;
+		default: return a/b;
+	}
+}
+
+template<Op OP, typename T>
+static inline bool compare(T a, T b) {
+	switch(OP) {
+		case LT: return a < b;
+		case LTE: return a <= b;
+		case GT: return a > b;
+		case GTE: return a >= b;
+		case EQ: return a == b;
+		default: return a != b;
+	}
+}
+
+template<Op OP>
+static inline bool checked(int64_t a, int64_t b, int64_t* out) {
+	switch(OP) {
+		case ADD: return __builtin_add_overflow(a, b, out);
+		case SUB: return __builtin_sub_overflow(a, b, out);
+		default: return __builtin_mul_overflow(a, b, out);
+	}
+}
+
+/**
+ * Advance the operands of a kernel past the first i elements.
+**/
+#define TAIL(i) \
+	va? a + (i) : a, va, vb? b + (i) : b, vb, out + (i), n - (i)
+
+template<Op OP>
+static void reals_scalar(
+	const double* a, bool va, const double* b, bool vb,
+	double* out, size_t n
+) {
+	for(size_t i = 0; i < n; ++i) {
+		out[i] = arith<OP>(a[va? i : 0], b[vb? i : 0]);
+	}
+}
+
+template<Op OP>
+static bool ints_scalar(
+	const int64_t* a, bool va, const int64_t* b, bool vb,
+	int64_t* out, size_t n
+) {
+	bool overflow = false;
+	for(size_t i = 0; i < n; ++i) {
+		overflow |= checked<OP>(a[va? i : 0], b[vb? i : 0], &out[i]);
+	}
+	return !overflow;
+}
+
+template<Op OP, typename T>
+static void compare_scalar(
+	const T* a, bool va, const T* b, bool vb, uint8_t* out, size_t n
+) {
+	for(size_t i = 0; i < n; ++i) {
+		out[i] = compare<OP>(a[va? i : 0], b[vb? i : 0]);
+	}
+}
+
+/**
+ * Spread the low k bits of a movemask into k bytes.
+**/
+static inline void unpack_mask(int bits, uint8_t* out, int k) {
+	for(int j = 0; j < k; ++j) {
+		out[j] = (bits >> j) & 1;
+	}
+}
+
+#ifdef ESP_X86
+
+template<Op OP>
+static void reals_sse2(
+	const double* a, bool va, const double* b, bool vb,
+	double* out, size_t n
+) {
+	__m128d sa = _mm_set1_pd(*a), sb = _mm_set1_pd(*b);
+	size_t i = 0;
+	for(; i + 2 <= n; i += 2) {
+		__m128d x = va? _mm_loadu_pd(a + i) : sa;
+		__m128d y = vb? _mm_loadu_pd(b + i) : sb;
+		__m128d r;
+		switch(OP) {
+			case ADD: r = _mm_add_pd(x, y); break;
+			case SUB: r = _mm_sub_pd(x, y); break;
+			case MUL: r = _mm_mul_pd(x, y); break;
+			default: r = _mm_div_pd(x, y); break;
+		}
+		_mm_storeu_pd(out + i, r);
+	}
+	reals_scalar<OP>(TAIL(i));
+}
+
+/**
+ * Adds and subtracts detect signed overflow from the sign bits of the
+ *  operands and result. Neither SSE2 nor AVX2 has a 64 bit multiply, so
+ *  MUL stays scalar.
+**/
+template<Op OP>
+static bool ints_sse2(
+	const int64_t* a, bool va, const int64_t* b, bool vb,
+	int64_t* out, size_t n
+) {
+	if constexpr(OP == MUL) {
+		return ints_scalar<OP>(a, va, b, vb, out, n);
+	}
+	else {
+		__m128i sa = _mm_set1_epi64x(*a), sb = _mm_set1_epi64x(*b);
+		__m128i overflow = _mm_setzero_si128();
+		size_t i = 0;
+		for(; i + 2 <= n; i += 2) {
+			__m128i x = va? _mm_loadu_si128((const __m128i*)(a + i)) : sa;
+			__m128i y = vb? _mm_loadu_si128((const __m128i*)(b + i)) : sb;
+			__m128i r, o;
+			if constexpr(OP == ADD) {
+				r = _mm_add_epi64(x, y);
+				o = _mm_and_si128(_mm_xor_si128(x, r), _mm_xor_si128(y, r));
+			}
+			else {
+				r = _mm_sub_epi64(x, y);
+				o = _mm_and_si128(_mm_xor_si128(x, y), _mm_xor_si128(x, r));
+			}
+			overflow = _mm_or_si128(overflow, o);
+			_mm_storeu_si128((__m128i*)(out + i), r);
+		}
+		if(_mm_movemask_pd(_mm_castsi128_pd(overflow))) {
+			return false;
+		}
+		return ints_scalar<OP>(TAIL(i));
+	}
+}
+
+template<Op OP>
+static void compare_reals_sse2(
+	const double* a, bool va, const double* b, bool vb,
+	uint8_t* out, size_t n
+) {
+	__m128d sa = _mm_set1_pd(*a), sb = _mm_set1_pd(*b);
+	size_t i = 0;
+	for(; i + 2 <= n; i += 2) {
+		__m128d x = va? _mm_loadu_pd(a + i) : sa;
+		__m128d y = vb? _mm_loadu_pd(b + i) : sb;
+		__m128d m;
+		switch(OP) {
+			case LT: m = _mm_cmplt_pd(x, y); break;
+			case LTE: m = _mm_cmple_pd(x, y); break;
+			case GT: m = _mm_cmpgt_pd(x, y); break;
+			case GTE: m = _mm_cmpge_pd(x, y); break;
+			case EQ: m = _mm_cmpeq_pd(x, y); break;
+			default: m = _mm_cmpneq_pd(x, y); break;
+		}
+		unpack_mask(_mm_movemask_pd(m), out + i, 2);
+	}
+	compare_scalar<OP>(TAIL(i));
+}
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+template<Op OP>
+AVX2_TARGET static void reals_avx2(
+	const double* a, bool va, const double* b, bool vb,
+	double* out, size_t n
+) {
+	__m256d sa = _mm256_set1_pd(*a), sb = _mm256_set1_pd(*b);
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m256d x = va? _mm256_loadu_pd(a + i) : sa;
+		__m256d y = vb? _mm256_loadu_pd(b + i) : sb;
+		__m256d r;
+		switch(OP) {
+			case ADD: r = _mm256_add_pd(x, y); break;
+			case SUB: r = _mm256_sub_pd(x, y); break;
+			case MUL: r = _mm256_mul_pd(x, y); break;
+			default: r = _mm256_div_pd(x, y); break;
+		}
+		_mm256_storeu_pd(out + i, r);
+	}
+	reals_scalar<OP>(TAIL(i));
+}
+
+template<Op OP>
+AVX2_TARGET static bool ints_avx2(
+	const int64_t* a, bool va, const int64_t* b, bool vb,
+	int64_t* out, size_t n
+) {
+	if constexpr(OP == MUL) {
+		return ints_scalar<OP>(a, va, b, vb, out, n);
+	}
+	else {
+		__m256i sa = _mm256_set1_epi64x(*a), sb = _mm256_set1_epi64x(*b);
+		__m256i overflow = _mm256_setzero_si256();
+		size_t i = 0;
+		for(; i + 4 <= n; i += 4) {
+			__m256i x = va?
+				_mm256_loadu_si256((const __m256i*)(a + i)) : sa;
+			__m256i y = vb?
+				_mm256_loadu_si256((const __m256i*)(b + i)) : sb;
+			__m256i r, o;
+			if constexpr(OP == ADD) {
+				r = _mm256_add_epi64(x, y);
+				o = _mm256_and_si256(
+					_mm256_xor_si256(x, r), _mm256_xor_si256(y, r)
+				);
+			}
+			else {
+				r = _mm256_sub_epi64(x, y);
+				o = _mm256_and_si256(
+					_mm256_xor_si256(x, y), _mm256_xor_si256(x, r)
+				);
+			}
+			overflow = _mm256_or_si256(overflow, o);
+			_mm256_storeu_si256((__m256i*)(out + i), r);
+		}
+		if(_mm256_movemask_pd(_mm256_castsi256_pd(overflow))) {
+			return false;
+		}
+		return ints_scalar<OP>(TAIL(i));
+	}
+}
+
+template<Op OP>
+AVX2_TARGET static void compare_reals_avx2(
+	const double* a, bool va, const double* b, bool vb,
+	uint8_t* out, size_t n
+) {
+	__m256d sa = _mm256_set1_pd(*a), sb = _mm256_set1_pd(*b);
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m256d x = va? _mm256_loadu_pd(a + i) : sa;
+		__m256d y = vb? _mm256_loadu_pd(b + i) : sb;
+		__m256d m;
+		switch(OP) {
+			case LT: m = _mm256_cmp_pd(x, y, _CMP_LT_OQ); break;
+			case LTE: m = _mm256_cmp_pd(x, y, _CMP_LE_OQ); break;
+			case GT: m = _mm256_cmp_pd(x, y, _CMP_GT_OQ); break;
+			case GTE: m = _mm256_cmp_pd(x, y, _CMP_GE_OQ); break;
+			case EQ: m = _mm256_cmp_pd(x, y, _CMP_EQ_OQ); break;
+			default: m = _mm256_cmp_pd(x, y, _CMP_NEQ_UQ); break;
+		}
+		unpack_mask(_mm256_movemask_pd(m), out + i, 4);
+	}
+	compare_scalar<OP>(TAIL(i));
+}
+
+/**
+ * AVX2 only has == and > for 64 bit ints, the rest are built from those
+ *  by swapping operands or inverting the mask.
+**/
+template<Op OP>
+AVX2_TARGET static void compare_ints_avx2(
+	const int64_t* a, bool va, const int64_t* b, bool vb,
+	uint8_t* out, size_t n
+) {
+	__m256i sa = _mm256_set1_epi64x(*a), sb = _mm256_set1_epi64x(*b);
+	size_t i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m256i x = va? _mm256_loadu_si256((const __m256i*)(a + i)) : sa;
+		__m256i y = vb? _mm256_loadu_si256((const __m256i*)(b + i)) : sb;
+		__m256i m;
+		int invert = 0;
+		switch(OP) {
+			case LT: m = _mm256_cmpgt_epi64(y, x); break;
+			case LTE: m = _mm256_cmpgt_epi64(x, y); invert = 15; break;
+			case GT: m = _mm256_cmpgt_epi64(x, y); break;
+			case GTE: m = _mm256_cmpgt_epi64(y, x); invert = 15; break;
+			case EQ: m = _mm256_cmpeq_epi64(x, y); break;
+			default: m = _mm256_cmpeq_epi64(x, y); invert = 15; break;
+		}
+		unpack_mask(
+			_mm256_movemask_pd(_mm256_castsi256_pd(m)) ^ invert, out + i, 4
+		);
+	}
+	compare_scalar<OP>(TAIL(i));
+}
+
+#endif
+
+#define KERNELS(reals, ints, compareReals, compareInts) { \
+	{reals<ADD>, reals<SUB>, reals<MUL>, reals<DIV>}, \
+	{ints<ADD>, ints<SUB>, ints<MUL>}, \
+	{ \
+		compareReals<LT>, compareReals<LTE>, compareReals<GT>, \
+		compareReals<GTE>, compareReals<EQ>, compareReals<NE> \
+	}, \
+	{ \
+		compareInts<LT>, compareInts<LTE>, compareInts<GT>, \
+		compareInts<GTE>, compareInts<EQ>, compareInts<NE> \
+	} \
+}
+
+template<Op OP>
+static void compare_reals_scalar(
+	const double* a, bool va, const double* b, bool vb,
+	uint8_t* out, size_t n
+) {
+	compare_scalar<OP>(a, va, b, vb, out, n);
+}
+
+template<Op OP>
+static void compare_ints_scalar(
+	const int64_t* a, bool va, const int64_t* b, bool vb,
+	uint8_t* out, size_t n
+) {
+	compare_scalar<OP>(a, va, b, vb, out, n);
+}
+
+static const Kernels tables[] = {
+	KERNELS(reals_scalar, ints_scalar,
+		compare_reals_scalar, compare_ints_scalar),
+#ifdef ESP_X86
+	// SSE2 has no 64 bit integer compare
+	KERNELS(reals_sse2, ints_sse2,
+		compare_reals_sse2, compare_ints_scalar),
+	KERNELS(reals_avx2, ints_avx2,
+		compare_reals_avx2, compare_ints_avx2)
+#endif
+};
+
+/**
+ * The kernels in use for every thread, indexed like tables by level.
+**/
+static std::atomic<const Kernels*> kernels{nullptr};
+
+static Level supported() {
+#ifdef ESP_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		return AVX2;
+	}
+	return SSE2;
+#else
+	return SCALAR;
+#endif
+}
+
+static inline const Kernels& table() {
+	auto k = kernels.load(std::memory_order_relaxed);
+	if(!k) {
+		setLevel(AVX2);
+		k = kernels.load(std::memory_order_relaxed);
+	}
+	return *k;
+}
+
+Level level() {
+	return (Level)(&table() - tables);
+}
+
+Level setLevel(Level l) {
+	Level current = std::min(l, supported());
+	kernels.store(&tables[current], std::memory_order_relaxed);
+	return current;
+}
+
+const char* level_name(Level l) {
+	switch(l) {
+		case SCALAR: return "scalar";
+		case SSE2: return "sse2";
+		case AVX2: return "avx2";
+	}
+	return "?";
+}
+
+void reals(
+	Op op, const double* a, bool va, const double* b, bool vb,
+	double* out, size_t n
+) {
+	if(n) {
+		table().reals[op - ADD](a, va, b, vb, out, n);
+	}
+}
+
+bool ints(
+	Op op, const int64_t* a, bool va, const int64_t* b, bool vb,
+	int64_t* out, size_t n
+) {
+	return !n || table().ints[op - ADD](a, va, b, vb, out, n);
+}
+
+void compareReals(
+	Op op, const double* a, bool va, const double* b, bool vb,
+	uint8_t* out, size_t n
+) {
+	if(n) {
+		table().compareReals[op - LT](a, va, b, vb, out, n);
+	}
+}
+
+void compareInts(
+	Op op, const int64_t* a, bool va, const int64_t* b, bool vb,
+	uint8_t* out, size_t n
+) {
+	if(n) {
+		table().compareInts[op - LT](a, va, b, vb, out, n);
+	}
+}
+
+} /* namespace simd */
+} /* namespace esp */
@@ -1,4 +1,5 @@
 #include <cstdlib>
+#include <stdexcept>
 #include <string>
 #include <cctype>
 
@@ -10,6 +11,10 @@ bool isIdentStart(int c) {
 	return isalpha(c) || c == '$' || c == '_' || c == '?';
 }
 
+bool isIdentPart(int c) {
+	return isIdentStart(c) || isdigit(c);
+}
+
 Token::Token() {}
 Token::Token(TokenType tt, Position ori, size_t len, bool v):type(tt), origin(ori), length(len) {
 	value.b = v;
@@ -18,6 +23,12 @@ Token::Token(TokenType tt, Position ori, size_t len, int v):Token(tt, ori, len,
 Token::Token(TokenType tt, Position ori, size_t len, esp_int v):type(tt), origin(ori), length(len) {
 	value.i = v;
 }
+Token::Token(TokenType tt, Position ori, size_t len, esp_real v):type(tt), origin(ori), length(len) {
+	value.r = v;
+}
+Token::Token(TokenType tt, Position ori, size_t len, Atom v):type(tt), origin(ori), length(len) {
+	value.atom = v;
+}
 Token::Token(TokenType tt, Position ori, size_t len, Symbol v):type(tt), origin(ori), length(len) {
 	value.sym = v;
 }
@@ -41,15 +52,19 @@ void Lexer::advance() {
 }
 
 bool Lexer::consumeToken() {
+	ignoreSpace();
+	
 	if(*pos.cur == '\0') {
-		
+		lookahead = Token(TT_END, pos, 0, 0);
+		return false;
+	}
+	
+	if(nextIdent() || nextNumber() || nextString() || nextOperator()) {
+		return true;
 	}
-	ignoreSpace();
 	
-	return
-		nextIdent() ||
-		nextNumber() ||
-		nextOperator();
+	lookahead = Token(TT_ERROR, pos, 1, 0);
+	return false;
 }
 
 bool Lexer::matchChar(int m) {
@@ -114,6 +129,82 @@ bool Lexer::nextOperator() {
 			lookahead = Token(TT_OP, pos, 1, TK_PERCENT);
 			break;
 		
+		case '<':
+			if(pos.cur[1] == '=') {
+				lookahead = Token(TT_OP, pos, 2, TK_LTE);
+				advance();
+			}
+			else {
+				lookahead = Token(TT_OP, pos, 1, TK_LT);
+			}
+			break;
+		
+		case '>':
+			if(pos.cur[1] == '=') {
+				lookahead = Token(TT_OP, pos, 2, TK_GTE);
+				advance();
+			}
+			else {
+				lookahead = Token(TT_OP, pos, 1, TK_GT);
+			}
+			break;
+		
+		case '=':
+			if(pos.cur[1] != '=') {
+				return false;
+			}
+			lookahead = Token(TT_OP, pos, 2, TK_EQ);
+			advance();
+			break;
+		
+		case '!':
+			if(pos.cur[1] != '=') {
+				return false;
+			}
+			lookahead = Token(TT_OP, pos, 2, TK_NE);
+			advance();
+			break;
+		
+		case '.':
+			lookahead = Token(TT_OP, pos, 1, TK_DOT);
+			break;
+		
+		case ',':
+			lookahead = Token(TT_OP, pos, 1, TK_COMMA);
+			break;
+		
+		case ':':
+			lookahead = Token(TT_OP, pos, 1, TK_COLON);
+			break;
+		
+		case ';':
+			lookahead = Token(TT_OP, pos, 1, TK_SEMICOLON);
+			break;
+		
+		case '(':
+			lookahead = Token(TT_OP, pos, 1, TK_LPAREN);
+			break;
+		
+		case ')':
+			lookahead = Token(TT_OP, pos, 1, TK_RPAREN);
+			break;
+		
+		case '[':
+			lookahead = Token(TT_OP, pos, 1, TK_LBRACKET);
+			break;
+		
+		case ']':
+			lookahead = Token(TT_OP, pos, 1, TK_RBRACKET);
+			break;
+		
+		case '{':
+			lookahead = Token(TT_OP, pos, 1, TK_LBRACE);
+			break;
+		
+		case '}':
+			lookahead = Token(TT_OP, pos, 1, TK_RBRACE);
+			break;
+		
 		default:
 			return false;
 	}
@@ -127,58 +218,144 @@ bool Lexer::nextOperator() {
  * Handles identifiers, including the literals
 **/
 bool Lexer::nextIdent() {
-	auto* beg = pos.cur;
+	auto start = pos;
 	auto c = nextChar();
 	
-	while(isIdentStart(c)) {
-		consumeChar();
-		c = nextChar();
-	}
-	
-	if(beg == pos.cur) {
+	if(!isIdentStart(c)) {
 		return false;
 	}
 	
-	std::string kw(beg, pos.cur - beg);
+	do {
+		consumeChar();
+		c = nextChar();
+	} while(isIdentPart(c));
+	
+	size_t len = pos.cur - start.cur;
+	std::string kw(start.cur, len);
 	
 	if(kw == "nil") {
-		lookahead = Token(TT_NIL, pos, 3, 0);
+		lookahead = Token(TT_NIL, start, len, 0);
 	}
 	else if(kw == "true") {
-		lookahead = Token(TT_BOOL, pos, 4, true);
+		lookahead = Token(TT_BOOL, start, len, true);
 	}
 	else if(kw == "false") {
-		lookahead = Token(TT_BOOL, pos, 5, false);
+		lookahead = Token(TT_BOOL, start, len, false);
+	}
+	else if(kw == "if") {
+		lookahead = Token(TT_OP, start, len, TK_IF);
+	}
+	else if(kw == "then") {
+		lookahead = Token(TT_OP, start, len, TK_THEN);
+	}
+	else if(kw == "else") {
+		lookahead = Token(TT_OP, start, len, TK_ELSE);
+	}
+	else if(kw == "let") {
+		lookahead = Token(TT_OP, start, len, TK_LET);
+	}
+	else if(kw == "try") {
+		lookahead = Token(TT_OP, start, len, TK_TRY);
+	}
+	else if(kw == "catch") {
+		lookahead = Token(TT_OP, start, len, TK_CATCH);
+	}
+	else if(kw == "fail") {
+		lookahead = Token(TT_OP, start, len, TK_FAIL);
+	}
+	else if(kw == "$") {
+		lookahead = Token(TT_OP, start, len, TK_DOLLAR);
 	}
 	else {
+		lookahead = Token(TT_IDENT, start, len, intern(kw));
+	}
+	
+	return true;
+}
+
+/**
+ * Handles the three quote styles, leaving the contents in str.
+**/
+bool Lexer::nextString() {
+	auto start = pos;
+	int q = nextChar();
+	
+	if(q != '"' && q != '\'' && q != '`') {
 		return false;
 	}
+	consumeChar();
 	
+	std::string& s = str;
+	s.clear();
+	for(int c; (c = nextChar()) != q; consumeChar()) {
+		if(c == '\0') {
+			lookahead = Token(TT_ERROR, start, pos.cur - start.cur, 0);
+			return true;
+		}
+		
+		if(c == '\\') {
+			consumeChar();
+			switch(c = nextChar()) {
+				case 'n': c = '\n'; break;
+				case 't': c = '\t'; break;
+				case 'r': c = '\r'; break;
+				case '0': c = '\0'; break;
+				case '\0':
+					lookahead = Token(TT_ERROR, start, pos.cur - start.cur, 0);
+					return true;
+				
+				default: break;
+			}
+		}
+		s += (char)c;
+	}
+	consumeChar();
+	
+	lookahead = Token(TT_STRING, start, pos.cur - start.cur, 0);
 	return true;
 }
 
 /**
- * Handles all number types, for now just decimal.
+ * Handles all number types, for now just decimal. Digits on both sides
+ *  of a point make a real. Ints too large for esp_int are TT_BIGINT,
+ *  left as digits in the source for the parser to convert.
 **/
 bool Lexer::nextNumber() {
 	auto start = pos;
-	int v = 0, c = nextChar();
+	esp_int v = 0;
+	int c = nextChar();
+	bool overflow = false;
 	
-	if(isdigit(c)) {
+	if(!isdigit(c)) {
+		return false;
+	}
+	
+	do {
+		consumeChar();
+		
+		overflow = overflow ||
+			__builtin_mul_overflow(v, 10, &v) ||
+			__builtin_add_overflow(v, c - '0', &v);
+		c = nextChar();
+	} while(isdigit(c));
+	
+	if(c == '.' && isdigit(pos.cur[1])) {
 		do {
 			consumeChar();
-			
-			v *= 10;
-			v += c - '0';
 			c = nextChar();
 		} while(isdigit(c));
 		
-		lookahead = Token(TT_INT, start, pos.cur - start.cur, v);
+		lookahead = Token(
+			TT_REAL, start, pos.cur - start.cur, strtod(start.cur, nullptr)
+		);
 		return true;
 	}
-	else {
-		return false;
-	}
+	
+	lookahead = Token(
+		overflow? TT_BIGINT : TT_INT, start, pos.cur - start.cur,
+		overflow? 0 : v
+	);
+	return true;
 }
 
 }
@@ -6,6 +6,9 @@
 **/
 
 #include <limits>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
 
 #include "common.hpp"
 #include "value.hpp"
@@ -25,51 +28,437 @@ constexpr esp_int INT_NAN = 1;
 **/
 constexpr char STR_NAN[] = "<OBJECT>";
 
-Result Function::call(Environment* env, std::vector<Value> args) {
-	if(env) {
-		env->call(this, Value::nil, args);
+/**
+ * Lenient numeric parsing of strings, which yields 0 (or NaN for reals)
+ *  rather than throwing on malformed input.
+**/
+static std::string_view trim_number(std::string_view s) {
+	while(!s.empty() && isspace(s.front())) {
+		s.remove_prefix(1);
 	}
-	else {
-		Environment env;
-		env.call(this, Value::nil, args);
+	if(!s.empty() && s.front() == '+') {
+		s.remove_prefix(1);
+	}
+	return s;
+}
+
+static esp_int parse_int(std::string_view s) {
+	s = trim_number(s);
+	esp_int v = 0;
+	std::from_chars(s.data(), s.data() + s.size(), v);
+	return v;
+}
+
+static esp_real parse_real(std::string_view s) {
+	s = trim_number(s);
+	esp_real v = REAL_NAN;
+	std::from_chars(s.data(), s.data() + s.size(), v);
+	return v;
+}
+
+Result Function::call(
+	Environment* env, const Value& self, Span<const Value> args
+) {
+	// A temporary environment would free the objects it returns
+	if(!env) {
+		env = Environment::owner(self);
 	}
+	if(!env) {
+		env = &Environment::local();
+	}
+	return env->call(this, self, args);
+}
+
+Result Function::call(Environment* env, const std::vector<Value>& args) {
+	return call(env, Value::nil, Span<const Value>{args.data(), args.size()});
 }
 
 std::string Function::disasm() {
 	std::string dis;
 	for(auto op : code) {
 		dis += op.disasm();
+		
+		// Name the key of attribute ops' caches and show constants
+		switch(op.op) {
+			case vm::OP_CONST:
+				dis += "\t; " + constants[op.bx()].toString();
+				break;
+			case vm::OP_FUNC:
+				dis += "\t; " + atom_name(functions[op.bx()]->name);
+				break;
+			case vm::OP_GETATTR:
+			case vm::OP_HASATTR:
+			case vm::OP_DELATTR:
+			case vm::OP_SETATTR:
+				dis += "\t; " + atom_name(caches[op.bx()].key);
+				break;
+			
+			default: break;
+		}
 		dis += '\n';
 	}
-	return dis;
+	
+	for(auto& h : handlers) {
+		dis += "; try [" + std::to_string(h.begin) + ", " +
+			std::to_string(h.end) + ") -> " + std::to_string(h.target) +
+			" in r" + std::to_string(h.reg) + '\n';
+	}
+	dis += "; " + std::to_string(code.size()) + " instructions, " +
+		std::to_string(slots) + " registers";
+	if(rawSize != code.size() || rawSlots != slots) {
+		dis += " (" + std::to_string(rawSize) + " instructions, " +
+			std::to_string(rawSlots) + " registers unoptimized)";
+	}
+	return dis + '\n';
+}
+
+Buffer* Buffer::alloc(size_t n) {
+	return new(::operator new(sizeof(Buffer) + n)) Buffer(n);
+}
+
+Buffer* Buffer::copy(const char* s, size_t n) {
+	auto b = alloc(n);
+	std::copy(s, s + n, b->bytes());
+	return b;
+}
+
+String::String(const char* s, size_t n)
+	:buf(Buffer::copy(s, n)), ptr(buf->bytes()), length(n),
+	left(nullptr), right(nullptr) {}
+
+String::String(Buffer* b, const char* p, size_t n)
+	:buf(b), ptr(p), length(n), left(nullptr), right(nullptr) {
+	b->incref();
+}
+
+String::String(String* l, String* r)
+	:buf(nullptr), ptr(nullptr), length(l->length + r->length),
+	left(l), right(r) {
+	l->incref();
+	r->incref();
+}
+
+/**
+ * Release rope children iteratively, ropes built by repeated appends are
+ *  as deep as they are long.
+**/
+static void release_rope(String* left, String* right) {
+	std::vector<String*> work{left, right};
+	while(!work.empty()) {
+		auto s = work.back();
+		work.pop_back();
+		
+		if(s->decref()) {
+			if(s->left) {
+				work.push_back(s->left);
+				work.push_back(s->right);
+				s->left = s->right = nullptr;
+			}
+			delete s;
+		}
+	}
+}
+
+String::~String() {
+	if(left) {
+		release_rope(left, right);
+	}
+	else if(buf) {
+		buf->release();
+	}
+}
+
+String* String::concat(String* l, String* r) {
+	if(l->length + r->length < MIN_ROPE) {
+		auto lv = l->flat(), rv = r->flat();
+		auto b = Buffer::alloc(lv.size() + rv.size());
+		std::copy(lv.begin(), lv.end(), b->bytes());
+		std::copy(rv.begin(), rv.end(), b->bytes() + lv.size());
+		
+		auto s = new String(b, b->bytes(), b->size);
+		b->release();
+		return s;
+	}
+	
+	return new String(l, r);
 }
 
-Value::Value():type(NIL), value(std::monostate()) {}
-Value::Value(const Value& v):type(v.type), value(v.value) {}
-Value::Value(bool v):type(BOOL), value(v) {}
+String* String::slice(size_t begin, size_t len) {
+	flat();
+	return new String(buf, ptr + begin, len);
+}
 
-Value::Value(int8_t v):type(INT), value((esp_int)v) {}
-Value::Value(int16_t v):type(INT), value((esp_int)v) {}
-Value::Value(int32_t v):type(INT), value((esp_int)v) {}
-Value::Value(int64_t v):type(INT), value((esp_int)v) {}
+void String::flatten() {
+	auto b = Buffer::alloc(length);
+	auto out = b->bytes();
+	
+	// In-order walk, right children are deferred on an explicit stack
+	std::vector<String*> todo{this};
+	while(!todo.empty()) {
+		auto cur = todo.back();
+		todo.pop_back();
+		
+		while(cur->isRope()) {
+			todo.push_back(cur->right);
+			cur = cur->left;
+		}
+		out = std::copy(cur->ptr, cur->ptr + cur->length, out);
+	}
+	
+	release_rope(left, right);
+	left = right = nullptr;
+	
+	buf = b;
+	ptr = b->bytes();
+}
+
+SlotArray* SlotArray::alloc(uint capacity) {
+	void* mem = ::operator new(sizeof(SlotArray) + capacity*sizeof(Value));
+	return new(mem) SlotArray(capacity);
+}
+
+SlotArray* SlotArray::copy(uint n) {
+	auto c = alloc(std::max(n, size));
+	auto src = values(), dst = c->values();
+	for(uint i = 0; i < size; ++i) {
+		new(&dst[i]) Value(src[i]);
+	}
+	c->size = size;
+	return c;
+}
+
+void SlotArray::release() {
+	if(decref()) {
+		auto v = values();
+		for(uint i = 0; i < size; ++i) {
+			v[i].~Value();
+		}
+		this->~SlotArray();
+		::operator delete(this);
+	}
+}
+
+Object::Object():shape(Shape::root()), slots(nullptr) {}
+
+Object::~Object() {
+	if(slots) {
+		slots->release();
+	}
+}
+
+void Object::copyFrom(Object* o) {
+	if(o == this) {
+		return;
+	}
+	
+	if(o->slots) {
+		o->slots->incref();
+	}
+	if(slots) {
+		slots->release();
+	}
+	
+	shape = o->shape;
+	slots = o->slots;
+	dict = o->dict;
+	
+	// A fresh copy is young, only an old one needs its new references
+	//  recorded.
+	if(gen == gc::OLD) {
+		if(slots) {
+			for(uint i = 0; i < slots->size; ++i) {
+				writeBarrier(slots->values()[i]);
+			}
+		}
+		dict.each([this](Atom, const Value& v) {
+			writeBarrier(v);
+		});
+	}
+}
+
+void Object::unshare() {
+	auto c = slots->copy(slots->capacity);
+	slots->release();
+	slots = c;
+}
+
+const Value* Object::find(Atom key) {
+	if(shape) {
+		int slot = shape->lookup(key);
+		return slot < 0? nullptr : &slots->values()[slot];
+	}
+	
+	return dict.find(key);
+}
+
+void Object::addSlot(Shape* next, Value v) {
+	writeBarrier(v);
+	
+	if(!slots) {
+		slots = SlotArray::alloc(4);
+	}
+	else if(slots->refs > 1 || slots->size == slots->capacity) {
+		auto c = slots->copy(std::min(
+			std::max(slots->size*2, 4u), (uint)Shape::MAX_SLOTS
+		));
+		slots->release();
+		slots = c;
+	}
+	
+	new(&slots->values()[slots->size++]) Value(std::move(v));
+	shape = next;
+}
+
+void Object::set(Atom key, Value v) {
+	if(shape) {
+		int slot = shape->lookup(key);
+		if(slot >= 0) {
+			setSlot(slot, std::move(v));
+			return;
+		}
+		
+		if(auto next = shape->add(key)) {
+			addSlot(next, std::move(v));
+			return;
+		}
+		
+		toDictionary();
+	}
+	
+	writeBarrier(v);
+	dict.set(key, v);
+}
+
+bool Object::del(Atom key) {
+	if(shape) {
+		if(shape->lookup(key) < 0) {
+			return false;
+		}
+		toDictionary();
+	}
+	
+	return dict.del(key);
+}
+
+void Object::toDictionary() {
+	if(slots) {
+		for(uint i = 0; i < slots->size; ++i) {
+			dict.set(shape->keys[i], slots->values()[i]);
+		}
+		slots->release();
+		slots = nullptr;
+	}
+	shape = nullptr;
+}
+
+Value::Value(bool v):bits(v? TRUE_BITS : FALSE_BITS) {}
+
+Value::Value(int8_t v):Value((int64_t)v) {}
+Value::Value(int16_t v):Value((int64_t)v) {}
+Value::Value(int32_t v):Value((int64_t)v) {}
+Value::Value(int64_t v) {
+	if(fitsSmallInt(v)) {
+		bits = tagged(TAG_INT) | ((uint64_t)v & PAYLOAD);
+	}
+	else {
+		bits = tagged(TAG_BIGINT) | (uint64_t)new BoxedInt(BigInt(v));
+	}
+}
+
+Value::Value(BigInt v) {
+	int64_t i;
+	if(v.toInt64(i) && fitsSmallInt(i)) {
+		bits = tagged(TAG_INT) | ((uint64_t)i & PAYLOAD);
+	}
+	else {
+		bits = tagged(TAG_BIGINT) | (uint64_t)new BoxedInt(std::move(v));
+	}
+}
 
 // Overload all float types to avoid type ambiguity
-Value::Value(float v):type(REAL), value((esp_real)v) {}
-Value::Value(double v):type(REAL), value((esp_real)v) {}
-Value::Value(long double v):type(REAL), value((esp_real)v) {}
+Value::Value(float v):Value((double)v) {}
+Value::Value(double v) {
+	if(v != v) {
+		bits = CANON_NAN;
+	}
+	else {
+		__builtin_memcpy(&bits, &v, sizeof(bits));
+	}
+}
+Value::Value(long double v):Value((double)v) {}
 
-Value::Value(const char* v):type(STRING), value(std::string(v)) {}
-Value::Value(const std::string& v):type(STRING), value(v) {}
+Value::Value(const char* v)
+	:bits(tagged(TAG_STRING) | (uint64_t)new String(v, strlen(v))) {}
+Value::Value(const std::string& v)
+	:bits(tagged(TAG_STRING) | (uint64_t)new String(v.data(), v.size())) {}
+
+Value::Value(String* v):bits(tagged(TAG_STRING) | (uint64_t)v) {
+	v->incref();
+}
+Value::Value(Array* v):bits(tagged(TAG_ARRAY) | (uint64_t)v) {
+	v->incref();
+}
+Value::Value(Function* v):bits(tagged(TAG_FUNCTION) | (uint64_t)v) {
+	if(v->refs == 0) {
+		v->unit->incref();
+	}
+	v->incref();
+}
+Value::Value(Object* v):bits(tagged(TAG_OBJECT) | (uint64_t)v) {}
+
+void Value::drop() {
+	if(((Shared*)asPointer())->decref()) {
+		switch(tag()) {
+			case TAG_STRING: delete asString(); break;
+			case TAG_ARRAY: asArray()->destroy(); break;
+			case TAG_FUNCTION: asFunction()->unit->release(); break;
+			default: delete asBoxedInt(); break;
+		}
+	}
+}
+
+void Value::makeImmortal() {
+	if(!isShared()) {
+		return;
+	}
+	assert(tag() == TAG_STRING || tag() == TAG_BIGINT);
+	
+	if(isString()) {
+		auto s = asString();
+		s->flat();
+		s->buf->refs = Shared::IMMORTAL;
+	}
+	((Shared*)asPointer())->refs = Shared::IMMORTAL;
+}
+
+Value::Type Value::type() const {
+	if(isReal()) {
+		return REAL;
+	}
+	
+	switch(tag()) {
+		case TAG_SPECIAL: return isNil()? NIL : BOOL;
+		case TAG_INT:
+		case TAG_BIGINT: return INT;
+		case TAG_STRING: return STRING;
+		case TAG_ARRAY: return ARRAY;
+		case TAG_OBJECT: return OBJECT;
+		case TAG_FUNCTION: return FUNCTION;
+		
+		default: return NIL;
+	}
+}
 
 bool Value::toBool() {
-	switch(type) {
+	switch(type()) {
 		case NIL: return false;
-		case BOOL: return std::get<bool>(value);
-		case INT: return std::get<esp_int>(value);
-		case REAL: return std::get<esp_real>(value);
-		case STRING: return std::get<std::string>(value).size();
+		case BOOL: return asBool();
+		case INT: return toInt();
+		case REAL: return asReal();
+		case STRING: return asString()->size();
+		case ARRAY: return asArray()->size();
 		case OBJECT: {
-			auto v = callMethod("toBool");
+			auto v = callMethod(Environment::owner(*this), ATOM_TOBOOL);
 			return v.isObject() || v.toBool();
 		}
 		
@@ -78,17 +467,21 @@ bool Value::toBool() {
 }
 
 esp_int Value::toInt() {
-	switch(type) {
+	if(isSmallInt()) {
+		return asSmallInt();
+	}
+	
+	switch(type()) {
 		case NIL: return 0;
-		case BOOL: return std::get<bool>(value);
-		case INT: return std::get<esp_int>(value);
-		case REAL: return std::get<esp_real>(value);
-		case STRING: return std::stoi(std::get<std::string>(value));
+		case BOOL: return asBool();
+		case INT: return asBoxedInt()->value.wrap();
+		case REAL: return asReal();
+		case STRING: return parse_int(asString()->flat());
 		case OBJECT: {
 			// toInt MUST return something which can be trivially
 			//  resolved to an int without further calls, otherwise
 			//  infinite loops can occur.
-			auto v = callMethod("toInt");
+			auto v = callMethod(Environment::owner(*this), ATOM_TOINT);
 			return v.isObject()? INT_NAN : v.toInt();
 		}
 		
@@ -97,17 +490,22 @@ esp_int Value::toInt() {
 }
 
 esp_real Value::toReal() {
-	switch(type) {
+	if(isReal()) {
+		return asReal();
+	}
+	
+	switch(type()) {
 		case NIL: return 0.0;
-		case BOOL: return std::get<bool>(value);
-		case INT: return std::get<esp_int>(value);
-		case REAL: return std::get<esp_real>(value);
-		case STRING: return std::stod(std::get<std::string>(value));
+		case BOOL: return asBool();
+		case INT:
+			return isSmallInt()?
+				asSmallInt() : asBoxedInt()->value.toReal();
+		case STRING: return parse_real(asString()->flat());
 		case OBJECT: {
 			// toReal MUST return something which can be trivially
 			//  resolved to a real without further calls, otherwise
 			//  infinite loops can occur.
-			auto v = callMethod("toReal");
+			auto v = callMethod(Environment::owner(*this), ATOM_TOREAL);
 			return v.isObject()? REAL_NAN : v.toReal();
 		}
 		
@@ -115,43 +513,94 @@ esp_real Value::toReal() {
 	}
 }
 
+MethodProxy Value::get(Atom k) {
+	if(isObject()) {
+		if(auto v = asObject()->find(k)) {
+			return MethodProxy(*v, *this);
+		}
+	}
+	
+	return MethodProxy(nil, *this);
+}
+
+void Value::set(Atom k, Value v) {
+	if(isObject()) {
+		asObject()->set(k, v);
+	}
+}
+
+bool Value::has(Atom k) {
+	if(isObject()) {
+		return asObject()->find(k);
+	}
+	return false;
+}
+
+bool Value::del(Atom k) {
+	if(isObject()) {
+		return asObject()->del(k);
+	}
+	return false;
+}
+
+bool Value::hasMethod(Atom k) {
+	return has(k) && get(k).isFunction();
+}
+
 MethodProxy Value::get(const std::string& k) {
-	return MethodProxy();
+	Atom a;
+	return find_atom(k, a)? get(a) : MethodProxy(nil, *this);
 }
 
 void Value::set(const std::string& k, Value v) {
-	/* TODO */
+	set(intern(k), v);
 }
 
 bool Value::has(const std::string& k) {
-	/* TODO */
-	return false;
+	Atom a;
+	return find_atom(k, a) && has(a);
 }
 
 bool Value::del(const std::string& k) {
-	/* TODO */
-	return false;
+	Atom a;
+	return find_atom(k, a) && del(a);
 }
 
 bool Value::hasMethod(const std::string& s) {
-	return has(s) && get(s).isFunction();
+	Atom a;
+	return find_atom(s, a) && hasMethod(a);
 }
 
 std::string Value::toString() {
-	switch(type) {
+	switch(type()) {
 		case NIL: return "nil";
-		case BOOL: return std::get<bool>(value)? "true" : "false";
-		case INT: return std::to_string(std::get<esp_int>(value));
-		case REAL: return std::to_string(std::get<esp_real>(value));
-		case STRING: return std::get<std::string>(value);
+		case BOOL: return asBool()? "true" : "false";
+		case INT:
+			return isSmallInt()?
+				std::to_string(asSmallInt()) :
+				asBoxedInt()->value.toString();
+		case REAL: return std::to_string(asReal());
+		case STRING: return std::string(asString()->flat());
 		case OBJECT: {
 			// toString MUST return something which can be trivially
-			//  resolved to a string without furcallMethodther calls, otherwise
+			//  resolved to a string without further calls, otherwise
 			//  infinite loops can occur.
-			auto v = callMethod("toString");
+			auto v = callMethod(Environment::owner(*this), ATOM_TOSTRING);
 			return v.isObject()? STR_NAN : v.toString();
 		}
 		
+		case ARRAY: {
+			auto a = asArray();
+			std::string out = "[";
+			for(size_t i = 0; i < a->size(); ++i) {
+				if(i) {
+					out += ", ";
+				}
+				out += a->at(i).toString();
+			}
+			return out + "]";
+		}
+		
 		case FUNCTION: return "function";
 		
 		default: return "Unknown type";
@@ -161,13 +610,121 @@ std::string Value::toString() {
 #define OVERLOAD(op) \
 	if(isObject()) { \
 		if(hasMethod(op)) { \
-			return callMethod(op, rhs); \
+			return callMethod(Environment::owner(*this), op, rhs); \
 		} \
 	}
 
-#define INT_OP(op) \
-	if(isInt()) { \
-		return Value(toInt() op rhs.toInt()); \
+/**
+ * Exact integer kernels on two int values. Pairs of immediates take an
+ *  overflow-checked fast path and only results which overflow 64 bits go
+ *  through BigInt, while those between the immediate range and 64 bits
+ *  are boxed by Value(int64_t).
+**/
+static inline BigInt int_big(const Value& v) {
+	return v.isSmallInt()? BigInt(v.asSmallInt()) : v.asBoxedInt()->value;
+}
+
+static inline esp_real int_real(const Value& v) {
+	return v.isSmallInt()? v.asSmallInt() : v.asBoxedInt()->value.toReal();
+}
+
+static inline Value as_int(Value& v) {
+	return v.isInt()? v : Value(v.toInt());
+}
+
+#define INT_KERNEL(name, check, op) \
+	static inline Value name(const Value& l, const Value& r) { \
+		esp_int v; \
+		if(l.isSmallInt() && r.isSmallInt() && \
+			!check(l.asSmallInt(), r.asSmallInt(), &v)) { \
+			return Value(v); \
+		} \
+		return Value(int_big(l) op int_big(r)); \
+	}
+
+INT_KERNEL(int_add, __builtin_add_overflow, +)
+INT_KERNEL(int_sub, __builtin_sub_overflow, -)
+INT_KERNEL(int_mul, __builtin_mul_overflow, *)
+
+static int int_cmp(const Value& l, const Value& r) {
+	if(l.isSmallInt() && r.isSmallInt()) {
+		esp_int a = l.asSmallInt(), b = r.asSmallInt();
+		return (a > b) - (a < b);
+	}
+	return BigInt::compare(int_big(l), int_big(r));
+}
+
+/**
+ * Truncating division and remainder. Ints have no infinity, so division
+ *  by zero falls back to real division like /.
+**/
+static Value int_divmod(const Value& l, const Value& r, bool mod) {
+	if(r.isSmallInt() && r.asSmallInt() == 0) {
+		esp_real x = int_real(l);
+		return Value(mod? fmod(x, 0.0) : x/0.0);
+	}
+	
+	// Immediates are 48 bits, so even SMALL_MIN/-1 can't overflow
+	if(l.isSmallInt() && r.isSmallInt()) {
+		esp_int a = l.asSmallInt(), b = r.asSmallInt();
+		return Value(mod? a%b : a/b);
+	}
+	
+	BigInt res;
+	if(mod) {
+		BigInt::divmod(int_big(l), int_big(r), nullptr, &res);
+	}
+	else {
+		BigInt::divmod(int_big(l), int_big(r), &res, nullptr);
+	}
+	return Value(std::move(res));
+}
+
+/**
+ * Left shifts longer than this fail instead of allocating the result,
+ *  which is already 2 MB.
+**/
+static constexpr esp_int MAX_SHIFT = 1 << 24;
+
+/**
+ * Shift left by n bits, or right for negative n or if right is set.
+**/
+static Result int_shift(const Value& l, esp_int n, bool right) {
+	// -INT64_MIN overflows, and a right shift that long already leaves
+	//  nothing but the sign
+	n = std::max(n, -INT64_MAX);
+	if(right) {
+		n = -n;
+	}
+	if(n > MAX_SHIFT) {
+		return Result::failure(Value("Shift count too large"));
+	}
+	
+	if(l.isSmallInt()) {
+		esp_int v = l.asSmallInt();
+		
+		// 48 bit immediates have 15 bits of headroom in 64
+		if(n >= 0 && n < 16) {
+			return Value((esp_int)((uint64_t)v << n));
+		}
+		if(n < 0) {
+			return Value(n <= -63? (v < 0? -1 : 0) : v >> -n);
+		}
+	}
+	
+	if(n >= 0) {
+		return Value(int_big(l).shl(n));
+	}
+	return Value(int_big(l).shr(-(uint64_t)n));
+}
+
+/**
+ * Arrays apply any operator element-wise, checked after the small int
+ *  fast path so it doesn't pay for them.
+**/
+#define ARRAY_OP(op) \
+	if(isArray() || rhs.isArray()) { \
+		return Array::apply(op, *this, rhs); \
 	}
 
 #define REAL_OP(op) \
@@ -180,19 +737,36 @@ std::string Value::toString() {
 		return Value(toReal() op rhs.toReal()); \
 	}
 
-#define STD_OP(op) \
-	INT_OP(op) \
+#define STD_OP(kernel, op, simd_op, atom) \
+	if(isSmallInt() && rhs.isSmallInt()) { \
+		return kernel(*this, rhs); \
+	} \
+	else ARRAY_OP(simd_op) \
+	else if(isInt()) { \
+		return kernel(*this, as_int(rhs)); \
+	} \
 	else REAL_OP(op) \
-	else OVERLOAD(#op)
+	else OVERLOAD(atom)
 
 Result Value::operator+(Value rhs) {
-	STD_OP(+)
-	return Value(toString() + rhs.toString());
+	STD_OP(int_add, +, simd::ADD, ATOM_ADD)
+	
+	// Concatenation builds a rope, only converting non-strings
+	Value l = isString()? *this : Value(toString());
+	Value r = rhs.isString()? rhs : Value(rhs.toString());
+	
+	if(l.asString()->size() == 0) {
+		return r;
+	}
+	if(r.asString()->size() == 0) {
+		return l;
+	}
+	return Value::adopt(String::concat(l.asString(), r.asString()));
 }
 Result Value::operator-(Value rhs) {
-	STD_OP(-)
+	STD_OP(int_sub, -, simd::SUB, ATOM_SUB)
 	if(rhs.isInt()) {
-		return Value(toInt() - rhs.toInt());
+		return int_sub(as_int(*this), rhs);
 	}
 	// Even if rhs isn't real, treat it like it is
 	else {
@@ -200,32 +774,36 @@ Result Value::operator-(Value rhs) {
 	}
 }
 Result Value::operator*(Value rhs) {
-	STD_OP(*)
+	STD_OP(int_mul, *, simd::MUL, ATOM_MUL)
 	else if(isString()) {
 		// Pythonic str*int
 		if(rhs.isNumber()) {
 			auto n = rhs.toInt();
-			auto period = std::get<std::string>(value).size();
+			auto str = asString()->flat();
+			auto period = str.size();
 			
-			if(n == 0) {
-				return Value("");
+			if(n <= 0) {
+				return atom_value(ATOM_EMPTY);
 			}
-			else if(n == 1 || std::get<std::string>(value).empty()) {
+			else if(n == 1 || str.empty()) {
 				return *this;
 			}
-			else if(period == 1) {
-				return Value(std::string(n, std::get<std::string>(value)[0]));
-			}
 			else {
-				std::string str;
-				str.reserve(n*period);
-				auto i = 1;
-				for(; i < n/2; i *= 2) {
-					str += str;
+				size_t total;
+				if(__builtin_mul_overflow((size_t)n, period, &total) ||
+					total > PTRDIFF_MAX) {
+					return Result::failure(Value("String too large to repeat"));
+				}
+				
+				auto b = Buffer::alloc(total);
+				auto out = b->bytes();
+				for(esp_int i = 0; i < n; ++i) {
+					out = std::copy(str.begin(), str.end(), out);
 				}
-				str.append(str, 0, n - i/2);
 				
-				return Value(str);
+				auto rep = Value::adopt(new String(b, b->bytes(), b->size));
+				b->release();
+				return rep;
 			}
 		}
 	}
@@ -233,64 +811,82 @@ Result Value::operator*(Value rhs) {
 	if(rhs.isReal()){
 		return Value(toReal() * rhs.toReal());
 	}
-	return Value(toInt() * rhs.toInt());
+	return int_mul(as_int(*this), as_int(rhs));
 }
 Result Value::operator/(Value rhs) {
-	NUMBER_OP(/)
-	else OVERLOAD("/")
+	ARRAY_OP(simd::DIV)
+	else NUMBER_OP(/)
+	else OVERLOAD(ATOM_DIV)
 	
 	return Value(toReal() / rhs.toReal());
 }
 Result Value::idiv(Value rhs) {
-	if(isNumber()) {
-		return Value(toInt() * rhs.toInt());
-	}
-	else OVERLOAD("//")
-	
-	return Value(toInt() / rhs.toInt());
+	OVERLOAD(ATOM_IDIV)
+	return int_divmod(as_int(*this), as_int(rhs), false);
 }
 Result Value::operator%(Value rhs) {
-	OVERLOAD("%")
+	// Unlike division, ints take an exact remainder, whatever their size
+	if(isInt() && rhs.isInt()) {
+		return int_divmod(*this, rhs, true);
+	}
+	OVERLOAD(ATOM_MOD)
 	return Value(fmod(toReal(), rhs.toReal()));
 }
 Result Value::imod(Value rhs) {
-	if(isNumber()) {
-		return Value(toInt() * rhs.toInt());
-	}
-	else OVERLOAD("%%")
-	
-	return Value(toInt() % rhs.toInt());
+	OVERLOAD(ATOM_IMOD)
+	return int_divmod(as_int(*this), as_int(rhs), true);
 }
 
-#define BOOL_OP(op) \
+#define BOOL_OP(op, simd_op, atom) \
 	Result Value::operator op(Value rhs) { \
-		NUMBER_OP(op) \
+		if(isInt() && rhs.isInt()) { \
+			return Value(int_cmp(*this, rhs) op 0); \
+		} \
+		else ARRAY_OP(simd_op) \
+		else NUMBER_OP(op) \
 		else if(isString()) { \
-			auto cmp = std::get<std::string>(value).compare(rhs.toString()); \
+			auto str = asString()->flat(); \
+			auto cmp = rhs.isString()? \
+				str.compare(rhs.asString()->flat()) : \
+				str.compare(rhs.toString()); \
 			return Value(cmp op 0); \
 		} \
-		else OVERLOAD(#op) \
+		else OVERLOAD(atom) \
 		return Value(toReal() op rhs.toReal()); \
 	}
 
-BOOL_OP(>)
-BOOL_OP(>=)
-BOOL_OP(<)
-BOOL_OP(<=)
-BOOL_OP(!=)
-BOOL_OP(==)
+BOOL_OP(>, simd::GT, ATOM_GT)
+BOOL_OP(>=, simd::GTE, ATOM_GTE)
+BOOL_OP(<, simd::LT, ATOM_LT)
+BOOL_OP(<=, simd::LTE, ATOM_LTE)
+BOOL_OP(!=, simd::NE, ATOM_NE)
+BOOL_OP(==, simd::EQ, ATOM_EQ)
 
-#define BIT_OP(op) \
+/**
+ * Bitwise operators on immediates can't leave the immediate range, any
+ *  other operands use their low 64 bits.
+**/
+#define BIT_OP(op, atom) \
 	Result Value::operator op(Value rhs) { \
-		OVERLOAD(#op) \
+		if(isSmallInt() && rhs.isSmallInt()) { \
+			return Value(asSmallInt() op rhs.asSmallInt()); \
+		} \
+		OVERLOAD(atom) \
 		return Value(toInt() op rhs.toInt()); \
 	}
 
-BIT_OP(&)
-BIT_OP(|)
-BIT_OP(^)
-BIT_OP(<<)
-BIT_OP(>>)
+BIT_OP(&, ATOM_BAND)
+BIT_OP(|, ATOM_BOR)
+BIT_OP(^, ATOM_BXOR)
+
+Result Value::operator<<(Value rhs) {
+	OVERLOAD(ATOM_SHL)
+	return int_shift(as_int(*this), rhs.toInt(), false);
+}
+Result Value::operator>>(Value rhs) {
+	OVERLOAD(ATOM_SHR)
+	return int_shift(as_int(*this), rhs.toInt(), true);
+}
 
 Value& Value::operator++() {
 	*this = *this + Value(1);
@@ -304,7 +900,7 @@ Value& Value::operator--() {
 
 Result Value::operator-() {
 	if(isInt()) {
-		return Value(-toInt());
+		return int_sub(Value(0), *this);
 	}
 	else if(isReal()) {
 		return Value(-toReal());
@@ -314,15 +910,15 @@ Result Value::operator-() {
 		return Value(-toReal());
 	}
 	else if(isObject()) {
-		if(hasMethod("-@")) {
-			return callMethod("-@");
+		if(hasMethod(ATOM_NEG)) {
+			return callMethod(Environment::owner(*this), ATOM_NEG);
 		}
 	}
 	return REAL_NAN;
 }
 Result Value::operator+() {
 	if(isInt()) {
-		return Value(+toInt());
+		return *this;
 	}
 	else if(isReal()) {
 		return Value(+toReal());
@@ -331,34 +927,50 @@ Result Value::operator+() {
 		// TODO: Custom implementation which returns either int or real
 		return Value(+toReal());
 	}
-	else if(hasMethod("+@")) {
-		return callMethod("+@");
+	else if(hasMethod(ATOM_POS)) {
+		return callMethod(Environment::owner(*this), ATOM_POS);
 	}
 	return REAL_NAN;
 }
 Result Value::operator~() {
-	if(hasMethod("~@")) {
-		return callMethod("~@");
+	if(hasMethod(ATOM_INV)) {
+		return callMethod(Environment::owner(*this), ATOM_INV);
 	}
-	return Value(~toInt());
+	// ~x == -x - 1, which stays exact for big ints
+	return int_sub(Value(-1), as_int(*this));
 }
 Result Value::operator!() {
-	if(hasMethod("!@")) {
-		return callMethod("!@");
+	if(hasMethod(ATOM_NOT)) {
+		return callMethod(Environment::owner(*this), ATOM_NOT);
 	}
 	return Value(!toBool());
 }
 
-Result Value::call(Environment* env, Value self) {
-	std::vector<Value> als(0);
+Value Value::slice(esp_int begin, esp_int end) {
+	Value str = isString()? *this : Value(toString());
+	esp_int len = str.asString()->size();
+	
+	begin = std::max<esp_int>(0, std::min(begin, len));
+	end = std::max(begin, std::min(end, len));
+	
+	return Value::adopt(str.asString()->slice(begin, end - begin));
+}
+
+Result Value::call(
+	Environment* env, const Value& self, Span<const Value> args
+) {
 	if(isFunction()) {
-		return env->call(std::get<Function*>(value), self, als);
+		return asFunction()->call(env, self, args);
 	}
 	else {
 		return nil;
 	}
 }
 
+Result Value::call(Environment* env, Value self) {
+	return call(env, self, Span<const Value>());
+}
+
 Result Value::call(Value self) {
 	return call(nullptr, self);
 }
@@ -367,14 +979,23 @@ Result Value::call() {
 	return call(nullptr, nil);
 }
 
+Result Value::callMethod(Environment* env, Atom name) {
+	return get(name).call(env);
+}
+
+Result Value::callMethod(Atom name) {
+	return callMethod(nullptr, name);
+}
+
 Result Value::callMethod(Environment* env, const std::string& name) {
-	return get(name).call(env, *this);
+	Atom a;
+	return find_atom(name, a)? callMethod(env, a) : Result(nil);
 }
 
 Result Value::callMethod(const std::string& name) {
 	return callMethod(nullptr, name);
 }
 
-Value Value::nil;
+const Value Value::nil;
 
 }
@@ -1,153 +1,979 @@
+#include <algorithm>
+#include <cmath>
+#include <unordered_set>
+
 #include "vm.hpp"
 #include "value.hpp"
 #include "parse.hpp"
+#include "aot.hpp"
 
 namespace esp {
 namespace vm {
 
-#define IMPL_OP(op) \
-	store(pc->a, Value((load(pc->b) op load(pc->c)).value())); \
-	break;
-
 /**
- * A frame of the environment call stack.
+ * Attribute access through an inline cache. On a hit the access is a
+ *  shape compare plus an indexed load or store, on a miss the generic
+ *  lookup runs and its outcome is recorded for the object's shape.
 **/
-struct StackFrame {
-	/**
-	 * Currently executing function
-	**/
-	Function* fun;
-	/**
-	 * Program counter
-	**/
-	std::vector<Operation>::iterator pc;
+Value getattr(InlineCache& ic, const Value& obj) {
+	if(obj.isObject()) {
+		auto o = obj.asObject();
+		if(auto e = ic.find(o->shape)) {
+			return e->slot < 0? Value::nil : o->getSlot(e->slot);
+		}
+		
+		if(o->shape && !ic.isMegamorphic()) {
+			int slot = o->shape->lookup(ic.key);
+			ic.insert(o->shape, o->shape, slot);
+			return slot < 0? Value::nil : o->getSlot(slot);
+		}
+	}
 	
-	/**
-	 * Essentially the register file of this frame, with a size of fun->slots
-	**/
-	std::vector<Value> var;
+	return Value(obj).get(ic.key);
+}
+
+void setattr(InlineCache& ic, const Value& obj, Value v) {
+	if(obj.isObject()) {
+		auto o = obj.asObject();
+		if(auto e = ic.find(o->shape)) {
+			if(e->next == e->shape) {
+				o->setSlot(e->slot, std::move(v));
+			}
+			else {
+				o->addSlot(e->next, std::move(v));
+			}
+			return;
+		}
+		
+		auto before = o->shape;
+		o->set(ic.key, v);
+		
+		if(before && o->shape && !ic.isMegamorphic()) {
+			ic.insert(before, o->shape, o->shape->lookup(ic.key));
+		}
+		return;
+	}
+	
+	Value(obj).set(ic.key, v);
+}
+
+bool hasattr(InlineCache& ic, const Value& obj) {
+	if(obj.isObject()) {
+		auto o = obj.asObject();
+		if(auto e = ic.find(o->shape)) {
+			return e->slot >= 0;
+		}
+		
+		if(o->shape && !ic.isMegamorphic()) {
+			int slot = o->shape->lookup(ic.key);
+			ic.insert(o->shape, o->shape, slot);
+			return slot >= 0;
+		}
+	}
 	
+	return Value(obj).has(ic.key);
+}
+
+/**
+ * Threaded dispatch jumps from each handler straight to the next through
+ *  GCC's labels as values, so every handler ends in its own indirect
+ *  branch with its own prediction history instead of all of them sharing
+ *  the switch's. Build with -DESP_THREADED=0 for the portable switch loop.
+**/
+#ifndef ESP_THREADED
+	#ifdef __GNUC__
+		#define ESP_THREADED 1
+	#else
+		#define ESP_THREADED 0
+	#endif
+#endif
+
+/**
+ * Frozen code is quickened by every thread running it, so opcodes and
+ *  handler addresses are loaded and stored with relaxed atomics, which
+ *  are plain moves. Every form of an instruction computes the same
+ *  thing, so whichever one a thread sees is right.
+**/
+#define LOAD(at) __atomic_load_n(&(at), __ATOMIC_RELAXED)
+#define SET(at, v) __atomic_store_n(&(at), v, __ATOMIC_RELAXED)
+
+#if ESP_THREADED
 	/**
-	 * The stack machine's temporary stack
+	 * Handler addresses indexed by opcode, published by run().
 	**/
-	std::vector<Value> stack;
-	
-	StackFrame(Function* f):fun(f), pc(f->code.begin()), var(f->slots) {}
+	static const void** dispatch = nullptr;
 	
-	void push(Value v) {
-		stack.push_back(v);
+	#define CASE(op) L_##op
+	#define NEXT() ++pc; ++tp; goto *LOAD(*tp)
+	#define REDO() goto *LOAD(*tp)
+	#define JUMP(off) \
+		{ int off_ = (off) + 1; pc += off_; tp += off_; goto *LOAD(*tp); }
+	#define REWRITE(to) SET(pc->op, to); SET(*tp, dispatch[to])
+	#define RESUME() tp = fun->threaded.begin() + (pc - fun->code.begin())
+#else
+	#define CASE(op) case op
+	#define NEXT() ++pc; continue
+	#define REDO() continue
+	#define JUMP(off) \
+		{ pc += (off) + 1; continue; }
+	#define REWRITE(to) SET(pc->op, to)
+	#define RESUME()
+#endif
+
+static inline bool both_int(const Value& l, const Value& r) {
+	return l.isSmallInt() && r.isSmallInt();
+}
+static inline bool both_real(const Value& l, const Value& r) {
+	return l.isReal() && r.isReal();
+}
+
+/**
+ * Store the Result of an operation in dst, unwinding if it failed.
+**/
+#define STORE(dst, expr) { \
+	Result res_ = (expr); \
+	if(res_.isFailure()) { \
+		err = std::move(res_); \
+		goto unwind; \
+	} \
+	dst = std::move(res_); \
+}
+
+#define IMPL_OP(op) \
+	STORE(reg[pc->a], reg[pc->b] op reg[pc->c]) \
+	NEXT();
+
+/**
+ * Generic operators quicken themselves to the int or real form whenever
+ *  both operands are immediate ints or both are reals. The rewrite takes
+ *  effect the next time the instruction runs.
+**/
+#define QUICKEN(name) \
+	if(both_int(reg[pc->b], reg[pc->c])) { \
+		REWRITE(OP_##name##_II); \
+	} \
+	else if(both_real(reg[pc->b], reg[pc->c])) { \
+		REWRITE(OP_##name##_RR); \
+	}
+
+#define GENERIC_OP(name, op) \
+	CASE(OP_##name): \
+		QUICKEN(name) \
+		IMPL_OP(op)
+
+/**
+ * Quickened forms guard their operand types and rewrite themselves back
+ *  to the generic op when the guard fails, which then runs in their
+ *  place. Int results outside the immediate range take the generic path
+ *  without giving up the quickened form.
+**/
+#define GUARD(name, check) \
+	if(!check(reg[pc->b], reg[pc->c])) { \
+		REWRITE(OP_##name); \
+		REDO(); \
+	}
+
+#define INT_OP(name, builtin, op) \
+	CASE(OP_##name##_II): { \
+		GUARD(name, both_int) \
+		esp_int v; \
+		if(!builtin(reg[pc->b].asSmallInt(), reg[pc->c].asSmallInt(), &v) && \
+			Value::fitsSmallInt(v)) { \
+			reg[pc->a] = Value::fromSmallInt(v); \
+			NEXT(); \
+		} \
+		IMPL_OP(op) \
+	}
+
+#define REAL_OP(name, type, check, expr) \
+	CASE(OP_##name##_##type): { \
+		GUARD(name, check) \
+		reg[pc->a] = Value::fromReal(expr); \
+		NEXT(); \
+	}
+
+#define CMP_OP(name, op) \
+	GENERIC_OP(name, op) \
+	CASE(OP_##name##_II): \
+		GUARD(name, both_int) \
+		reg[pc->a] = Value::fromBool( \
+			reg[pc->b].asSmallInt() op reg[pc->c].asSmallInt() \
+		); \
+		NEXT(); \
+	CASE(OP_##name##_RR): \
+		GUARD(name, both_real) \
+		reg[pc->a] = Value::fromBool( \
+			reg[pc->b].asReal() op reg[pc->c].asReal() \
+		); \
+		NEXT();
+
+/**
+ * a <- b + delta, quickened on the type of b alone.
+**/
+#define STEP_OP(name, op) \
+	CASE(OP_##name): \
+		if(reg[pc->b].isSmallInt()) { \
+			REWRITE(OP_##name##_I); \
+		} \
+		else if(reg[pc->b].isReal()) { \
+			REWRITE(OP_##name##_R); \
+		} \
+		STORE(reg[pc->a], reg[pc->b] op Value::fromSmallInt(1)) \
+		NEXT(); \
+	CASE(OP_##name##_I): { \
+		if(!reg[pc->b].isSmallInt()) { \
+			REWRITE(OP_##name); \
+			REDO(); \
+		} \
+		esp_int v = reg[pc->b].asSmallInt() op 1; \
+		reg[pc->a] = Value::fitsSmallInt(v)? \
+			Value::fromSmallInt(v) : Value(v); \
+		NEXT(); \
+	} \
+	CASE(OP_##name##_R): \
+		if(!reg[pc->b].isReal()) { \
+			REWRITE(OP_##name); \
+			REDO(); \
+		} \
+		reg[pc->a] = Value::fromReal(reg[pc->b].asReal() op 1); \
+		NEXT();
+
+/**
+ * Make room for fn's registers starting at base, of which the caller
+ *  has filled (or is about to fill) the first n. The rest start out nil.
+ *  Returns the registers.
+**/
+static inline Value* window(
+	Environment* env, Function* fn, size_t base, uint n, uint& size
+) {
+	size = std::max(fn->slots, n);
+	auto& stack = env->stack;
+	if(base + size > stack.size()) {
+		stack.resize(std::max(base + size, stack.size()*2));
 	}
 	
-	Value pop() {
-		Value top = stack.back();
-		stack.pop_back();
-		return top;
+	Value* reg = stack.data() + base;
+	for(uint i = n; i < size; ++i) {
+		reg[i] = Value::nil;
+	}
+	return reg;
+}
+
+/**
+ * Push a frame for fn with its registers starting at base, see window.
+ *  Returns null if the stack is already as deep as it's allowed to go.
+**/
+static inline Value* enter(
+	Environment* env, Function* fn, size_t base, uint n, bool entry
+) {
+	if(env->frames.size() + env->suspendedDepth >= env->maxDepth) {
+		return nullptr;
 	}
 	
-	void store(int index, Value v) {
-		if(index < 0) {
-			stack.insert(stack.end() + index + 1, v);
-		}
-		else {
-			var[index] = v;
+	uint size;
+	Value* reg = window(env, fn, base, n, size);
+	env->frames.push_back({fn, fn->code.begin(), base, size, entry});
+	if(!fn->frozen) {
+		++fn->calls;
+		++fn->active;
+	}
+	return reg;
+}
+
+/**
+ * Pop the innermost frame, returning whether it was a call's entry.
+**/
+static inline bool leave(Environment* env) {
+	auto& frame = env->frames.back();
+	bool entry = frame.entry;
+	if(!frame.fun->frozen) {
+		--frame.fun->active;
+	}
+	env->frames.pop_back();
+	return entry;
+}
+
+/**
+ * The handler covering pc, if any.
+**/
+static inline const Handler* handler_at(Function* fn, Operation* pc) {
+	uint32_t at = pc - fn->code.begin();
+	for(auto& h : fn->handlers) {
+		if(at >= h.begin && at < h.end) {
+			return &h;
 		}
 	}
+	return nullptr;
+}
+
+/**
+ * Replace fn's code with the same code at OPT_FULL. The old code stays
+ *  in the arena, but nothing may be running it.
+**/
+static void reoptimize(Function* fn) {
+	std::vector<Operation> code(fn->code.begin(), fn->code.end());
+	std::vector<Handler> handlers(fn->handlers.begin(), fn->handlers.end());
+	uint slots = fn->slots;
+	optimize(code, handlers, slots, OPT_FULL);
 	
-	Value load(int index) {
-		if(index < 0) {
-			// Stack variables erase themselves on access
-			auto v = stack[stack.size() + index];
-			stack.erase(stack.end() + index);
-			return v;
+	auto& arena = fn->unit->arena;
+	fn->code = arena.copy(code.data(), code.size());
+	fn->handlers = arena.copy(handlers.data(), handlers.size());
+	fn->slots = slots;
+	fn->opt = OPT_FULL;
+	prepare(fn);
+}
+
+/**
+ * Move fn up the tiers its heat has earned under env's policy. Only
+ *  called as the innermost frame enters fn, before the caller takes pc
+ *  from its code, which may be replaced. A function too busy to
+ *  reoptimize can still be compiled from its code as it is.
+**/
+static void promote(Environment* env, Function* fn) {
+	auto& tiers = env->tiers;
+	uint64_t heat = fn->calls + fn->loops;
+	
+	if(fn->tier == TIER_INTERPRETED && heat >= std::max(tiers.optimize, fn->retry)) {
+		// The innermost frame is already counted
+		if(fn->active > 1) {
+			fn->retry = heat*2;
 		}
 		else {
-			return stack[index];
+			reoptimize(fn);
+			fn->tier = TIER_OPTIMIZED;
 		}
 	}
 	
-	Result exec(Environment* env) {
-		for(;pc != fun->code.end(); ++pc) {
-			switch(pc->op) {
-				case OP_NOP: continue;
-				
-				case OP_NIL:
-					store(pc->a, Value::nil);
-					break;
-				
-				case OP_BOOL:
-					store(pc->a, Value(!!pc->b));
-					break;
-				
-				case OP_IMM:
-					store(pc->a, Value(pc->b));
-					break;
-				
-				case OP_MOVE:
-					if(pc->c) {
-						store(pc->a, load(pc->b));
-					}
-					else if(pc->b < 0) {
-						store(pc->a, stack[stack.size() + pc->b - 1]);
-					}
-					else {
-						store(pc->a, stack[pc->b]);
-					}
-					
-					break;
-				
-				case OP_ADD: IMPL_OP(+);
-				case OP_SUB: IMPL_OP(-);
-				case OP_MUL: IMPL_OP(*);
-				case OP_DIV: IMPL_OP(/);
-				case OP_IDIV:
-					store(pc->a, Value((load(pc->b).idiv(load(pc->c))).value()));
-					break;
-				case OP_MOD: IMPL_OP(%);
-				case OP_IMOD:
-					store(pc->a, Value((load(pc->b).imod(load(pc->c))).value()));
-					break;
+	if(env->jit && !fn->jitTried && heat >= tiers.compile) {
+		fn->jitTried = true;
+		fn->native = jit::compile(fn);
+		if(fn->native) {
+			fn->tier = TIER_NATIVE;
+		}
+	}
+}
+
+static inline void tier_up(Environment* env, Function* fn) {
+	if(fn->tier != TIER_NATIVE && !fn->jitTried) {
+		promote(env, fn);
+	}
+}
+
+/**
+ * The interpreter loop, running the innermost frame until the frame it
+ *  was entered with returns. Calls and returns between functions stay
+ *  in the loop, so script recursion never recurses natively.
+ *
+ * Failures don't throw. They unwind frame by frame looking for a handler
+ *  covering the failing pc, or the pc of the call each caller is in,
+ *  and come out of the loop as a failed Result if the entry frame has
+ *  none.
+ *
+ * Entering a function at its start counts it and may move it up a
+ *  tier. Wherever control enters a function, at its start, after a call
+ *  or at a handler, its machine code takes over if the JIT compiled it.
+ *  That hands back the next call, return or fail to run here, or a
+ *  failure.
+ *
+ * OP_CALL places the callee's window right after the callee register,
+ *  so the self and arguments the caller left there become its r0 and up
+ *  without being copied, and the result lands in the callee register.
+ *  OP_TAILCALL moves them down to the start of the caller's own window
+ *  and replaces its frame, so tail recursion runs in constant space.
+ *
+ * Code always ends in OP_RETURN, so pc is never checked against the end.
+ *  Threaded builds call this once with no environment to publish the
+ *  handler addresses, which only exist in here.
+**/
+static Result run(Environment* env) {
+#if ESP_THREADED
+	static const void* labels[OPCODE_COUNT];
+	if(!env) {
+		std::fill(labels, labels + OPCODE_COUNT, &&L_BAD);
+		
+		#define LABEL(op) labels[op] = &&L_##op
+		LABEL(OP_NOP); LABEL(OP_NIL); LABEL(OP_BOOL); LABEL(OP_IMM);
+		LABEL(OP_MOVE); LABEL(OP_CONST); LABEL(OP_OBJECT); LABEL(OP_FUNC);
+		LABEL(OP_JMP); LABEL(OP_IF); LABEL(OP_CALL); LABEL(OP_TAILCALL);
+		LABEL(OP_RETURN); LABEL(OP_FAIL);
+		LABEL(OP_GETATTR); LABEL(OP_SETATTR);
+		LABEL(OP_HASATTR); LABEL(OP_DELATTR);
+		LABEL(OP_INC); LABEL(OP_DEC);
+		LABEL(OP_ADD); LABEL(OP_SUB); LABEL(OP_MUL); LABEL(OP_DIV);
+		LABEL(OP_IDIV); LABEL(OP_MOD); LABEL(OP_IMOD);
+		LABEL(OP_GT); LABEL(OP_GTE); LABEL(OP_LT); LABEL(OP_LTE);
+		LABEL(OP_EQ); LABEL(OP_NE);
+		
+		LABEL(OP_ADD_II); LABEL(OP_ADD_RR); LABEL(OP_ADD_SS);
+		LABEL(OP_SUB_II); LABEL(OP_SUB_RR);
+		LABEL(OP_MUL_II); LABEL(OP_MUL_RR);
+		LABEL(OP_DIV_II); LABEL(OP_DIV_RR);
+		LABEL(OP_MOD_II); LABEL(OP_MOD_RR);
+		LABEL(OP_GT_II); LABEL(OP_GT_RR); LABEL(OP_GTE_II); LABEL(OP_GTE_RR);
+		LABEL(OP_LT_II); LABEL(OP_LT_RR); LABEL(OP_LTE_II); LABEL(OP_LTE_RR);
+		LABEL(OP_EQ_II); LABEL(OP_EQ_RR); LABEL(OP_NE_II); LABEL(OP_NE_RR);
+		LABEL(OP_INC_I); LABEL(OP_INC_R); LABEL(OP_DEC_I); LABEL(OP_DEC_R);
+		#undef LABEL
+		
+		dispatch = labels;
+		return Value::nil;
+	}
+#endif
+
+	StackFrame* frame = &env->frames.back();
+	Function* fun = frame->fun;
+	Value* reg = env->stack.data() + frame->base;
+	Value err;
+
+#if ESP_THREADED
+	const void** tp;
+#endif
+	// The entry frame is new, so it starts at code which may be replaced
+	tier_up(env, fun);
+	Operation* pc = fun->code.begin();
+	goto native;
+
+#if !ESP_THREADED
+	for(;;) switch(LOAD(pc->op)) {
+#endif
+		CASE(OP_NOP): NEXT();
+		
+		CASE(OP_NIL):
+			reg[pc->a] = Value::nil;
+			NEXT();
+		
+		CASE(OP_BOOL):
+			reg[pc->a] = Value::fromBool(pc->b);
+			NEXT();
+		
+		CASE(OP_IMM):
+			reg[pc->a] = Value::fromSmallInt(pc->sbx());
+			NEXT();
+		
+		CASE(OP_MOVE):
+			reg[pc->a] = reg[pc->b];
+			NEXT();
+		
+		CASE(OP_CONST):
+			reg[pc->a] = fun->constants[pc->bx()];
+			NEXT();
+		
+		CASE(OP_OBJECT):
+			reg[pc->a] = Value(env->newObject());
+			NEXT();
+		
+		CASE(OP_FUNC):
+			reg[pc->a] = Value(fun->functions[pc->bx()]);
+			NEXT();
+		
+		CASE(OP_JMP):
+			JUMP(pc->sbx());
+		
+		CASE(OP_IF): {
+			Value& cond = reg[pc->a];
+			if(cond.isBool()? cond.asBool() : cond.toBool()) {
+				NEXT();
+			}
+			JUMP(pc->sbx());
+		}
+		
+		CASE(OP_CALL): {
+			Value& callee = reg[pc->a];
+			if(!callee.isFunction()) {
+				err = Value("Value isn't callable");
+				goto unwind;
+			}
+			
+			// Also where unwinding looks for a handler in this frame
+			frame->pc = pc;
+			Function* fn = callee.asFunction();
+			Value* r = enter(env, fn, frame->base + pc->a + 1, pc->b + 1, false);
+			if(!r) {
+				err = Value("Call stack overflow");
+				goto unwind;
+			}
+			
+			frame = &env->frames.back();
+			fun = fn;
+			reg = r;
+			tier_up(env, fun);
+			pc = fun->code.begin();
+			goto native;
+		}
+		
+		CASE(OP_TAILCALL): {
+			if(!reg[pc->a].isFunction()) {
+				err = Value("Value isn't callable");
+				goto unwind;
+			}
+			
+			// The result slot keeps the callee alive in place of the
+			//  register it's about to be moved over
+			uint n = pc->b + 1;
+			Value* args = reg + pc->a + 1;
+			reg[-1] = reg[pc->a];
+			Function* fn = reg[-1].asFunction();
+			if(!fun->frozen) {
+				--fun->active;
+			}
+			if(!fn->frozen) {
+				++(fn == fun? fn->loops : fn->calls);
+				++fn->active;
+			}
+			fun = fn;
+			for(uint i = 0; i < n; ++i) {
+				reg[i] = std::move(args[i]);
+			}
+			
+			reg = window(env, fun, frame->base, n, frame->size);
+			frame->fun = fun;
+			tier_up(env, fun);
+			pc = fun->code.begin();
+			goto native;
+		}
+		
+		CASE(OP_RETURN): {
+			reg[-1] = reg[pc->a];
+			if(leave(env)) {
+				return reg[-1];
+			}
+			
+			frame = &env->frames.back();
+			fun = frame->fun;
+			pc = frame->pc + 1;
+			reg = env->stack.data() + frame->base;
+			goto native;
+		}
+		
+		CASE(OP_FAIL):
+			err = reg[pc->a];
+			goto unwind;
+		
+		CASE(OP_GETATTR):
+			reg[pc->a] = getattr(fun->caches[pc->bx()], reg[pc->a]);
+			NEXT();
+		
+		CASE(OP_SETATTR):
+			setattr(fun->caches[pc->bx()], reg[pc->a], reg[pc->a + 1]);
+			NEXT();
+		
+		CASE(OP_HASATTR):
+			reg[pc->a] = Value(hasattr(fun->caches[pc->bx()], reg[pc->a]));
+			NEXT();
+		
+		CASE(OP_DELATTR):
+			reg[pc->a] = Value(reg[pc->a].del(fun->caches[pc->bx()].key));
+			NEXT();
+		
+		STEP_OP(INC, +)
+		STEP_OP(DEC, -)
+		
+		CASE(OP_ADD):
+			if(reg[pc->b].isString() && reg[pc->c].isString()) {
+				REWRITE(OP_ADD_SS);
+			}
+			else QUICKEN(ADD)
+			IMPL_OP(+)
+		GENERIC_OP(SUB, -)
+		GENERIC_OP(MUL, *)
+		GENERIC_OP(DIV, /)
+		CASE(OP_IDIV):
+			STORE(reg[pc->a], reg[pc->b].idiv(reg[pc->c]))
+			NEXT();
+		GENERIC_OP(MOD, %)
+		CASE(OP_IMOD):
+			STORE(reg[pc->a], reg[pc->b].imod(reg[pc->c]))
+			NEXT();
+		
+		CMP_OP(GT, >)
+		CMP_OP(GTE, >=)
+		CMP_OP(LT, <)
+		CMP_OP(LTE, <=)
+		CMP_OP(EQ, ==)
+		CMP_OP(NE, !=)
+		
+		INT_OP(ADD, __builtin_add_overflow, +)
+		INT_OP(SUB, __builtin_sub_overflow, -)
+		INT_OP(MUL, __builtin_mul_overflow, *)
+		
+		// Ints divide as reals
+		REAL_OP(DIV, II, both_int,
+			(esp_real)reg[pc->b].asSmallInt()/reg[pc->c].asSmallInt())
+		
+		// But take an exact remainder, which can't leave the immediate
+		//  range. A zero divisor takes the generic path.
+		CASE(OP_MOD_II): {
+			GUARD(MOD, both_int)
+			esp_int d = reg[pc->c].asSmallInt();
+			if(d != 0) {
+				reg[pc->a] = Value::fromSmallInt(reg[pc->b].asSmallInt() % d);
+				NEXT();
+			}
+			IMPL_OP(%)
+		}
+		
+		REAL_OP(ADD, RR, both_real, reg[pc->b].asReal() + reg[pc->c].asReal())
+		REAL_OP(SUB, RR, both_real, reg[pc->b].asReal() - reg[pc->c].asReal())
+		REAL_OP(MUL, RR, both_real, reg[pc->b].asReal()*reg[pc->c].asReal())
+		REAL_OP(DIV, RR, both_real, reg[pc->b].asReal()/reg[pc->c].asReal())
+		REAL_OP(MOD, RR, both_real,
+			fmod(reg[pc->b].asReal(), reg[pc->c].asReal()))
+		
+		CASE(OP_ADD_SS): {
+			Value &l = reg[pc->b], &r = reg[pc->c];
+			if(!l.isString() || !r.isString()) {
+				REWRITE(OP_ADD);
+				REDO();
+			}
+			if(l.asString()->size() == 0) {
+				reg[pc->a] = r;
+			}
+			else if(r.asString()->size() != 0) {
+				reg[pc->a] = Value::adopt(
+					String::concat(l.asString(), r.asString())
+				);
+			}
+			else if(pc->a != pc->b) {
+				reg[pc->a] = l;
+			}
+			NEXT();
+		}
+		
+		unwind: {
+			const Handler* h;
+			while(!(h = handler_at(fun, pc))) {
+				if(leave(env)) {
+					return Result::failure(std::move(err));
+				}
 				
-				default:
-					cout << "BAD OP" << std::endl;
-					break;
+				frame = &env->frames.back();
+				fun = frame->fun;
+				pc = frame->pc;
+				reg = env->stack.data() + frame->base;
 			}
+			
+			reg[h->reg] = std::move(err);
+			pc = fun->code.begin() + h->target;
+			goto native;
 		}
 		
-		return pop();
+		native: {
+			if(fun->native && env->jit) {
+				uint32_t at = fun->native->run(
+					reg, env, &err, pc - fun->code.begin()
+				);
+				pc = fun->code.begin() + (at & ~(jit::FAILED | jit::THREW));
+				if(at & jit::THREW) {
+					jit::rethrow();
+				}
+				if(at & jit::FAILED) {
+					goto unwind;
+				}
+			}
+			RESUME();
+			REDO();
+		}
+
+#if ESP_THREADED
+		L_BAD:
+#else
+		default:
+#endif
+			cout << "BAD OP" << std::endl;
+			NEXT();
+#if !ESP_THREADED
 	}
-};
+#endif
+}
 
-} /* namespace vm */
+std::vector<Heat> profile(Function* fn) {
+	std::vector<Heat> heats;
+	std::unordered_set<Function*> seen;
+	std::vector<Function*> work{fn};
+	while(!work.empty()) {
+		Function* f = work.back();
+		work.pop_back();
+		
+		// Nested functions can refer to each other and themselves
+		if(!seen.insert(f).second) {
+			continue;
+		}
+		heats.push_back({f, f->calls, f->loops, f->tier});
+		work.insert(work.end(), f->functions.begin(), f->functions.end());
+	}
+	
+	std::stable_sort(heats.begin(), heats.end(),
+		[](const Heat& a, const Heat& b) {
+			return a.calls + a.loops > b.calls + b.loops;
+		}
+	);
+	return heats;
+}
+
+void freeze(Function* fn, bool native) {
+	if(fn->frozen) {
+		return;
+	}
+	
+	std::unordered_set<Function*> seen{fn};
+	std::vector<Function*> work{fn};
+	while(!work.empty()) {
+		Function* f = work.back();
+		work.pop_back();
+		
+		if(f->opt < OPT_FULL) {
+			reoptimize(f);
+			f->tier = TIER_OPTIMIZED;
+		}
+		
+		// Before compiling, which leaves the counters out of frozen code,
+		//  so any code compiled while it was counting is replaced
+		f->frozen = true;
+		f->jitTried = true;
+		f->native = native? jit::compile(f) : nullptr;
+		f->tier = f->native? TIER_NATIVE : TIER_OPTIMIZED;
+		
+		for(auto& v : f->constants) {
+			v.makeImmortal();
+		}
+		
+		// Values of a nested function share a reference to the unit,
+		//  which they won't drop once it's immortal
+		if(f != fn && f->refs > 0) {
+			f->unit->release();
+		}
+		f->refs = Shared::IMMORTAL;
+		
+		for(auto g : f->functions) {
+			if(seen.insert(g).second) {
+				work.push_back(g);
+			}
+		}
+	}
+}
 
-Environment::Environment() {
+void prepare(Function* fn) {
+#if ESP_THREADED
+	// Static initialization is thread-safe, the table only needs it once
+	static const void* const* table = (run(nullptr), dispatch);
 	
+	std::vector<const void*> handlers;
+	handlers.reserve(fn->code.size());
+	for(auto& op : fn->code) {
+		handlers.push_back(table[op.op]);
+	}
+	fn->threaded = fn->unit->arena.copy(handlers.data(), handlers.size());
+#endif
 }
-Environment::~Environment() {
+
+} /* namespace vm */
+
+/**
+ * Drops whatever frames a call leaves behind if something throws, like
+ *  running out of memory, so the environment's stack is back where it
+ *  was when the call returns.
+**/
+struct FrameScope {
+	Environment* env;
+	size_t depth;
+	
+	FrameScope(Environment* e):env(e), depth(e->frames.size()) {}
+	~FrameScope() {
+		while(env->frames.size() > depth) {
+			vm::leave(env);
+		}
+	}
+};
+
+/**
+ * Sets the stack aside for a call made while another is running, see
+ *  Environment::suspended, and puts it back when the call returns.
+**/
+struct StackScope {
+	Environment* env;
+	bool nested;
+	
+	StackScope(Environment* e):env(e), nested(!e->frames.empty()) {
+		if(!nested) {
+			return;
+		}
+		
+		auto& all = env->suspended;
+		if(env->nesting == all.size()) {
+			all.emplace_back();
+			all.back().stack.resize(256);
+			all.back().frames.reserve(64);
+		}
+		
+		auto& seg = all[env->nesting++];
+		std::swap(env->stack, seg.stack);
+		std::swap(env->frames, seg.frames);
+		env->suspendedDepth += seg.frames.size();
+	}
+	~StackScope() {
+		if(nested) {
+			auto& seg = env->suspended[--env->nesting];
+			env->suspendedDepth -= seg.frames.size();
+			std::swap(env->stack, seg.stack);
+			std::swap(env->frames, seg.frames);
+		}
+	}
+};
+
+/**
+ * Self and the arguments of a host call to translated code, copied to
+ *  the native stack for it to move from. Only as many as it has
+ *  registers are copied, it ignores the rest.
+**/
+struct NativeArgs {
+	alignas(Value) unsigned char storage[(UINT8_MAX + 1)*sizeof(Value)];
+	uint n;
+	
+	NativeArgs(Function* fn, const Value& self, Span<const Value> args)
+		:n(std::min<size_t>(args.size() + 1, std::max(fn->slots, 1u))) {
+		Value* v = values();
+		new(v) Value(self);
+		for(uint i = 1; i < n; ++i) {
+			new(v + i) Value(args[i - 1]);
+		}
+	}
+	~NativeArgs() {
+		Value* v = values();
+		for(uint i = 0; i < n; ++i) {
+			v[i].~Value();
+		}
+	}
 	
+	inline Value* values() {
+		return (Value*)storage;
+	}
+};
+
+Environment::Environment()
+	:stack(256), nesting(0), suspendedDepth(0),
+	maxDepth(DEFAULT_MAX_DEPTH), jit(jit::available()),
+	tiers(DEFAULT_TIERS), heap(this) {
+	frames.reserve(64);
+}
+
+Environment::~Environment() {}
+
+Environment* Environment::owner(const Value& v) {
+	if(v.isObject()) {
+		if(auto heap = v.asObject()->heap) {
+			return heap->env;
+		}
+	}
+	return nullptr;
+}
+
+Environment& Environment::local() {
+	static thread_local Environment env;
+	return env;
+}
+
+Object* Environment::newObject() {
+	return heap.alloc();
+}
+
+Object* Environment::copyObject(Object* o) {
+	auto c = heap.alloc();
+	c->copyFrom(o);
+	return c;
+}
+
+/**
+ * One past the innermost of frames' registers.
+**/
+static size_t top_of(const std::vector<vm::StackFrame>& frames) {
+	if(frames.empty()) {
+		return 0;
+	}
+	auto& f = frames.back();
+	return f.base + f.size;
+}
+
+void Environment::traceRoots(const std::function<void(const Value&)>& visit) {
+	for(size_t k = 0; k < nesting; ++k) {
+		auto& seg = suspended[k];
+		for(size_t i = 0, n = top_of(seg.frames); i < n; ++i) {
+			visit(seg.stack[i]);
+		}
+	}
+	for(size_t i = 0, n = top(); i < n; ++i) {
+		visit(stack[i]);
+	}
+}
+
+size_t Environment::top() const {
+	return top_of(frames);
 }
 
-Result Environment::call(Function* fn, Value self, std::vector<Value> args) {
-	vm::StackFrame frame(fn);
-	for(auto a : args) {
-		frame.push(a);
+/**
+ * Host calls lay out their frame like OP_CALL would, above the innermost
+ *  frame with a slot below it for the result. Translated functions get
+ *  their self and arguments in one array instead, and since they
+ *  recurse natively, count towards aot::MAX_DEPTH like their calls to
+ *  each other rather than maxDepth.
+**/
+Result Environment::call(
+	Function* fn, const Value& self, Span<const Value> args
+) {
+	if(fn->compiled) {
+		aot::Depth depth;
+		if(depth.overflowed()) {
+			return Result::failure(Value("Call stack overflow"));
+		}
+		
+		if(!fn->frozen) {
+			++fn->calls;
+		}
+		NativeArgs regs(fn, self, args);
+		return fn->compiled(this, regs.values(), regs.n);
 	}
-	frame.push(self);
-	return frame.exec(this);
+	
+	StackScope nested(this);
+	FrameScope scope(this);
+	
+	// Entering can move the stack, and args or self with it
+	const Value* data = stack.data();
+	bool inStack = args.ptr >= data && args.ptr < data + stack.size();
+	size_t at = inStack? args.ptr - data : 0;
+	Value s = self;
+	
+	size_t base = top() + 1;
+	Value* reg = vm::enter(this, fn, base, args.size() + 1, true);
+	if(!reg) {
+		return Result::failure(Value("Call stack overflow"));
+	}
+	const Value* src = inStack? stack.data() + at : args.ptr;
+	
+	reg[0] = std::move(s);
+	for(size_t i = 0; i < args.size(); ++i) {
+		reg[i + 1] = src[i];
+	}
+	return vm::run(this);
+}
+
+Result Environment::call(
+	Function* fn, const Value& self, const std::vector<Value>& args
+) {
+	return call(fn, self, Span<const Value>{args.data(), args.size()});
 }
 
-Result Environment::call(Function* fn, std::vector<Value> args) {
-	return call(fn, Value::nil, args);
+Result Environment::call(Function* fn, const std::vector<Value>& args) {
+	return call(fn, Value::nil, Span<const Value>{args.data(), args.size()});
 }
 
 Result Environment::exec(Function* fn) {
-	vm::StackFrame frame(fn);
-	return frame.exec(this);
+	return call(fn, Value::nil, Span<const Value>());
 }
 
 Result Environment::exec(const std::string& code) {
-	auto fn = esp::parse(code);
+	auto fn = esp::parse(code, tiers.parse);
 	auto res = exec(fn);
-	delete fn;
+	fn->release();
 	return res;
 }
 